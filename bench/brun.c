@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+/*
+ * Run a command and report how long it took and its peak resident set
+ * size, for suite.sh:
+ *
+ *	brun command [ args ... ]
+ *
+ * The command's output is discarded.  One line is printed:
+ *
+ *	seconds maxrss_kb
+ *
+ * and brun exits 1 if the command didn't exit 0.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+    int
+main( int argc, char **argv )
+{
+    struct timeval	start, end;
+    struct rusage	ru;
+    pid_t		pid;
+    int			status, fd;
+    long		maxrss;
+
+    if ( argc < 2 ) {
+	fprintf( stderr, "usage: %s command [ args ... ]\n", argv[ 0 ] );
+	exit( 2 );
+    }
+
+    gettimeofday( &start, NULL );
+    switch ( pid = fork()) {
+    case -1:
+	perror( "fork" );
+	exit( 2 );
+
+    case 0:
+	if (( fd = open( "/dev/null", O_WRONLY, 0 )) < 0 ) {
+	    perror( "/dev/null" );
+	    exit( 2 );
+	}
+	if ( dup2( fd, 1 ) < 0 ) {
+	    perror( "dup2" );
+	    exit( 2 );
+	}
+	close( fd );
+	execvp( argv[ 1 ], argv + 1 );
+	perror( argv[ 1 ] );
+	exit( 2 );
+
+    default:
+	break;
+    }
+
+    if ( waitpid( pid, &status, 0 ) < 0 ) {
+	perror( "waitpid" );
+	exit( 2 );
+    }
+    gettimeofday( &end, NULL );
+
+    /* only the one child has been waited for */
+    if ( getrusage( RUSAGE_CHILDREN, &ru ) != 0 ) {
+	perror( "getrusage" );
+	exit( 2 );
+    }
+    maxrss = ru.ru_maxrss;
+#ifdef __APPLE__
+    /* in bytes, rather than kilobytes */
+    maxrss /= 1024;
+#endif /* __APPLE__ */
+
+    printf( "%.6f %ld\n", ( end.tv_sec - start.tv_sec ) +
+	    ( end.tv_usec - start.tv_usec ) / 1000000.0, maxrss );
+
+    if ( !WIFEXITED( status ) || ( WEXITSTATUS( status ) != 0 )) {
+	exit( 1 );
+    }
+    exit( 0 );
+}
@@ -0,0 +1,105 @@
+#!/bin/sh
+#
+# Time fsdiff's checksums, the same do_fcksum() path lcksum, lcreate,
+# lapply and ktcheck use, with each of several algorithms.
+#
+# usage: cksum.sh [ -b bindir ] [ -d tmpdir ] [ -R runs ] [ -s size ]
+#		[ -n files ] [ checksum ... ]
+#
+# One file of size megabytes and files small files of 1 to 16k are made
+# under tmpdir, and each is checksummed with fsdiff -1 -c checksum, by
+# default for blake3, sha1 and sha256.  The files are read once first,
+# so what's timed is the checksum rather than the disk.  Each is run
+# runs times, and the fastest is reported, one line each:
+#
+#	checksum what bytes seconds bytes/sec
+#
+# with what being "large" or "small".  brun, built by "make bench", does
+# the timing.
+#
+
+BIN=.
+RUNS=3
+SIZE=256
+FILES=2000
+TMPDIR=${TMPDIR:-/tmp}
+
+USAGE="usage: $0 [ -b bindir ] [ -d tmpdir ] [ -R runs ] [ -s size ]
+	[ -n files ] [ checksum ... ]"
+
+while getopts b:d:n:R:s: opt; do
+    case $opt in
+    b)	BIN="$OPTARG" ;;
+    d)	TMPDIR="$OPTARG" ;;
+    n)	FILES="$OPTARG" ;;
+    R)	RUNS="$OPTARG" ;;
+    s)	SIZE="$OPTARG" ;;
+    *)	echo "$USAGE" >&2
+	exit 2 ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+if [ $# -eq 0 ]; then
+    set blake3 sha1 sha256
+fi
+
+BIN=`cd "${BIN}" && pwd`
+for t in fsdiff bench/brun; do
+    if [ ! -x "${BIN}/$t" ]; then
+	echo "${BIN}/$t: not executable" >&2
+	exit 2
+    fi
+done
+BRUN="${BIN}/bench/brun"
+
+WORK="${TMPDIR}/cksum.$$"
+trap 'rm -rf "${WORK}"' 0 1 2 15
+mkdir -p "${WORK}/small" || exit 1
+
+dd if=/dev/urandom of="${WORK}/large" bs=1048576 count=$SIZE 2> /dev/null \
+	|| exit 1
+perl - "${WORK}/small" $FILES <<'EOF' || exit 1
+my ( $dir, $files ) = @ARGV;
+my $s = 1;
+
+for ( my $i = 0; $i < $files; $i++ ) {
+    $s = ( $s * 1103515245 + 12345 ) % 2147483648;
+    open( F, ">", sprintf( "%s/f%05d", $dir, $i )) or die "$i: $!\n";
+    print F "x" x ( 1 + $s % 16384 );
+    close( F );
+}
+EOF
+LBYTES=`wc -c < "${WORK}/large"`
+SBYTES=`cat "${WORK}/small"/* | wc -c`
+cat "${WORK}/large" "${WORK}/small"/* > /dev/null
+
+# time checksum what bytes dir command ...
+time_it() {
+    name=$1 what=$2 bytes=$3 dir=$4
+    shift 4
+    : > "${WORK}/runs"
+    i=0
+    while [ $i -lt $RUNS ]; do
+	( cd "$dir" && "${BRUN}" "$@" ) >> "${WORK}/runs" || {
+	    echo "$name: $* failed" >&2
+	    return 1
+	}
+	i=`expr $i + 1`
+    done
+    awk -v name=$name -v what=$what -v bytes=$bytes '
+	    NR == 1 || $1 < t { t = $1 }
+	    END { if ( t <= 0 ) t = 0.000001
+		printf "%s %s %.0f %.6f %.0f\n", name, what, bytes, t,
+		bytes / t }' "${WORK}/runs"
+}
+
+echo "# checksum what bytes seconds bytes/sec"
+
+for c in "$@"; do
+    time_it $c large $LBYTES "${WORK}" \
+	    "${BIN}/fsdiff" -1 -c $c -K /dev/null large || exit 1
+    time_it $c small $SBYTES "${WORK}" \
+	    "${BIN}/fsdiff" -C -c $c -K /dev/null -o /dev/null small || exit 1
+done
+
+exit 0
@@ -0,0 +1,265 @@
+#!/bin/sh
+#
+# Time fsdiff, lapply, lcksum and lmerge against a synthetic tree.
+#
+# usage: suite.sh [ -b bindir ] [ -d tmpdir ] [ -c checksum ] [ -R runs ]
+#		[ -F fanout ] [ -L depth ] [ -n files ] [ -s maxsize ]
+#		[ -H hardlinks ] [ -S symlinks ] [ -x excludes ] [ -r seed ]
+#
+# A tree is made under tmpdir with fanout subdirectories per directory
+# down to depth, and files regular files in each directory.  File sizes
+# run up to maxsize bytes, mostly small.  Every hardlinks'th file is a
+# hard link, every symlinks'th a symbolic link, and excludes percent of
+# the directories are excluded by the command file.  The same seed
+# makes the same tree.
+#
+# The tree's positive transcript base.T, a negative transcript neg.T for
+# one subtree, a special.T and command.K are made in tmpdir/client, with
+# the files and transcripts laid out in tmpdir/radmind as on a server.
+# Some files are then changed, removed and added, and these are timed:
+#
+#	fsdiff		fsdiff -C against command.K
+#	fsdiff-c	fsdiff -C -c checksum
+#	fsdiff-A	fsdiff -A -c checksum, making apply.T
+#	lapply		lapply -n of apply.T, without the network
+#	lcksum		lcksum -n of base.T
+#	lmerge		lmerge of neg.T over base.T, linking files
+#
+# Each is run runs times, and the fastest is reported, one line each:
+#
+#	name entries bytes seconds entries/sec bytes/sec maxrss_kb
+#
+# entries is the number of transcript lines the tool reads, bytes the
+# size of the files it could read.  maxrss_kb is the largest peak
+# resident set size seen.  brun, built by "make bench", does the timing.
+#
+
+BIN=.
+CKSUM=sha1
+RUNS=3
+FANOUT=4
+DEPTH=4
+FILES=16
+MAXSIZE=65536
+HARDLINKS=50
+SYMLINKS=40
+EXCLUDES=5
+SEED=1
+TMPDIR=${TMPDIR:-/tmp}
+
+USAGE="usage: $0 [ -b bindir ] [ -d tmpdir ] [ -c checksum ] [ -R runs ]
+	[ -F fanout ] [ -L depth ] [ -n files ] [ -s maxsize ]
+	[ -H hardlinks ] [ -S symlinks ] [ -x excludes ] [ -r seed ]"
+
+while getopts b:c:d:F:H:L:n:r:R:s:S:x: opt; do
+    case $opt in
+    b)	BIN="$OPTARG" ;;
+    c)	CKSUM="$OPTARG" ;;
+    d)	TMPDIR="$OPTARG" ;;
+    F)	FANOUT="$OPTARG" ;;
+    H)	HARDLINKS="$OPTARG" ;;
+    L)	DEPTH="$OPTARG" ;;
+    n)	FILES="$OPTARG" ;;
+    r)	SEED="$OPTARG" ;;
+    R)	RUNS="$OPTARG" ;;
+    s)	MAXSIZE="$OPTARG" ;;
+    S)	SYMLINKS="$OPTARG" ;;
+    x)	EXCLUDES="$OPTARG" ;;
+    *)	echo "$USAGE" >&2
+	exit 2 ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+if [ $# -ne 0 ]; then
+    echo "$USAGE" >&2
+    exit 2
+fi
+
+BIN=`cd "${BIN}" && pwd`
+for t in fsdiff lapply lcksum lmerge bench/brun; do
+    if [ ! -x "${BIN}/$t" ]; then
+	echo "${BIN}/$t: not executable" >&2
+	exit 2
+    fi
+done
+BRUN="${BIN}/bench/brun"
+
+WORK="${TMPDIR}/bench.$$"
+trap 'rm -rf "${WORK}"' 0 1 2 15
+TREE="${WORK}/tree"
+CLIENT="${WORK}/client"
+RADMIND="${WORK}/radmind"
+mkdir -p "${TREE}" "${CLIENT}" "${RADMIND}/transcript" "${RADMIND}/file" \
+	|| exit 1
+
+# make the tree, with fixed mtimes, and list the excluded directories
+perl - "${TREE}" $FANOUT $DEPTH $FILES $MAXSIZE $HARDLINKS $SYMLINKS \
+	$EXCLUDES $SEED > "${WORK}/excludes" <<'EOF' || exit 1
+use integer;
+my ( $root, $fanout, $depth, $files, $maxsize, $hard, $sym, $excl,
+	$seed ) = @ARGV;
+my $s = $seed;
+my $n = 0;
+my $prev;
+
+# a fixed generator, so a seed makes the same tree everywhere
+sub r { $s = ( $s * 1103515245 + 12345 ) % 2147483648; return $s; }
+
+sub mkdir_r {
+    my ( $dir, $level ) = @_;
+
+    if ( $dir ne "." ) {
+	mkdir( "$root/$dir", 0755 ) or die "$dir: $!\n";
+    }
+    if (( $level > 0 ) && ( r() % 100 < $excl )) {
+	print "$dir\n";
+    }
+    for ( my $i = 0; $i < $files; $i++ ) {
+	my $f = sprintf( "%s/f%04d", $dir, $i );
+	$n++;
+	if ( $hard && defined( $prev ) && ( $n % $hard == 0 )) {
+	    link( "$root/$prev", "$root/$f" ) or die "$f: $!\n";
+	    next;
+	}
+	if ( $sym && ( $n % $sym == 0 )) {
+	    symlink( "f0000", "$root/$f" ) or die "$f: $!\n";
+	    next;
+	}
+	# sizes are skewed towards small files, as on most systems
+	my $size = r() % ( $maxsize + 1 );
+	$size = $size * ( r() % 1024 ) / 1024 * ( r() % 1024 ) / 1024;
+	my $line = "$f " . r() . "\n";
+	open( F, ">", "$root/$f" ) or die "$f: $!\n";
+	print F substr( $line x ( $size / length( $line ) + 1 ), 0, $size );
+	close( F );
+	utime( 1000000000 + $n, 1000000000 + $n, "$root/$f" );
+	$prev = $f;
+    }
+    return if ( $level >= $depth );
+    for ( my $i = 0; $i < $fanout; $i++ ) {
+	mkdir_r( sprintf( "%s/d%02d", $dir, $i ), $level + 1 );
+    }
+}
+
+mkdir_r( ".", 0 );
+EOF
+
+# transcripts, as lcreate would leave them on the server
+( cd "${TREE}" && "${BIN}/fsdiff" -C -c ${CKSUM} -K /dev/null \
+	-o "${RADMIND}/transcript/base.T" . ) || exit 1
+( cd "${TREE}" && "${BIN}/fsdiff" -C -K /dev/null \
+	-o "${RADMIND}/transcript/neg.T" ./d00 ) || exit 1
+cp -pR "${TREE}" "${RADMIND}/file/base.T" || exit 1
+mkdir -p "${RADMIND}/file/neg.T" || exit 1
+cp -pR "${TREE}/d00" "${RADMIND}/file/neg.T/" || exit 1
+cp "${RADMIND}/transcript/base.T" "${RADMIND}/transcript/neg.T" \
+	"${CLIENT}/" || exit 1
+
+# every 97th file is special
+awk '$1 == "f" && ++n % 97 == 0 { print $2 }' \
+	"${RADMIND}/transcript/base.T" > "${WORK}/specials"
+: > "${CLIENT}/special.T"
+for f in `cat "${WORK}/specials"`; do
+    ( cd "${TREE}" && "${BIN}/fsdiff" -1 -c ${CKSUM} -K /dev/null \
+	    -o /dev/stdout "$f" ) >> "${CLIENT}/special.T" || exit 1
+done
+
+(
+    echo "p base.T"
+    echo "n neg.T"
+    sed -e 's/^/x /' "${WORK}/excludes"
+    sed -e 's/^/s /' "${WORK}/specials"
+) > "${CLIENT}/command.K"
+
+# change some of what's in the transcripts
+perl - "${TREE}" < "${RADMIND}/transcript/base.T" <<'EOF' || exit 1
+my $root = shift;
+my $n = 0;
+
+while ( <STDIN> ) {
+    my ( $type, $path ) = split;
+    next if ( $type ne "f" );
+    $n++;
+    if ( $n % 29 == 0 ) {
+	unlink( "$root/$path" ) or die "$path: $!\n";
+    } elsif ( $n % 17 == 0 ) {
+	utime( 1500000000 + $n, 1500000000 + $n, "$root/$path" );
+    } elsif ( $n % 13 == 0 ) {
+	chmod( 0600, "$root/$path" );
+    } elsif ( $n % 31 == 0 ) {
+	open( F, ">", "$root/$path.new" ) or die "$path.new: $!\n";
+	print F "$path\n";
+	close( F );
+    }
+}
+EOF
+
+ENTRIES=`wc -l < "${RADMIND}/transcript/base.T"`
+BYTES=`awk '$1 == "f" { n += $7 } END { printf "%.0f\n", n }' \
+	"${RADMIND}/transcript/base.T"`
+
+# report name entries bytes, from the brun lines in ${WORK}/runs
+report() {
+    awk -v name=$1 -v entries=$2 -v bytes=$3 '
+	    NR == 1 || $1 < t { t = $1 }
+	    $2 > rss { rss = $2 }
+	    END { if ( t <= 0 ) t = 0.000001
+		printf "%s %d %.0f %.6f %.0f %.0f %d\n", name, entries, bytes,
+		t, entries / t, bytes / t, rss }' "${WORK}/runs"
+}
+
+# time name entries bytes dir command ...
+time_it() {
+    name=$1 entries=$2 bytes=$3 dir=$4
+    shift 4
+    : > "${WORK}/runs"
+    i=0
+    while [ $i -lt $RUNS ]; do
+	( cd "$dir" && "${BRUN}" "$@" ) >> "${WORK}/runs" || {
+	    echo "$name: $* failed" >&2
+	    return 1
+	}
+	i=`expr $i + 1`
+    done
+    report $name $entries $bytes
+}
+
+echo "# name entries bytes seconds entries/sec bytes/sec maxrss_kb"
+
+time_it fsdiff $ENTRIES $BYTES "${TREE}" \
+	"${BIN}/fsdiff" -C -K "${CLIENT}/command.K" -o /dev/null . || exit 1
+time_it fsdiff-c $ENTRIES $BYTES "${TREE}" \
+	"${BIN}/fsdiff" -C -c ${CKSUM} -K "${CLIENT}/command.K" \
+	-o /dev/null . || exit 1
+time_it fsdiff-A $ENTRIES $BYTES "${TREE}" \
+	"${BIN}/fsdiff" -A -c ${CKSUM} -K "${CLIENT}/command.K" \
+	-o "${WORK}/apply.T" . || exit 1
+
+# lapply changes the tree, so each run gets a fresh copy
+: > "${WORK}/runs"
+i=0
+while [ $i -lt $RUNS ]; do
+    rm -rf "${WORK}/apply"
+    cp -pR "${TREE}" "${WORK}/apply" || exit 1
+    ( cd "${WORK}/apply" && "${BRUN}" "${BIN}/lapply" -n -q \
+	    "${WORK}/apply.T" ) >> "${WORK}/runs" || {
+	echo "lapply: ${WORK}/apply.T failed" >&2
+	exit 1
+    }
+    i=`expr $i + 1`
+done
+report lapply `wc -l < "${WORK}/apply.T"` 0
+
+time_it lcksum $ENTRIES $BYTES "${RADMIND}" \
+	"${BIN}/lcksum" -n -c ${CKSUM} -D "${RADMIND}" \
+	"${RADMIND}/transcript/base.T" || exit 1
+
+# lmerge won't write over an earlier run's result
+NEG=`wc -l < "${RADMIND}/transcript/neg.T"`
+time_it lmerge `expr $ENTRIES + $NEG` 0 "${RADMIND}" \
+	sh -c "rm -rf transcript/merged.T file/merged.T &&
+	'${BIN}/lmerge' -D '${RADMIND}' '${RADMIND}/transcript/neg.T' \
+	'${RADMIND}/transcript/base.T' '${RADMIND}/transcript/merged.T'" \
+	|| exit 1
+
+exit 0
@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Time an fsdiff walk of a single flat directory against its size.
+#
+# usage: walk.sh [ -f fsdiff ] [ -d tmpdir ] [ -j threads ] [ size ... ]
+#
+# For each size, a directory holding that many empty files is created
+# under tmpdir and fsdiff -C is run against it with an empty command
+# file.  One line per size is printed:
+#
+#	entries seconds entries/sec
+#
+
+FSDIFF=./fsdiff
+THREADS=
+TMPDIR=${TMPDIR:-/tmp}
+
+while getopts d:f:j: opt; do
+    case $opt in
+    d)	TMPDIR="$OPTARG" ;;
+    f)	FSDIFF="$OPTARG" ;;
+    j)	THREADS="$OPTARG" ;;
+    *)	echo "usage: $0 [ -f fsdiff ] [ -d tmpdir ] [ -j threads ] [ size ... ]" >&2
+	exit 2 ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+
+if [ $# -eq 0 ]; then
+    set -- 1000 10000 50000 100000 300000
+fi
+
+if [ ! -x "${FSDIFF}" ]; then
+    echo "${FSDIFF}: not executable" >&2
+    exit 2
+fi
+
+WORK="${TMPDIR}/walk.$$"
+trap 'rm -rf "${WORK}"' 0 1 2 15
+
+now() {
+    perl -MTime::HiRes=time -e 'printf "%.6f\n", time'
+}
+
+for n in "$@"; do
+    rm -rf "${WORK}"
+    mkdir -p "${WORK}/d"
+    # names are written in reverse so readdir order is far from sorted
+    (cd "${WORK}/d" && awk -v n=$n 'BEGIN { for ( i = n; i > 0; i-- )
+	    printf "f%08d\n", i * 7919 % n }' | xargs touch )
+
+    start=`now`
+    "${FSDIFF}" -C -K /dev/null ${THREADS:+-j $THREADS} -o /dev/null "${WORK}/d" \
+	    || exit 1
+    end=`now`
+
+    echo $n $start $end | awk '{ t = $3 - $2; if ( t <= 0 ) t = 0.000001;
+	    printf "%d %.3f %.0f\n", $1, t, $1 / t }'
+done
+
+exit 0
@@ -0,0 +1,1517 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+/* EVP_MD_meth_new() and friends are deprecated, but still the way in */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+
+#include "openssl_compat.h"
+#include "blake3.h"
+
+/*
+ * BLAKE3, offered as the "blake3" checksum.  Input is split into 1k
+ * chunks, each hashed on its own, and the chunks' chaining values are
+ * hashed in pairs up a binary tree to the root.  Since the chunks are
+ * independent, whole chunks are hashed several at once where the CPU
+ * can: 4 with SSE4.1, 8 with AVX2 and 16 with AVX-512, one to each
+ * lane of a vector.  Which of these to use is decided at run time, and
+ * all give the same result as the portable code.
+ *
+ * blake3_update() keeps a stack of chaining values for subtrees it's
+ * finished, and when it's given a long enough run of input hashes the
+ * largest whole subtree it can at once.  Callers get the most from the
+ * vector code by passing many chunks per call.
+ *
+ * Any run of chunks whose length is a power of two, starting at a
+ * multiple of that length, is a subtree of its own.  So a large input
+ * cut into such pieces can have each piece hashed apart, on different
+ * threads, with blake3_piece(), and the pieces' chaining values given
+ * to blake3_evp_pieces() to finish the same digest as hashing it whole.
+ *
+ * An input of a chunk or less is all root, and too short to fill the
+ * vector lanes by itself.  blake3_many() hashes many such inputs, one
+ * to a lane, for checksumming trees of small files.
+ */
+
+#define B3_CHUNK_START		0x01
+#define B3_CHUNK_END		0x02
+#define B3_PARENT		0x04
+#define B3_ROOT			0x08
+
+#define B3_MAX_DEGREE		16
+
+#if defined( __x86_64__ ) && ( defined( __clang__ ) || \
+	( defined( __GNUC__ ) && ( __GNUC__ >= 6 ))) && \
+	!defined( BLAKE3_NO_SIMD )
+#define B3_X86
+#include <immintrin.h>
+#endif
+
+static const uint32_t b3_iv[ 8 ] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+/* the order message words are used in each of the 7 rounds */
+static const uint8_t b3_schedule[ 7 ][ 16 ] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+struct b3_output {
+    uint32_t		bo_cv[ 8 ];
+    uint8_t		bo_block[ BLAKE3_BLOCK_LEN ];
+    uint8_t		bo_block_len;
+    uint64_t		bo_counter;
+    uint8_t		bo_flags;
+};
+
+/* how many chunks the hash_many kernel in use takes at once */
+static int		b3_degree = 0;
+
+static EVP_MD		*b3_md = NULL;
+
+static void	b3_detect( void );
+
+/*
+ * The G function, mixing a column or diagonal of the state v with two
+ * message words, written once for scalars and each vector type.
+ */
+#define B3_G( v, a, b, c, d, x, y, ADD, XOR, R16, R12, R8, R7 ) \
+    do { \
+	v[ a ] = ADD( ADD( v[ a ], v[ b ] ), x ); \
+	v[ d ] = R16( XOR( v[ d ], v[ a ] )); \
+	v[ c ] = ADD( v[ c ], v[ d ] ); \
+	v[ b ] = R12( XOR( v[ b ], v[ c ] )); \
+	v[ a ] = ADD( ADD( v[ a ], v[ b ] ), y ); \
+	v[ d ] = R8( XOR( v[ d ], v[ a ] )); \
+	v[ c ] = ADD( v[ c ], v[ d ] ); \
+	v[ b ] = R7( XOR( v[ b ], v[ c ] )); \
+    } while ( 0 )
+
+#define B3_ROUND( v, m, r, ADD, XOR, R16, R12, R8, R7 ) \
+    do { \
+	const uint8_t *s = b3_schedule[ r ]; \
+	B3_G( v, 0, 4, 8, 12, m[ s[ 0 ]], m[ s[ 1 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 1, 5, 9, 13, m[ s[ 2 ]], m[ s[ 3 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 2, 6, 10, 14, m[ s[ 4 ]], m[ s[ 5 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 3, 7, 11, 15, m[ s[ 6 ]], m[ s[ 7 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 0, 5, 10, 15, m[ s[ 8 ]], m[ s[ 9 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 1, 6, 11, 12, m[ s[ 10 ]], m[ s[ 11 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 2, 7, 8, 13, m[ s[ 12 ]], m[ s[ 13 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+	B3_G( v, 3, 4, 9, 14, m[ s[ 14 ]], m[ s[ 15 ]], \
+		ADD, XOR, R16, R12, R8, R7 ); \
+    } while ( 0 )
+
+#define B3_ADD( a, b )	((uint32_t)(( a ) + ( b )))
+#define B3_XOR( a, b )	(( a ) ^ ( b ))
+#define B3_ROR( x, n )	((uint32_t)((( x ) >> ( n )) | (( x ) << ( 32 - ( n )))))
+#define B3_R16( x )	B3_ROR( x, 16 )
+#define B3_R12( x )	B3_ROR( x, 12 )
+#define B3_R8( x )	B3_ROR( x, 8 )
+#define B3_R7( x )	B3_ROR( x, 7 )
+
+    static uint32_t
+b3_load32( const uint8_t *p )
+{
+    return(( (uint32_t)p[ 0 ] ) | ( (uint32_t)p[ 1 ] << 8 ) |
+	    ( (uint32_t)p[ 2 ] << 16 ) | ( (uint32_t)p[ 3 ] << 24 ));
+}
+
+    static void
+b3_store32( uint8_t *p, uint32_t w )
+{
+    p[ 0 ] = (uint8_t)w;
+    p[ 1 ] = (uint8_t)( w >> 8 );
+    p[ 2 ] = (uint8_t)( w >> 16 );
+    p[ 3 ] = (uint8_t)( w >> 24 );
+}
+
+    static void
+b3_store_cv( uint8_t *out, const uint32_t cv[ 8 ] )
+{
+    int			i;
+
+    for ( i = 0; i < 8; i++ ) {
+	b3_store32( out + 4 * i, cv[ i ] );
+    }
+}
+
+    static void
+b3_compress_pre( uint32_t v[ 16 ], const uint32_t cv[ 8 ],
+	const uint8_t *block, uint8_t block_len, uint64_t counter,
+	uint8_t flags )
+{
+    uint32_t		m[ 16 ];
+    int			i;
+
+    for ( i = 0; i < 16; i++ ) {
+	m[ i ] = b3_load32( block + 4 * i );
+    }
+    for ( i = 0; i < 8; i++ ) {
+	v[ i ] = cv[ i ];
+    }
+    v[ 8 ] = b3_iv[ 0 ];
+    v[ 9 ] = b3_iv[ 1 ];
+    v[ 10 ] = b3_iv[ 2 ];
+    v[ 11 ] = b3_iv[ 3 ];
+    v[ 12 ] = (uint32_t)counter;
+    v[ 13 ] = (uint32_t)( counter >> 32 );
+    v[ 14 ] = block_len;
+    v[ 15 ] = flags;
+
+    /* unrolled, so the schedule is known at compile time */
+    B3_ROUND( v, m, 0, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+    B3_ROUND( v, m, 1, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+    B3_ROUND( v, m, 2, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+    B3_ROUND( v, m, 3, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+    B3_ROUND( v, m, 4, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+    B3_ROUND( v, m, 5, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+    B3_ROUND( v, m, 6, B3_ADD, B3_XOR, B3_R16, B3_R12, B3_R8, B3_R7 );
+}
+
+    static void
+b3_compress( uint32_t cv[ 8 ], const uint8_t *block, uint8_t block_len,
+	uint64_t counter, uint8_t flags )
+{
+    uint32_t		v[ 16 ];
+    int			i;
+
+    b3_compress_pre( v, cv, block, block_len, counter, flags );
+    for ( i = 0; i < 8; i++ ) {
+	cv[ i ] = v[ i ] ^ v[ i + 8 ];
+    }
+}
+
+/* the full 64 bytes of output of a compression, for the root */
+    static void
+b3_compress_xof( const uint32_t cv[ 8 ], const uint8_t *block,
+	uint8_t block_len, uint64_t counter, uint8_t flags, uint8_t out[ 64 ] )
+{
+    uint32_t		v[ 16 ];
+    int			i;
+
+    b3_compress_pre( v, cv, block, block_len, counter, flags );
+    for ( i = 0; i < 8; i++ ) {
+	b3_store32( out + 4 * i, v[ i ] ^ v[ i + 8 ] );
+	b3_store32( out + 32 + 4 * i, v[ i + 8 ] ^ cv[ i ] );
+    }
+}
+
+/*
+ * Hash one run of blocks, a whole chunk or a parent, to its chaining
+ * value.
+ */
+    static void
+b3_hash_one( const uint8_t *input, size_t blocks, const uint32_t key[ 8 ],
+	uint64_t counter, uint8_t flags, uint8_t flags_start,
+	uint8_t flags_end, uint8_t out[ BLAKE3_OUT_LEN ] )
+{
+    uint32_t		cv[ 8 ];
+    uint8_t		block_flags;
+
+    memcpy( cv, key, sizeof( cv ));
+    block_flags = flags | flags_start;
+    for ( ; blocks > 0; blocks--, input += BLAKE3_BLOCK_LEN ) {
+	if ( blocks == 1 ) {
+	    block_flags |= flags_end;
+	}
+	b3_compress( cv, input, BLAKE3_BLOCK_LEN, counter, block_flags );
+	block_flags = flags;
+    }
+    b3_store_cv( out, cv );
+}
+
+/* how many blocks an input of at most a chunk is, the empty one being one */
+    static size_t
+b3_root_blocks( size_t len )
+{
+    if ( len == 0 ) {
+	return( 1 );
+    }
+    return(( len + BLAKE3_BLOCK_LEN - 1 ) / BLAKE3_BLOCK_LEN );
+}
+
+#ifdef B3_X86
+
+/*
+ * Whole inputs of at most a chunk, each its own root, hashed side by
+ * side, one to a lane.  They needn't be the same length: each one's
+ * last block is copied out and padded, and a lane that has run out of
+ * blocks keeps its chaining value while the others go on.
+ */
+struct b3_lanes {
+    const uint8_t	*bl_input[ B3_MAX_DEGREE ];
+    uint8_t		bl_last[ B3_MAX_DEGREE ][ BLAKE3_BLOCK_LEN ];
+    uint32_t		bl_last_len[ B3_MAX_DEGREE ];
+    size_t		bl_blocks[ B3_MAX_DEGREE ];
+    size_t		bl_max;
+};
+
+    static void
+b3_lanes_init( struct b3_lanes *bl, const uint8_t *const *inputs,
+	const size_t *lens, int n )
+{
+    size_t		off;
+    int			i;
+
+    bl->bl_max = 0;
+    for ( i = 0; i < n; i++ ) {
+	bl->bl_input[ i ] = inputs[ i ];
+	bl->bl_blocks[ i ] = b3_root_blocks( lens[ i ] );
+	off = ( bl->bl_blocks[ i ] - 1 ) * BLAKE3_BLOCK_LEN;
+	bl->bl_last_len[ i ] = (uint32_t)( lens[ i ] - off );
+	memset( bl->bl_last[ i ], 0, BLAKE3_BLOCK_LEN );
+	if ( bl->bl_last_len[ i ] > 0 ) {
+	    memcpy( bl->bl_last[ i ], inputs[ i ] + off, bl->bl_last_len[ i ] );
+	}
+	if ( bl->bl_blocks[ i ] > bl->bl_max ) {
+	    bl->bl_max = bl->bl_blocks[ i ];
+	}
+    }
+}
+
+/*
+ * Where block b of each of n lanes is, with its length and flags, and
+ * whether it's one the lane has, all ones, or is past its end, zero.
+ */
+    static void
+b3_lanes_block( const struct b3_lanes *bl, int n, size_t b,
+	const uint8_t **blocks, uint32_t *len, uint32_t *flags,
+	uint32_t *live )
+{
+    int			i;
+
+    for ( i = 0; i < n; i++ ) {
+	flags[ i ] = ( b == 0 ) ? B3_CHUNK_START : 0;
+	if ( b + 1 < bl->bl_blocks[ i ] ) {
+	    blocks[ i ] = bl->bl_input[ i ] + b * BLAKE3_BLOCK_LEN;
+	    len[ i ] = BLAKE3_BLOCK_LEN;
+	    live[ i ] = 0xffffffff;
+	} else {
+	    blocks[ i ] = bl->bl_last[ i ];
+	    len[ i ] = bl->bl_last_len[ i ];
+	    flags[ i ] |= B3_CHUNK_END | B3_ROOT;
+	    live[ i ] = ( b + 1 == bl->bl_blocks[ i ] ) ? 0xffffffff : 0;
+	}
+    }
+}
+
+/*
+ * The same as b3_hash_one() for 4, 8 or 16 inputs at a time, with each
+ * vector holding one word of the state for every input.  Inputs' words
+ * are little-endian, as x86 is.
+ */
+
+#define B3_SSE41	__attribute__(( target( "sse4.1" )))
+#define B3_AVX2		__attribute__(( target( "avx2" )))
+#define B3_AVX512	__attribute__(( target( "avx512f" )))
+
+B3_SSE41 static inline __m128i
+s_add( __m128i a, __m128i b )
+{
+    return( _mm_add_epi32( a, b ));
+}
+
+B3_SSE41 static inline __m128i
+s_xor( __m128i a, __m128i b )
+{
+    return( _mm_xor_si128( a, b ));
+}
+
+B3_SSE41 static inline __m128i
+s_r16( __m128i x )
+{
+    return( _mm_shuffle_epi8( x, _mm_set_epi8( 13, 12, 15, 14, 9, 8, 11, 10,
+	    5, 4, 7, 6, 1, 0, 3, 2 )));
+}
+
+B3_SSE41 static inline __m128i
+s_r12( __m128i x )
+{
+    return( _mm_or_si128( _mm_srli_epi32( x, 12 ), _mm_slli_epi32( x, 20 )));
+}
+
+B3_SSE41 static inline __m128i
+s_r8( __m128i x )
+{
+    return( _mm_shuffle_epi8( x, _mm_set_epi8( 12, 15, 14, 13, 8, 11, 10, 9,
+	    4, 7, 6, 5, 0, 3, 2, 1 )));
+}
+
+B3_SSE41 static inline __m128i
+s_r7( __m128i x )
+{
+    return( _mm_or_si128( _mm_srli_epi32( x, 7 ), _mm_slli_epi32( x, 25 )));
+}
+
+/* rows of words to columns */
+B3_SSE41 static inline void
+s_transpose( __m128i v[ 4 ] )
+{
+    __m128i		ab01, ab23, cd01, cd23;
+
+    ab01 = _mm_unpacklo_epi32( v[ 0 ], v[ 1 ] );
+    ab23 = _mm_unpackhi_epi32( v[ 0 ], v[ 1 ] );
+    cd01 = _mm_unpacklo_epi32( v[ 2 ], v[ 3 ] );
+    cd23 = _mm_unpackhi_epi32( v[ 2 ], v[ 3 ] );
+    v[ 0 ] = _mm_unpacklo_epi64( ab01, cd01 );
+    v[ 1 ] = _mm_unpackhi_epi64( ab01, cd01 );
+    v[ 2 ] = _mm_unpacklo_epi64( ab23, cd23 );
+    v[ 3 ] = _mm_unpackhi_epi64( ab23, cd23 );
+}
+
+B3_SSE41 static void
+b3_hash4_sse41( const uint8_t *const *inputs, size_t blocks,
+	const uint32_t key[ 8 ], uint64_t counter, int increment,
+	uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out )
+{
+    __m128i		h[ 8 ], v[ 16 ], m[ 16 ], lo, hi;
+    uint32_t		clo[ 4 ], chi[ 4 ];
+    uint8_t		block_flags;
+    size_t		b, off;
+    int			i, j, r;
+
+    for ( i = 0; i < 4; i++ ) {
+	clo[ i ] = (uint32_t)( counter + ( increment ? i : 0 ));
+	chi[ i ] = (uint32_t)(( counter + ( increment ? i : 0 )) >> 32 );
+    }
+    lo = _mm_loadu_si128( (const __m128i *)clo );
+    hi = _mm_loadu_si128( (const __m128i *)chi );
+    for ( i = 0; i < 8; i++ ) {
+	h[ i ] = _mm_set1_epi32( (int)key[ i ] );
+    }
+
+    block_flags = flags | flags_start;
+    for ( b = 0; b < blocks; b++ ) {
+	if ( b + 1 == blocks ) {
+	    block_flags |= flags_end;
+	}
+	off = b * BLAKE3_BLOCK_LEN;
+	for ( j = 0; j < 4; j++ ) {
+	    for ( i = 0; i < 4; i++ ) {
+		m[ 4 * j + i ] = _mm_loadu_si128(
+			(const __m128i *)( inputs[ i ] + off + 16 * j ));
+	    }
+	    s_transpose( &m[ 4 * j ] );
+	}
+
+	for ( i = 0; i < 8; i++ ) {
+	    v[ i ] = h[ i ];
+	}
+	for ( i = 0; i < 4; i++ ) {
+	    v[ 8 + i ] = _mm_set1_epi32( (int)b3_iv[ i ] );
+	}
+	v[ 12 ] = lo;
+	v[ 13 ] = hi;
+	v[ 14 ] = _mm_set1_epi32( BLAKE3_BLOCK_LEN );
+	v[ 15 ] = _mm_set1_epi32( block_flags );
+	for ( r = 0; r < 7; r++ ) {
+	    B3_ROUND( v, m, r, s_add, s_xor, s_r16, s_r12, s_r8, s_r7 );
+	}
+	for ( i = 0; i < 8; i++ ) {
+	    h[ i ] = s_xor( v[ i ], v[ i + 8 ] );
+	}
+	block_flags = flags;
+    }
+
+    s_transpose( &h[ 0 ] );
+    s_transpose( &h[ 4 ] );
+    for ( i = 0; i < 4; i++ ) {
+	_mm_storeu_si128( (__m128i *)( out + 32 * i ), h[ i ] );
+	_mm_storeu_si128( (__m128i *)( out + 32 * i + 16 ), h[ 4 + i ] );
+    }
+}
+
+/* four inputs of at most a chunk, as b3_root_one() */
+B3_SSE41 static void
+b3_roots4_sse41( const struct b3_lanes *bl, uint8_t *out )
+{
+    __m128i		h[ 8 ], v[ 16 ], m[ 16 ], keep;
+    const uint8_t	*blocks[ 4 ];
+    uint32_t		len[ 4 ], flags[ 4 ], live[ 4 ];
+    size_t		b;
+    int			i, j, r;
+
+    for ( i = 0; i < 8; i++ ) {
+	h[ i ] = _mm_set1_epi32( (int)b3_iv[ i ] );
+    }
+
+    for ( b = 0; b < bl->bl_max; b++ ) {
+	b3_lanes_block( bl, 4, b, blocks, len, flags, live );
+	for ( j = 0; j < 4; j++ ) {
+	    for ( i = 0; i < 4; i++ ) {
+		m[ 4 * j + i ] = _mm_loadu_si128(
+			(const __m128i *)( blocks[ i ] + 16 * j ));
+	    }
+	    s_transpose( &m[ 4 * j ] );
+	}
+
+	for ( i = 0; i < 8; i++ ) {
+	    v[ i ] = h[ i ];
+	}
+	for ( i = 0; i < 4; i++ ) {
+	    v[ 8 + i ] = _mm_set1_epi32( (int)b3_iv[ i ] );
+	}
+	v[ 12 ] = _mm_setzero_si128();
+	v[ 13 ] = _mm_setzero_si128();
+	v[ 14 ] = _mm_loadu_si128( (const __m128i *)len );
+	v[ 15 ] = _mm_loadu_si128( (const __m128i *)flags );
+	for ( r = 0; r < 7; r++ ) {
+	    B3_ROUND( v, m, r, s_add, s_xor, s_r16, s_r12, s_r8, s_r7 );
+	}
+	keep = _mm_loadu_si128( (const __m128i *)live );
+	for ( i = 0; i < 8; i++ ) {
+	    h[ i ] = _mm_blendv_epi8( h[ i ], s_xor( v[ i ], v[ i + 8 ] ),
+		    keep );
+	}
+    }
+
+    s_transpose( &h[ 0 ] );
+    s_transpose( &h[ 4 ] );
+    for ( i = 0; i < 4; i++ ) {
+	_mm_storeu_si128( (__m128i *)( out + 32 * i ), h[ i ] );
+	_mm_storeu_si128( (__m128i *)( out + 32 * i + 16 ), h[ 4 + i ] );
+    }
+}
+
+B3_AVX2 static inline __m256i
+a_add( __m256i a, __m256i b )
+{
+    return( _mm256_add_epi32( a, b ));
+}
+
+B3_AVX2 static inline __m256i
+a_xor( __m256i a, __m256i b )
+{
+    return( _mm256_xor_si256( a, b ));
+}
+
+B3_AVX2 static inline __m256i
+a_r16( __m256i x )
+{
+    return( _mm256_shuffle_epi8( x, _mm256_set_epi8(
+	    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+	    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2 )));
+}
+
+B3_AVX2 static inline __m256i
+a_r12( __m256i x )
+{
+    return( _mm256_or_si256( _mm256_srli_epi32( x, 12 ),
+	    _mm256_slli_epi32( x, 20 )));
+}
+
+B3_AVX2 static inline __m256i
+a_r8( __m256i x )
+{
+    return( _mm256_shuffle_epi8( x, _mm256_set_epi8(
+	    12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+	    12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1 )));
+}
+
+B3_AVX2 static inline __m256i
+a_r7( __m256i x )
+{
+    return( _mm256_or_si256( _mm256_srli_epi32( x, 7 ),
+	    _mm256_slli_epi32( x, 25 )));
+}
+
+B3_AVX2 static inline void
+a_transpose( __m256i v[ 8 ] )
+{
+    __m256i		ab0145, ab2367, cd0145, cd2367;
+    __m256i		ef0145, ef2367, gh0145, gh2367;
+    __m256i		abcd04, abcd15, abcd26, abcd37;
+    __m256i		efgh04, efgh15, efgh26, efgh37;
+
+    ab0145 = _mm256_unpacklo_epi32( v[ 0 ], v[ 1 ] );
+    ab2367 = _mm256_unpackhi_epi32( v[ 0 ], v[ 1 ] );
+    cd0145 = _mm256_unpacklo_epi32( v[ 2 ], v[ 3 ] );
+    cd2367 = _mm256_unpackhi_epi32( v[ 2 ], v[ 3 ] );
+    ef0145 = _mm256_unpacklo_epi32( v[ 4 ], v[ 5 ] );
+    ef2367 = _mm256_unpackhi_epi32( v[ 4 ], v[ 5 ] );
+    gh0145 = _mm256_unpacklo_epi32( v[ 6 ], v[ 7 ] );
+    gh2367 = _mm256_unpackhi_epi32( v[ 6 ], v[ 7 ] );
+
+    abcd04 = _mm256_unpacklo_epi64( ab0145, cd0145 );
+    abcd15 = _mm256_unpackhi_epi64( ab0145, cd0145 );
+    abcd26 = _mm256_unpacklo_epi64( ab2367, cd2367 );
+    abcd37 = _mm256_unpackhi_epi64( ab2367, cd2367 );
+    efgh04 = _mm256_unpacklo_epi64( ef0145, gh0145 );
+    efgh15 = _mm256_unpackhi_epi64( ef0145, gh0145 );
+    efgh26 = _mm256_unpacklo_epi64( ef2367, gh2367 );
+    efgh37 = _mm256_unpackhi_epi64( ef2367, gh2367 );
+
+    v[ 0 ] = _mm256_permute2x128_si256( abcd04, efgh04, 0x20 );
+    v[ 1 ] = _mm256_permute2x128_si256( abcd15, efgh15, 0x20 );
+    v[ 2 ] = _mm256_permute2x128_si256( abcd26, efgh26, 0x20 );
+    v[ 3 ] = _mm256_permute2x128_si256( abcd37, efgh37, 0x20 );
+    v[ 4 ] = _mm256_permute2x128_si256( abcd04, efgh04, 0x31 );
+    v[ 5 ] = _mm256_permute2x128_si256( abcd15, efgh15, 0x31 );
+    v[ 6 ] = _mm256_permute2x128_si256( abcd26, efgh26, 0x31 );
+    v[ 7 ] = _mm256_permute2x128_si256( abcd37, efgh37, 0x31 );
+}
+
+B3_AVX2 static void
+b3_hash8_avx2( const uint8_t *const *inputs, size_t blocks,
+	const uint32_t key[ 8 ], uint64_t counter, int increment,
+	uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out )
+{
+    __m256i		h[ 8 ], v[ 16 ], m[ 16 ], lo, hi;
+    uint32_t		clo[ 8 ], chi[ 8 ];
+    uint8_t		block_flags;
+    size_t		b, off;
+    int			i, j, r;
+
+    for ( i = 0; i < 8; i++ ) {
+	clo[ i ] = (uint32_t)( counter + ( increment ? i : 0 ));
+	chi[ i ] = (uint32_t)(( counter + ( increment ? i : 0 )) >> 32 );
+    }
+    lo = _mm256_loadu_si256( (const __m256i *)clo );
+    hi = _mm256_loadu_si256( (const __m256i *)chi );
+    for ( i = 0; i < 8; i++ ) {
+	h[ i ] = _mm256_set1_epi32( (int)key[ i ] );
+    }
+
+    block_flags = flags | flags_start;
+    for ( b = 0; b < blocks; b++ ) {
+	if ( b + 1 == blocks ) {
+	    block_flags |= flags_end;
+	}
+	off = b * BLAKE3_BLOCK_LEN;
+	for ( j = 0; j < 2; j++ ) {
+	    for ( i = 0; i < 8; i++ ) {
+		m[ 8 * j + i ] = _mm256_loadu_si256(
+			(const __m256i *)( inputs[ i ] + off + 32 * j ));
+	    }
+	    a_transpose( &m[ 8 * j ] );
+	}
+
+	for ( i = 0; i < 8; i++ ) {
+	    v[ i ] = h[ i ];
+	}
+	for ( i = 0; i < 4; i++ ) {
+	    v[ 8 + i ] = _mm256_set1_epi32( (int)b3_iv[ i ] );
+	}
+	v[ 12 ] = lo;
+	v[ 13 ] = hi;
+	v[ 14 ] = _mm256_set1_epi32( BLAKE3_BLOCK_LEN );
+	v[ 15 ] = _mm256_set1_epi32( block_flags );
+	for ( r = 0; r < 7; r++ ) {
+	    B3_ROUND( v, m, r, a_add, a_xor, a_r16, a_r12, a_r8, a_r7 );
+	}
+	for ( i = 0; i < 8; i++ ) {
+	    h[ i ] = a_xor( v[ i ], v[ i + 8 ] );
+	}
+	block_flags = flags;
+    }
+
+    a_transpose( h );
+    for ( i = 0; i < 8; i++ ) {
+	_mm256_storeu_si256( (__m256i *)( out + 32 * i ), h[ i ] );
+    }
+}
+
+B3_AVX2 static void
+b3_roots8_avx2( const struct b3_lanes *bl, uint8_t *out )
+{
+    __m256i		h[ 8 ], v[ 16 ], m[ 16 ], keep;
+    const uint8_t	*blocks[ 8 ];
+    uint32_t		len[ 8 ], flags[ 8 ], live[ 8 ];
+    size_t		b;
+    int			i, j, r;
+
+    for ( i = 0; i < 8; i++ ) {
+	h[ i ] = _mm256_set1_epi32( (int)b3_iv[ i ] );
+    }
+
+    for ( b = 0; b < bl->bl_max; b++ ) {
+	b3_lanes_block( bl, 8, b, blocks, len, flags, live );
+	for ( j = 0; j < 2; j++ ) {
+	    for ( i = 0; i < 8; i++ ) {
+		m[ 8 * j + i ] = _mm256_loadu_si256(
+			(const __m256i *)( blocks[ i ] + 32 * j ));
+	    }
+	    a_transpose( &m[ 8 * j ] );
+	}
+
+	for ( i = 0; i < 8; i++ ) {
+	    v[ i ] = h[ i ];
+	}
+	for ( i = 0; i < 4; i++ ) {
+	    v[ 8 + i ] = _mm256_set1_epi32( (int)b3_iv[ i ] );
+	}
+	v[ 12 ] = _mm256_setzero_si256();
+	v[ 13 ] = _mm256_setzero_si256();
+	v[ 14 ] = _mm256_loadu_si256( (const __m256i *)len );
+	v[ 15 ] = _mm256_loadu_si256( (const __m256i *)flags );
+	for ( r = 0; r < 7; r++ ) {
+	    B3_ROUND( v, m, r, a_add, a_xor, a_r16, a_r12, a_r8, a_r7 );
+	}
+	keep = _mm256_loadu_si256( (const __m256i *)live );
+	for ( i = 0; i < 8; i++ ) {
+	    h[ i ] = _mm256_blendv_epi8( h[ i ], a_xor( v[ i ], v[ i + 8 ] ),
+		    keep );
+	}
+    }
+
+    a_transpose( h );
+    for ( i = 0; i < 8; i++ ) {
+	_mm256_storeu_si256( (__m256i *)( out + 32 * i ), h[ i ] );
+    }
+}
+
+B3_AVX512 static inline __m512i
+z_add( __m512i a, __m512i b )
+{
+    return( _mm512_add_epi32( a, b ));
+}
+
+B3_AVX512 static inline __m512i
+z_xor( __m512i a, __m512i b )
+{
+    return( _mm512_xor_si512( a, b ));
+}
+
+B3_AVX512 static inline __m512i
+z_r16( __m512i x )
+{
+    return( _mm512_ror_epi32( x, 16 ));
+}
+
+B3_AVX512 static inline __m512i
+z_r12( __m512i x )
+{
+    return( _mm512_ror_epi32( x, 12 ));
+}
+
+B3_AVX512 static inline __m512i
+z_r8( __m512i x )
+{
+    return( _mm512_ror_epi32( x, 8 ));
+}
+
+B3_AVX512 static inline __m512i
+z_r7( __m512i x )
+{
+    return( _mm512_ror_epi32( x, 7 ));
+}
+
+/*
+ * 16 by 16: words within each 128-bit lane as a_transpose() does,
+ * then the lanes themselves.
+ */
+B3_AVX512 static inline void
+z_transpose( __m512i v[ 16 ] )
+{
+    __m512i		t[ 16 ], u[ 16 ], p, q, r, s;
+    int			i, k;
+
+    for ( i = 0; i < 16; i += 2 ) {
+	t[ i ] = _mm512_unpacklo_epi32( v[ i ], v[ i + 1 ] );
+	t[ i + 1 ] = _mm512_unpackhi_epi32( v[ i ], v[ i + 1 ] );
+    }
+    for ( i = 0; i < 16; i += 4 ) {
+	u[ i ] = _mm512_unpacklo_epi64( t[ i ], t[ i + 2 ] );
+	u[ i + 1 ] = _mm512_unpackhi_epi64( t[ i ], t[ i + 2 ] );
+	u[ i + 2 ] = _mm512_unpacklo_epi64( t[ i + 1 ], t[ i + 3 ] );
+	u[ i + 3 ] = _mm512_unpackhi_epi64( t[ i + 1 ], t[ i + 3 ] );
+    }
+
+    /* u[ 4 * q + k ] lane l is word 4 * l + k of rows 4 * q to 4 * q + 3 */
+    for ( k = 0; k < 4; k++ ) {
+	p = _mm512_shuffle_i32x4( u[ k ], u[ 4 + k ], 0x88 );
+	q = _mm512_shuffle_i32x4( u[ k ], u[ 4 + k ], 0xdd );
+	r = _mm512_shuffle_i32x4( u[ 8 + k ], u[ 12 + k ], 0x88 );
+	s = _mm512_shuffle_i32x4( u[ 8 + k ], u[ 12 + k ], 0xdd );
+	v[ k ] = _mm512_shuffle_i32x4( p, r, 0x88 );
+	v[ 4 + k ] = _mm512_shuffle_i32x4( q, s, 0x88 );
+	v[ 8 + k ] = _mm512_shuffle_i32x4( p, r, 0xdd );
+	v[ 12 + k ] = _mm512_shuffle_i32x4( q, s, 0xdd );
+    }
+}
+
+B3_AVX512 static void
+b3_hash16_avx512( const uint8_t *const *inputs, size_t blocks,
+	const uint32_t key[ 8 ], uint64_t counter, int increment,
+	uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out )
+{
+    __m512i		h[ 16 ], v[ 16 ], m[ 16 ], lo, hi;
+    uint32_t		clo[ 16 ], chi[ 16 ];
+    uint8_t		block_flags;
+    size_t		b, off;
+    int			i, r;
+
+    for ( i = 0; i < 16; i++ ) {
+	clo[ i ] = (uint32_t)( counter + ( increment ? i : 0 ));
+	chi[ i ] = (uint32_t)(( counter + ( increment ? i : 0 )) >> 32 );
+    }
+    lo = _mm512_loadu_si512( (const void *)clo );
+    hi = _mm512_loadu_si512( (const void *)chi );
+    for ( i = 0; i < 8; i++ ) {
+	h[ i ] = _mm512_set1_epi32( (int)key[ i ] );
+    }
+
+    block_flags = flags | flags_start;
+    for ( b = 0; b < blocks; b++ ) {
+	if ( b + 1 == blocks ) {
+	    block_flags |= flags_end;
+	}
+	off = b * BLAKE3_BLOCK_LEN;
+	for ( i = 0; i < 16; i++ ) {
+	    m[ i ] = _mm512_loadu_si512( (const void *)( inputs[ i ] + off ));
+	}
+	z_transpose( m );
+
+	for ( i = 0; i < 8; i++ ) {
+	    v[ i ] = h[ i ];
+	}
+	for ( i = 0; i < 4; i++ ) {
+	    v[ 8 + i ] = _mm512_set1_epi32( (int)b3_iv[ i ] );
+	}
+	v[ 12 ] = lo;
+	v[ 13 ] = hi;
+	v[ 14 ] = _mm512_set1_epi32( BLAKE3_BLOCK_LEN );
+	v[ 15 ] = _mm512_set1_epi32( block_flags );
+	for ( r = 0; r < 7; r++ ) {
+	    B3_ROUND( v, m, r, z_add, z_xor, z_r16, z_r12, z_r8, z_r7 );
+	}
+	for ( i = 0; i < 8; i++ ) {
+	    h[ i ] = z_xor( v[ i ], v[ i + 8 ] );
+	}
+	block_flags = flags;
+    }
+
+    /* the bottom half of each row is an input's chaining value */
+    for ( i = 8; i < 16; i++ ) {
+	h[ i ] = _mm512_setzero_si512();
+    }
+    z_transpose( h );
+    for ( i = 0; i < 16; i++ ) {
+	_mm256_storeu_si256( (__m256i *)( out + 32 * i ),
+		_mm512_castsi512_si256( h[ i ] ));
+    }
+}
+
+B3_AVX512 static void
+b3_roots16_avx512( const struct b3_lanes *bl, uint8_t *out )
+{
+    __m512i		h[ 16 ], v[ 16 ], m[ 16 ];
+    __mmask16		keep;
+    const uint8_t	*blocks[ 16 ];
+    uint32_t		len[ 16 ], flags[ 16 ], live[ 16 ];
+    size_t		b;
+    int			i, r;
+
+    for ( i = 0; i < 8; i++ ) {
+	h[ i ] = _mm512_set1_epi32( (int)b3_iv[ i ] );
+    }
+
+    for ( b = 0; b < bl->bl_max; b++ ) {
+	b3_lanes_block( bl, 16, b, blocks, len, flags, live );
+	for ( i = 0; i < 16; i++ ) {
+	    m[ i ] = _mm512_loadu_si512( (const void *)blocks[ i ] );
+	}
+	z_transpose( m );
+
+	for ( i = 0; i < 8; i++ ) {
+	    v[ i ] = h[ i ];
+	}
+	for ( i = 0; i < 4; i++ ) {
+	    v[ 8 + i ] = _mm512_set1_epi32( (int)b3_iv[ i ] );
+	}
+	v[ 12 ] = _mm512_setzero_si512();
+	v[ 13 ] = _mm512_setzero_si512();
+	v[ 14 ] = _mm512_loadu_si512( (const void *)len );
+	v[ 15 ] = _mm512_loadu_si512( (const void *)flags );
+	for ( r = 0; r < 7; r++ ) {
+	    B3_ROUND( v, m, r, z_add, z_xor, z_r16, z_r12, z_r8, z_r7 );
+	}
+	keep = _mm512_test_epi32_mask( _mm512_loadu_si512(
+		(const void *)live ), _mm512_set1_epi32( -1 ));
+	for ( i = 0; i < 8; i++ ) {
+	    h[ i ] = _mm512_mask_mov_epi32( h[ i ], keep,
+		    z_xor( v[ i ], v[ i + 8 ] ));
+	}
+    }
+
+    for ( i = 8; i < 16; i++ ) {
+	h[ i ] = _mm512_setzero_si512();
+    }
+    z_transpose( h );
+    for ( i = 0; i < 16; i++ ) {
+	_mm256_storeu_si256( (__m256i *)( out + 32 * i ),
+		_mm512_castsi512_si256( h[ i ] ));
+    }
+}
+
+#endif /* B3_X86 */
+
+    static void
+b3_detect( void )
+{
+    int			degree = 1;
+
+#ifdef B3_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx512f" )) {
+	degree = 16;
+    } else if ( __builtin_cpu_supports( "avx2" )) {
+	degree = 8;
+    } else if ( __builtin_cpu_supports( "sse4.1" )) {
+	degree = 4;
+    }
+#endif /* B3_X86 */
+
+    b3_degree = degree;
+}
+
+/*
+ * Hash each of n inputs of blocks blocks to a chaining value in out,
+ * as many at once as the CPU allows.  With increment, each input's
+ * counter is one more than the last's.
+ */
+    static void
+b3_hash_many( const uint8_t *const *inputs, size_t n, size_t blocks,
+	const uint32_t key[ 8 ], uint64_t counter, int increment,
+	uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out )
+{
+#ifdef B3_X86
+    if ( b3_degree >= 16 ) {
+	for ( ; n >= 16; n -= 16, inputs += 16, out += 16 * BLAKE3_OUT_LEN ) {
+	    b3_hash16_avx512( inputs, blocks, key, counter, increment,
+		    flags, flags_start, flags_end, out );
+	    counter += increment ? 16 : 0;
+	}
+    }
+    if ( b3_degree >= 8 ) {
+	for ( ; n >= 8; n -= 8, inputs += 8, out += 8 * BLAKE3_OUT_LEN ) {
+	    b3_hash8_avx2( inputs, blocks, key, counter, increment,
+		    flags, flags_start, flags_end, out );
+	    counter += increment ? 8 : 0;
+	}
+    }
+    if ( b3_degree >= 4 ) {
+	for ( ; n >= 4; n -= 4, inputs += 4, out += 4 * BLAKE3_OUT_LEN ) {
+	    b3_hash4_sse41( inputs, blocks, key, counter, increment,
+		    flags, flags_start, flags_end, out );
+	    counter += increment ? 4 : 0;
+	}
+    }
+#endif /* B3_X86 */
+
+    for ( ; n > 0; n--, inputs++, out += BLAKE3_OUT_LEN ) {
+	b3_hash_one( *inputs, blocks, key, counter, flags, flags_start,
+		flags_end, out );
+	counter += increment ? 1 : 0;
+    }
+}
+
+    static void
+b3_chunk_init( struct blake3_chunk *bc, const uint32_t key[ 8 ],
+	uint64_t counter )
+{
+    memcpy( bc->bc_cv, key, sizeof( bc->bc_cv ));
+    bc->bc_counter = counter;
+    memset( bc->bc_buf, 0, sizeof( bc->bc_buf ));
+    bc->bc_buf_len = 0;
+    bc->bc_blocks = 0;
+    bc->bc_flags = 0;
+}
+
+    static size_t
+b3_chunk_len( struct blake3_chunk *bc )
+{
+    return( BLAKE3_BLOCK_LEN * (size_t)bc->bc_blocks + bc->bc_buf_len );
+}
+
+    static uint8_t
+b3_chunk_start( struct blake3_chunk *bc )
+{
+    return(( bc->bc_blocks == 0 ) ? B3_CHUNK_START : 0 );
+}
+
+/* the last block of a chunk is kept back, as it may end the chunk */
+    static void
+b3_chunk_update( struct blake3_chunk *bc, const uint8_t *input, size_t len )
+{
+    size_t		take;
+
+    if ( bc->bc_buf_len > 0 ) {
+	take = BLAKE3_BLOCK_LEN - bc->bc_buf_len;
+	if ( take > len ) {
+	    take = len;
+	}
+	memcpy( bc->bc_buf + bc->bc_buf_len, input, take );
+	bc->bc_buf_len += take;
+	input += take;
+	len -= take;
+	if ( len == 0 ) {
+	    return;
+	}
+	b3_compress( bc->bc_cv, bc->bc_buf, BLAKE3_BLOCK_LEN, bc->bc_counter,
+		bc->bc_flags | b3_chunk_start( bc ));
+	bc->bc_blocks++;
+	bc->bc_buf_len = 0;
+	memset( bc->bc_buf, 0, sizeof( bc->bc_buf ));
+    }
+
+    for ( ; len > BLAKE3_BLOCK_LEN; len -= BLAKE3_BLOCK_LEN ) {
+	b3_compress( bc->bc_cv, input, BLAKE3_BLOCK_LEN, bc->bc_counter,
+		bc->bc_flags | b3_chunk_start( bc ));
+	bc->bc_blocks++;
+	input += BLAKE3_BLOCK_LEN;
+    }
+
+    memcpy( bc->bc_buf, input, len );
+    bc->bc_buf_len = (uint8_t)len;
+}
+
+    static void
+b3_chunk_output( struct blake3_chunk *bc, struct b3_output *bo )
+{
+    memcpy( bo->bo_cv, bc->bc_cv, sizeof( bo->bo_cv ));
+    memcpy( bo->bo_block, bc->bc_buf, sizeof( bo->bo_block ));
+    bo->bo_block_len = bc->bc_buf_len;
+    bo->bo_counter = bc->bc_counter;
+    bo->bo_flags = bc->bc_flags | b3_chunk_start( bc ) | B3_CHUNK_END;
+}
+
+    static void
+b3_parent_output( const uint8_t block[ BLAKE3_BLOCK_LEN ],
+	const uint32_t key[ 8 ], struct b3_output *bo )
+{
+    memcpy( bo->bo_cv, key, sizeof( bo->bo_cv ));
+    memcpy( bo->bo_block, block, sizeof( bo->bo_block ));
+    bo->bo_block_len = BLAKE3_BLOCK_LEN;
+    bo->bo_counter = 0;
+    bo->bo_flags = B3_PARENT;
+}
+
+    static void
+b3_output_cv( struct b3_output *bo, uint8_t out[ BLAKE3_OUT_LEN ] )
+{
+    uint32_t		cv[ 8 ];
+
+    memcpy( cv, bo->bo_cv, sizeof( cv ));
+    b3_compress( cv, bo->bo_block, bo->bo_block_len, bo->bo_counter,
+	    bo->bo_flags );
+    b3_store_cv( out, cv );
+}
+
+/* what the kernels' roots do, for one input of at most a chunk */
+    static void
+b3_root_one( const uint8_t *input, size_t len, uint8_t out[ BLAKE3_OUT_LEN ] )
+{
+    struct blake3_chunk	bc;
+    struct b3_output	bo;
+
+    b3_chunk_init( &bc, b3_iv, 0 );
+    b3_chunk_update( &bc, input, len );
+    b3_chunk_output( &bc, &bo );
+    bo.bo_flags |= B3_ROOT;
+    b3_output_cv( &bo, out );
+}
+
+/*
+ * Hash each of n inputs of at most a chunk to its digest in out, as
+ * many at once as the CPU allows.
+ */
+    static void
+b3_roots( const uint8_t *const *inputs, const size_t *lens, size_t n,
+	uint8_t *out )
+{
+#ifdef B3_X86
+    struct b3_lanes	bl;
+
+    if ( b3_degree >= 16 ) {
+	for ( ; n >= 16; n -= 16, inputs += 16, lens += 16,
+		out += 16 * BLAKE3_OUT_LEN ) {
+	    b3_lanes_init( &bl, inputs, lens, 16 );
+	    b3_roots16_avx512( &bl, out );
+	}
+    }
+    if ( b3_degree >= 8 ) {
+	for ( ; n >= 8; n -= 8, inputs += 8, lens += 8,
+		out += 8 * BLAKE3_OUT_LEN ) {
+	    b3_lanes_init( &bl, inputs, lens, 8 );
+	    b3_roots8_avx2( &bl, out );
+	}
+    }
+    if ( b3_degree >= 4 ) {
+	for ( ; n >= 4; n -= 4, inputs += 4, lens += 4,
+		out += 4 * BLAKE3_OUT_LEN ) {
+	    b3_lanes_init( &bl, inputs, lens, 4 );
+	    b3_roots4_sse41( &bl, out );
+	}
+    }
+#endif /* B3_X86 */
+
+    for ( ; n > 0; n--, inputs++, lens++, out += BLAKE3_OUT_LEN ) {
+	b3_root_one( *inputs, *lens, out );
+    }
+}
+
+/*
+ * Hash whole chunks of input, and one partial chunk at its end if
+ * there is one, to their chaining values.  Returns how many.
+ */
+    static size_t
+b3_chunks( const uint8_t *input, size_t len, const uint32_t key[ 8 ],
+	uint64_t counter, uint8_t *out )
+{
+    const uint8_t	*chunks[ B3_MAX_DEGREE ];
+    struct blake3_chunk	bc;
+    struct b3_output	bo;
+    size_t		n = 0, off = 0;
+
+    for ( ; len - off >= BLAKE3_CHUNK_LEN; off += BLAKE3_CHUNK_LEN ) {
+	chunks[ n++ ] = input + off;
+    }
+    b3_hash_many( chunks, n, BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, key,
+	    counter, 1, 0, B3_CHUNK_START, B3_CHUNK_END, out );
+    if ( off == len ) {
+	return( n );
+    }
+
+    b3_chunk_init( &bc, key, counter + n );
+    b3_chunk_update( &bc, input + off, len - off );
+    b3_chunk_output( &bc, &bo );
+    b3_output_cv( &bo, out + n * BLAKE3_OUT_LEN );
+    return( n + 1 );
+}
+
+/*
+ * Hash pairs of n chaining values to their parents' chaining values,
+ * carrying an odd one over as it is.  Returns how many.
+ */
+    static size_t
+b3_parents( const uint8_t *cvs, size_t n, const uint32_t key[ 8 ],
+	uint8_t *out )
+{
+    const uint8_t	*parents[ B3_MAX_DEGREE ];
+    size_t		p;
+
+    for ( p = 0; n - 2 * p >= 2; p++ ) {
+	parents[ p ] = cvs + 2 * p * BLAKE3_OUT_LEN;
+    }
+    b3_hash_many( parents, p, 1, key, 0, 0, B3_PARENT, 0, 0, out );
+    if ( n > 2 * p ) {
+	memcpy( out + p * BLAKE3_OUT_LEN, cvs + 2 * p * BLAKE3_OUT_LEN,
+		BLAKE3_OUT_LEN );
+	return( p + 1 );
+    }
+    return( p );
+}
+
+    static size_t
+b3_pow2_floor( uint64_t x )
+{
+    size_t		p = 1;
+
+    while ( p <= x / 2 ) {
+	p *= 2;
+    }
+    return( p );
+}
+
+/*
+ * Hash the len bytes at input, a subtree starting at chunk counter, to
+ * at most b3_degree chaining values in out, or 2 if b3_degree is 1.
+ * The left half of the tree is the largest power of two chunks short
+ * of all of them, which keeps it whole.  Returns how many.
+ */
+    static size_t
+b3_subtree_wide( const uint8_t *input, size_t len, const uint32_t key[ 8 ],
+	uint64_t counter, uint8_t *out )
+{
+    uint8_t		cvs[ 2 * B3_MAX_DEGREE * BLAKE3_OUT_LEN ];
+    size_t		left, nleft, nright, degree;
+
+    if ( len <= (size_t)b3_degree * BLAKE3_CHUNK_LEN ) {
+	return( b3_chunks( input, len, key, counter, out ));
+    }
+
+    left = b3_pow2_floor(( len - 1 ) / BLAKE3_CHUNK_LEN ) * BLAKE3_CHUNK_LEN;
+    degree = b3_degree;
+    if (( left > BLAKE3_CHUNK_LEN ) && ( degree == 1 )) {
+	degree = 2;
+    }
+    nleft = b3_subtree_wide( input, left, key, counter, cvs );
+    nright = b3_subtree_wide( input + left, len - left, key,
+	    counter + left / BLAKE3_CHUNK_LEN, cvs + degree * BLAKE3_OUT_LEN );
+
+    /* with one chunk at a time, the two halves are already a pair */
+    if ( nleft == 1 ) {
+	memcpy( out, cvs, 2 * BLAKE3_OUT_LEN );
+	return( 2 );
+    }
+    return( b3_parents( cvs, nleft + nright, key, out ));
+}
+
+/* the two chaining values at the top of a subtree of more than a chunk */
+    static void
+b3_subtree( const uint8_t *input, size_t len, const uint32_t key[ 8 ],
+	uint64_t counter, uint8_t out[ 2 * BLAKE3_OUT_LEN ] )
+{
+    uint8_t		cvs[ B3_MAX_DEGREE * BLAKE3_OUT_LEN ];
+    uint8_t		tmp[ B3_MAX_DEGREE * BLAKE3_OUT_LEN / 2 ];
+    size_t		n;
+
+    n = b3_subtree_wide( input, len, key, counter, cvs );
+    while ( n > 2 ) {
+	n = b3_parents( cvs, n, key, tmp );
+	memcpy( cvs, tmp, n * BLAKE3_OUT_LEN );
+    }
+    memcpy( out, cvs, 2 * BLAKE3_OUT_LEN );
+}
+
+    static int
+b3_popcount( uint64_t x )
+{
+    int			n;
+
+    for ( n = 0; x != 0; n++ ) {
+	x &= x - 1;
+    }
+    return( n );
+}
+
+/*
+ * Fold finished subtrees into their parents until the stack holds one
+ * chaining value per 1 bit of total, the number of chunks done.  The
+ * last is left alone while it may still be the root.
+ */
+    static void
+b3_merge( struct blake3_hasher *bh, uint64_t total )
+{
+    struct b3_output	bo;
+    uint8_t		*pair;
+    int			n;
+
+    n = b3_popcount( total );
+    while ( bh->bh_cv_len > n ) {
+	pair = bh->bh_cv_stack + ( bh->bh_cv_len - 2 ) * BLAKE3_OUT_LEN;
+	b3_parent_output( pair, bh->bh_key, &bo );
+	b3_output_cv( &bo, pair );
+	bh->bh_cv_len--;
+    }
+}
+
+    static void
+b3_push( struct blake3_hasher *bh, const uint8_t cv[ BLAKE3_OUT_LEN ],
+	uint64_t counter )
+{
+    b3_merge( bh, counter );
+    memcpy( bh->bh_cv_stack + bh->bh_cv_len * BLAKE3_OUT_LEN, cv,
+	    BLAKE3_OUT_LEN );
+    bh->bh_cv_len++;
+}
+
+    void
+blake3_init( struct blake3_hasher *bh )
+{
+    if ( b3_degree == 0 ) {
+	b3_detect();
+    }
+    memcpy( bh->bh_key, b3_iv, sizeof( bh->bh_key ));
+    b3_chunk_init( &bh->bh_chunk, bh->bh_key, 0 );
+    bh->bh_cv_len = 0;
+}
+
+    void
+blake3_update( struct blake3_hasher *bh, const void *buf, size_t len )
+{
+    const uint8_t	*input = buf;
+    struct b3_output	bo;
+    struct blake3_chunk	bc;
+    uint8_t		cv[ 2 * BLAKE3_OUT_LEN ];
+    uint64_t		counter;
+    size_t		take, sub;
+
+    /* finish a chunk begun by an earlier call */
+    if ( b3_chunk_len( &bh->bh_chunk ) > 0 ) {
+	take = BLAKE3_CHUNK_LEN - b3_chunk_len( &bh->bh_chunk );
+	if ( take > len ) {
+	    take = len;
+	}
+	b3_chunk_update( &bh->bh_chunk, input, take );
+	input += take;
+	len -= take;
+	if ( len == 0 ) {
+	    return;
+	}
+	b3_chunk_output( &bh->bh_chunk, &bo );
+	b3_output_cv( &bo, cv );
+	b3_push( bh, cv, bh->bh_chunk.bc_counter );
+	b3_chunk_init( &bh->bh_chunk, bh->bh_key,
+		bh->bh_chunk.bc_counter + 1 );
+    }
+
+    /*
+     * Whole subtrees, as large as the input and the position allow.
+     * Input that ends on a chunk boundary keeps its last chunk back,
+     * since it may yet be the root.
+     */
+    while ( len > BLAKE3_CHUNK_LEN ) {
+	counter = bh->bh_chunk.bc_counter;
+	sub = b3_pow2_floor( len );
+	while ((( sub - 1 ) & ( counter * BLAKE3_CHUNK_LEN )) != 0 ) {
+	    sub /= 2;
+	}
+	if ( sub <= BLAKE3_CHUNK_LEN ) {
+	    b3_chunk_init( &bc, bh->bh_key, counter );
+	    b3_chunk_update( &bc, input, sub );
+	    b3_chunk_output( &bc, &bo );
+	    b3_output_cv( &bo, cv );
+	    b3_push( bh, cv, counter );
+	} else {
+	    b3_subtree( input, sub, bh->bh_key, counter, cv );
+	    b3_push( bh, cv, counter );
+	    b3_push( bh, cv + BLAKE3_OUT_LEN,
+		    counter + sub / BLAKE3_CHUNK_LEN / 2 );
+	}
+	bh->bh_chunk.bc_counter += sub / BLAKE3_CHUNK_LEN;
+	input += sub;
+	len -= sub;
+    }
+
+    if ( len > 0 ) {
+	b3_chunk_update( &bh->bh_chunk, input, len );
+	b3_merge( bh, bh->bh_chunk.bc_counter );
+    }
+}
+
+    void
+blake3_final( struct blake3_hasher *bh, uint8_t *out, size_t len )
+{
+    struct b3_output	bo;
+    uint8_t		block[ BLAKE3_BLOCK_LEN ], wide[ 64 ];
+    uint64_t		counter;
+    size_t		n, take;
+
+    if ( bh->bh_cv_len == 0 ) {
+	b3_chunk_output( &bh->bh_chunk, &bo );
+    } else {
+	if ( b3_chunk_len( &bh->bh_chunk ) > 0 ) {
+	    n = bh->bh_cv_len;
+	    b3_chunk_output( &bh->bh_chunk, &bo );
+	} else {
+	    n = bh->bh_cv_len - 2;
+	    b3_parent_output( bh->bh_cv_stack + n * BLAKE3_OUT_LEN,
+		    bh->bh_key, &bo );
+	}
+	while ( n > 0 ) {
+	    n--;
+	    memcpy( block, bh->bh_cv_stack + n * BLAKE3_OUT_LEN,
+		    BLAKE3_OUT_LEN );
+	    b3_output_cv( &bo, block + BLAKE3_OUT_LEN );
+	    b3_parent_output( block, bh->bh_key, &bo );
+	}
+    }
+
+    for ( counter = 0; len > 0; counter++ ) {
+	b3_compress_xof( bo.bo_cv, bo.bo_block, bo.bo_block_len, counter,
+		bo.bo_flags | B3_ROOT, wide );
+	take = ( len < sizeof( wide )) ? len : sizeof( wide );
+	memcpy( out, wide, take );
+	out += take;
+	len -= take;
+    }
+}
+
+/*
+ * The chaining value of the len bytes at input, a piece of a larger
+ * input starting at chunk counter.  len is a power of two chunks, or
+ * less for the last piece.
+ */
+    void
+blake3_piece( const void *input, size_t len, uint64_t counter,
+	uint8_t cv[ BLAKE3_OUT_LEN ] )
+{
+    struct blake3_chunk	bc;
+    struct b3_output	bo;
+    uint8_t		pair[ 2 * BLAKE3_OUT_LEN ];
+
+    if ( b3_degree == 0 ) {
+	b3_detect();
+    }
+    if ( len <= BLAKE3_CHUNK_LEN ) {
+	b3_chunk_init( &bc, b3_iv, counter );
+	b3_chunk_update( &bc, input, len );
+	b3_chunk_output( &bc, &bo );
+    } else {
+	b3_subtree( input, len, b3_iv, counter, pair );
+	b3_parent_output( pair, b3_iv, &bo );
+    }
+    b3_output_cv( &bo, cv );
+}
+
+/*
+ * Give ctx, a blake3 digest with nothing added yet, the chaining values
+ * of all n pieces of an input, each piece bytes long but the last.  n
+ * is at least 2.  The digest can then be finished as usual.
+ */
+    void
+blake3_evp_pieces( EVP_MD_CTX *ctx, const uint8_t *cvs, size_t n,
+	size_t piece )
+{
+    struct blake3_hasher	*bh = EVP_MD_CTX_md_data( ctx );
+    size_t			i;
+
+    for ( i = 0; i < n; i++ ) {
+	b3_push( bh, cvs + i * BLAKE3_OUT_LEN, i * ( piece / BLAKE3_CHUNK_LEN ));
+    }
+}
+
+/* b3_roots() for w of blake3_many()'s inputs, put back in their places */
+    static void
+b3_roots_scatter( const uint8_t *const *in, const size_t *len,
+	const size_t *which, size_t w, uint8_t *out )
+{
+    uint8_t		digests[ B3_MAX_DEGREE * BLAKE3_OUT_LEN ];
+    size_t		k;
+
+    b3_roots( in, len, w, digests );
+    for ( k = 0; k < w; k++ ) {
+	memcpy( out + which[ k ] * BLAKE3_OUT_LEN,
+		digests + k * BLAKE3_OUT_LEN, BLAKE3_OUT_LEN );
+    }
+}
+
+/*
+ * The digests of n inputs of at most BLAKE3_CHUNK_LEN bytes each, one
+ * after another in out.  Inputs with the same number of blocks are put
+ * side by side, so no lane waits long on another.
+ */
+    void
+blake3_many( const uint8_t *const *inputs, const size_t *lens, size_t n,
+	uint8_t *out )
+{
+    const uint8_t	*in[ B3_MAX_DEGREE ];
+    size_t		len[ B3_MAX_DEGREE ], which[ B3_MAX_DEGREE ];
+    size_t		blocks, i, w = 0;
+
+    if ( b3_degree == 0 ) {
+	b3_detect();
+    }
+
+    for ( blocks = 1; blocks <= BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN;
+	    blocks++ ) {
+	for ( i = 0; i < n; i++ ) {
+	    if ( b3_root_blocks( lens[ i ] ) != blocks ) {
+		continue;
+	    }
+	    in[ w ] = inputs[ i ];
+	    len[ w ] = lens[ i ];
+	    which[ w ] = i;
+	    if ( ++w == (size_t)b3_degree ) {
+		b3_roots_scatter( in, len, which, w, out );
+		w = 0;
+	    }
+	}
+    }
+    if ( w > 0 ) {
+	b3_roots_scatter( in, len, which, w, out );
+    }
+}
+
+/* the blake3 digest, or NULL if blake3_add_digest() hasn't been called */
+    const EVP_MD *
+blake3_md( void )
+{
+    return( b3_md );
+}
+
+/* which kernel is hashing several chunks at once */
+    char *
+blake3_simd( void )
+{
+    if ( b3_degree == 0 ) {
+	b3_detect();
+    }
+    switch ( b3_degree ) {
+    case 16:
+	return( "avx512" );
+    case 8:
+	return( "avx2" );
+    case 4:
+	return( "sse4.1" );
+    default:
+	return( "portable" );
+    }
+}
+
+    static int
+b3_evp_init( EVP_MD_CTX *ctx )
+{
+    blake3_init( EVP_MD_CTX_md_data( ctx ));
+    return( 1 );
+}
+
+    static int
+b3_evp_update( EVP_MD_CTX *ctx, const void *data, size_t len )
+{
+    blake3_update( EVP_MD_CTX_md_data( ctx ), data, len );
+    return( 1 );
+}
+
+    static int
+b3_evp_final( EVP_MD_CTX *ctx, unsigned char *md )
+{
+    blake3_final( EVP_MD_CTX_md_data( ctx ), md, BLAKE3_OUT_LEN );
+    return( 1 );
+}
+
+/*
+ * Make "blake3" known to EVP_get_digestbyname(), so it can be given
+ * anywhere an OpenSSL digest can.  Call once OpenSSL's own digests are
+ * added, before any threads are started.
+ */
+    void
+blake3_add_digest( void )
+{
+    if ( b3_md != NULL ) {
+	return;
+    }
+    b3_detect();
+
+    if ((( b3_md = EVP_MD_meth_new( NID_undef, NID_undef )) == NULL ) ||
+	    !EVP_MD_meth_set_result_size( b3_md, BLAKE3_OUT_LEN ) ||
+	    !EVP_MD_meth_set_input_blocksize( b3_md, BLAKE3_BLOCK_LEN ) ||
+	    !EVP_MD_meth_set_app_datasize( b3_md,
+		    sizeof( struct blake3_hasher )) ||
+	    !EVP_MD_meth_set_init( b3_md, b3_evp_init ) ||
+	    !EVP_MD_meth_set_update( b3_md, b3_evp_update ) ||
+	    !EVP_MD_meth_set_final( b3_md, b3_evp_final ) ||
+	    !OBJ_NAME_add( "blake3", OBJ_NAME_TYPE_MD_METH,
+		    (const char *)b3_md )) {
+	fprintf( stderr, "blake3: can't add digest\n" );
+	exit( 2 );
+    }
+}
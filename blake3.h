@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#define BLAKE3_OUT_LEN		32
+#define BLAKE3_BLOCK_LEN	64
+#define BLAKE3_CHUNK_LEN	1024
+#define BLAKE3_MAX_DEPTH	54
+
+struct blake3_chunk {
+    uint32_t		bc_cv[ 8 ];
+    uint64_t		bc_counter;
+    uint8_t		bc_buf[ BLAKE3_BLOCK_LEN ];
+    uint8_t		bc_buf_len;
+    uint8_t		bc_blocks;
+    uint8_t		bc_flags;
+};
+
+struct blake3_hasher {
+    uint32_t		bh_key[ 8 ];
+    struct blake3_chunk	bh_chunk;
+    uint8_t		bh_cv_len;
+    uint8_t		bh_cv_stack[ ( BLAKE3_MAX_DEPTH + 1 ) * BLAKE3_OUT_LEN ];
+};
+
+void	blake3_init( struct blake3_hasher *bh );
+void	blake3_update( struct blake3_hasher *bh, const void *input,
+	    size_t len );
+void	blake3_final( struct blake3_hasher *bh, uint8_t *out, size_t len );
+void	blake3_piece( const void *input, size_t len, uint64_t counter,
+	    uint8_t cv[ BLAKE3_OUT_LEN ] );
+void	blake3_evp_pieces( EVP_MD_CTX *ctx, const uint8_t *cvs, size_t n,
+	    size_t piece );
+void	blake3_many( const uint8_t *const *inputs, const size_t *lens,
+	    size_t n, uint8_t *out );
+const EVP_MD *blake3_md( void );
+char	*blake3_simd( void );
+void	blake3_add_digest( void );
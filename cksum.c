@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <sys/mman.h>
 #ifdef __APPLE__
 #include <sys/paths.h>
 #endif /* __APPLE__ */
@@ -18,50 +19,700 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
 #include <openssl/evp.h>
 
 #include "openssl_compat.h" // Compatibility shims for OpenSSL < 1.1.0
 #include "applefile.h"
 #include "cksum.h"
+#include "largefile.h"
 #include "base64.h"
+#include "blake3.h"
 
 /*
- * do_cksum calculates the checksum for PATH and returns it base64 encoded
- * in cksum_b64 which must be of size SZ_BASE64_E( EVP_MAX_MD_SIZE ).
+ * OpenSSL's digests, and the ones built in.  Call before looking one up
+ * with EVP_get_digestbyname().
+ */
+    void
+cksum_add_digests( void )
+{
+    OpenSSL_add_all_digests();
+    blake3_add_digest();
+}
+
+/*
+ * How do_fcksum() reads files larger than its stack buffer, set with
+ * cksum_options().  Reads are cksum_readsize bytes, into a buffer
+ * aligned for O_DIRECT.  With CKSUM_MMAP, regular files are mapped
+ * rather than read, and with CKSUM_DIRECT they're read around the
+ * buffer cache where the system allows it.
+ */
+static size_t	cksum_readsize = CKSUM_READSIZE;
+static int	cksum_flags = 0;
+
+/*
+ * blake3 is a tree hash, so a large file can be cut into CKSUM_PIECE
+ * pieces, hashed on up to cksum_threads threads, by default one per
+ * CPU, and put together to the same checksum as reading it through.
+ * If cksum_piecedir is set, the pieces' chaining values are kept there
+ * in a file named for the checksum, with '/' in it as '_':
+ *
+ *	blake3 piece-size file-size
+ *	chaining value of piece 0, in hex
+ *	...
+ *
+ * so that a file's pieces can later be compared with another's.
+ */
+static int	cksum_threads = 0;
+static char	*cksum_piecedir = NULL;
+
+struct cksum_pieces {
+    int			cp_fd;
+    off_t		cp_len;
+    size_t		cp_count;
+    size_t		cp_next;
+    int			cp_errno;	/* -1 if the file got shorter */
+    uint8_t		*cp_cvs;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t	cp_mutex;
+#endif /* HAVE_PTHREAD */
+};
+
+static int	cksum_read( int fd, off_t len, EVP_MD_CTX *mdctx, off_t *size );
+static int	cksum_mmap( int fd, off_t len, EVP_MD_CTX *mdctx, off_t *size );
+static void	*cksum_piece_worker( void *arg );
+static int	cksum_pieces( int fd, off_t len, EVP_MD_CTX *mdctx,
+		    off_t *size, uint8_t **cvs );
+static int	cksum_store( uint8_t *cvs, off_t len, char *cksum_b64 );
+
+/*
+ * spec is a comma separated list of a read size, with an optional k or
+ * m suffix, "mmap", "direct", "threads=N" and "pieces=dir", as in
+ * "4m,direct" or "threads=8,pieces=/var/radmind/pieces".
  *
  * return values:
- *	< 0	system error: errno set, no message given
- *	>= 0	number of bytes check summed
+ *	0	options set
+ *	-1	bad spec, nothing changed
  */
+    int
+cksum_options( char *spec )
+{
+    char		*buf, *p, *q, *last, *piecedir = NULL;
+    unsigned long	size = cksum_readsize;
+    long		threads = cksum_threads;
+    int			flags = 0;
 
-    off_t 
-do_fcksum( int fd, char *cksum_b64 )
+    /* kept for as long as piecedir is in use */
+    if (( buf = strdup( spec )) == NULL ) {
+	perror( "strdup" );
+	exit( 2 );
+    }
+
+    for ( p = strtok_r( buf, ",", &last ); p != NULL;
+	    p = strtok_r( NULL, ",", &last )) {
+	if ( strcmp( p, "mmap" ) == 0 ) {
+	    flags |= CKSUM_MMAP;
+	    continue;
+	}
+	if ( strcmp( p, "direct" ) == 0 ) {
+	    flags |= CKSUM_DIRECT;
+	    continue;
+	}
+	if ( strncmp( p, "threads=", 8 ) == 0 ) {
+	    threads = strtol( p + 8, &q, 10 );
+	    if (( q == p + 8 ) || ( *q != '\0' ) || ( threads < 1 ) ||
+		    ( threads > CKSUM_MAXTHREADS )) {
+		goto bad;
+	    }
+	    continue;
+	}
+	if ( strncmp( p, "pieces=", 7 ) == 0 ) {
+	    piecedir = p + 7;
+	    if ( *piecedir == '\0' ) {
+		goto bad;
+	    }
+	    continue;
+	}
+
+	errno = 0;
+	size = strtoul( p, &q, 10 );
+	if (( errno != 0 ) || ( q == p )) {
+	    goto bad;
+	}
+	switch ( *q ) {
+	case 'k': case 'K':
+	    size *= 1024;
+	    q++;
+	    break;
+
+	case 'm': case 'M':
+	    size *= 1024 * 1024;
+	    q++;
+	    break;
+
+	default:
+	    break;
+	}
+	if (( *q != '\0' ) || ( size < CKSUM_MINREAD ) ||
+		( size > CKSUM_MAXREAD )) {
+	    goto bad;
+	}
+    }
+
+    /* whole pages, for O_DIRECT */
+    cksum_readsize = ( size + CKSUM_ALIGN - 1 ) & ~( CKSUM_ALIGN - 1 );
+    cksum_flags = flags;
+    cksum_threads = (int)threads;
+    if ( piecedir != NULL ) {
+	cksum_piecedir = piecedir;
+    } else {
+	free( buf );
+    }
+    return( 0 );
+
+bad:
+    free( buf );
+    return( -1 );
+}
+
+/*
+ * Digest fd from where it is to the end, len being its size if known
+ * or 0.  Returns -1 with errno set on error.
+ */
+    static int
+cksum_read( int fd, off_t len, EVP_MD_CTX *mdctx, off_t *size )
+{
+    unsigned char	*buf;
+    size_t		bufsize = cksum_readsize;
+    ssize_t		rr;
+    int			flags = -1, err;
+
+    /* no bigger than needed to see the end of a smaller file */
+    if (( len > 0 ) && ( len < (off_t)bufsize )) {
+	bufsize = ( len + CKSUM_ALIGN ) & ~( CKSUM_ALIGN - 1 );
+    }
+    if (( errno = posix_memalign( (void **)&buf, CKSUM_ALIGN, bufsize ))
+	    != 0 ) {
+	return( -1 );
+    }
+
+    if ( cksum_flags & CKSUM_DIRECT ) {
+	if (( flags = fcntl( fd, F_GETFL )) >= 0 ) {
+#ifdef O_DIRECT
+	    /* not every filesystem takes it, which is fine */
+	    if ( fcntl( fd, F_SETFL, flags | O_DIRECT ) != 0 ) {
+		flags = -1;
+	    }
+#endif /* O_DIRECT */
+#ifdef F_NOCACHE
+	    (void)fcntl( fd, F_NOCACHE, 1 );
+#endif /* F_NOCACHE */
+	}
+    }
+
+    for ( ;; ) {
+	if (( rr = read( fd, buf, bufsize )) > 0 ) {
+	    *size += rr;
+	    EVP_DigestUpdate( mdctx, buf, (size_t)rr );
+	    continue;
+	}
+	if ( rr == 0 ) {
+	    break;
+	}
+#ifdef O_DIRECT
+	/* a short read leaves the offset unaligned, so read normally */
+	if (( errno == EINVAL ) && ( flags >= 0 ) &&
+		( fcntl( fd, F_SETFL, flags ) == 0 )) {
+	    flags = -1;
+	    continue;
+	}
+#endif /* O_DIRECT */
+	err = errno;
+	free( buf );
+	errno = err;
+	return( -1 );
+    }
+
+    if ( flags >= 0 ) {
+	(void)fcntl( fd, F_SETFL, flags );
+    }
+#ifdef F_NOCACHE
+    if ( cksum_flags & CKSUM_DIRECT ) {
+	(void)fcntl( fd, F_NOCACHE, 0 );
+    }
+#endif /* F_NOCACHE */
+    free( buf );
+    return( 0 );
+}
+
+/*
+ * Digest the len bytes of regular file fd by mapping it.  Returns 1 if
+ * the file couldn't be mapped and should be read instead.
+ */
+    static int
+cksum_mmap( int fd, off_t len, EVP_MD_CTX *mdctx, off_t *size )
+{
+    unsigned char	*map;
+    off_t		off;
+    size_t		chunk;
+
+    if (( map = mmap( NULL, (size_t)len, PROT_READ, MAP_SHARED, fd, 0 ))
+	    == MAP_FAILED ) {
+	return( 1 );
+    }
+#ifdef MADV_SEQUENTIAL
+    (void)madvise( map, (size_t)len, MADV_SEQUENTIAL );
+#endif /* MADV_SEQUENTIAL */
+
+    for ( off = 0; off < len; off += chunk ) {
+	chunk = cksum_readsize;
+	if ( len - off < (off_t)chunk ) {
+	    chunk = len - off;
+	}
+	EVP_DigestUpdate( mdctx, map + off, chunk );
+    }
+    *size += len;
+
+    if ( munmap( map, (size_t)len ) != 0 ) {
+	return( -1 );
+    }
+    return( 0 );
+}
+
+/* hash pieces of cp until there are none left */
+    static void *
+cksum_piece_worker( void *arg )
+{
+    struct cksum_pieces	*cp = arg;
+    uint8_t		*buf;
+    size_t		i, want, got;
+    ssize_t		rr;
+    off_t		off;
+    int			err;
+
+    if (( err = posix_memalign( (void **)&buf, CKSUM_ALIGN, CKSUM_PIECE ))
+	    != 0 ) {
+	buf = NULL;
+    }
+
+    for ( ;; ) {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock( &cp->cp_mutex );
+#endif /* HAVE_PTHREAD */
+	if ( buf == NULL ) {
+	    cp->cp_errno = err;
+	}
+	i = cp->cp_next++;
+	err = cp->cp_errno;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock( &cp->cp_mutex );
+#endif /* HAVE_PTHREAD */
+	if (( i >= cp->cp_count ) || ( err != 0 )) {
+	    break;
+	}
+
+	off = (off_t)i * CKSUM_PIECE;
+	want = CKSUM_PIECE;
+	if ( cp->cp_len - off < (off_t)want ) {
+	    want = cp->cp_len - off;
+	}
+	for ( got = 0; got < want; got += rr ) {
+	    if (( rr = pread( cp->cp_fd, buf + got, want - got,
+		    off + got )) <= 0 ) {
+		err = ( rr == 0 ) ? -1 : errno;
+		break;
+	    }
+	}
+	if ( err != 0 ) {
+#ifdef HAVE_PTHREAD
+	    pthread_mutex_lock( &cp->cp_mutex );
+#endif /* HAVE_PTHREAD */
+	    if ( cp->cp_errno == 0 ) {
+		cp->cp_errno = err;
+	    }
+#ifdef HAVE_PTHREAD
+	    pthread_mutex_unlock( &cp->cp_mutex );
+#endif /* HAVE_PTHREAD */
+	    break;
+	}
+	blake3_piece( buf, want, (uint64_t)off / BLAKE3_CHUNK_LEN,
+		cp->cp_cvs + i * BLAKE3_OUT_LEN );
+    }
+
+    free( buf );
+    return( NULL );
+}
+
+/*
+ * Digest the len bytes of regular file fd, from its start, in pieces.
+ * The pieces' chaining values are left in *cvs, for the caller to free.
+ * Returns 1 if the file should be read through instead, because it's
+ * too small, there's only the one thread and the pieces aren't wanted,
+ * or it got shorter while it was read.
+ */
+    static int
+cksum_pieces( int fd, off_t len, EVP_MD_CTX *mdctx, off_t *size,
+	uint8_t **cvs )
+{
+    struct cksum_pieces	cp;
+    long		threads;
+    int			i;
+#ifdef HAVE_PTHREAD
+    pthread_t		tids[ CKSUM_MAXTHREADS ];
+    int			started = 0;
+#endif /* HAVE_PTHREAD */
+
+    *cvs = NULL;
+    memset( &cp, 0, sizeof( cp ));
+    cp.cp_fd = fd;
+    cp.cp_len = len;
+    cp.cp_count = ( len + CKSUM_PIECE - 1 ) / CKSUM_PIECE;
+    if ( cp.cp_count < 2 ) {
+	return( 1 );
+    }
+
+    if (( threads = cksum_threads ) == 0 ) {
+#ifdef _SC_NPROCESSORS_ONLN
+	threads = sysconf( _SC_NPROCESSORS_ONLN );
+#endif /* _SC_NPROCESSORS_ONLN */
+	if ( threads > CKSUM_MAXTHREADS ) {
+	    threads = CKSUM_MAXTHREADS;
+	}
+    }
+#ifndef HAVE_PTHREAD
+    threads = 1;
+#endif /* !HAVE_PTHREAD */
+    if ( threads > (long)cp.cp_count ) {
+	threads = cp.cp_count;
+    }
+    /* not worth it for a handful of pieces */
+    if ((( threads <= 1 ) || ( cp.cp_count < CKSUM_MINPIECES )) &&
+	    ( cksum_piecedir == NULL )) {
+	return( 1 );
+    }
+
+    if (( cp.cp_cvs = malloc( cp.cp_count * BLAKE3_OUT_LEN )) == NULL ) {
+	return( -1 );
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init( &cp.cp_mutex, NULL );
+    for ( i = 1; i < threads; i++ ) {
+	if ( pthread_create( &tids[ started ], NULL,
+		cksum_piece_worker, &cp ) != 0 ) {
+	    /* fewer threads will do */
+	    break;
+	}
+	started++;
+    }
+#endif /* HAVE_PTHREAD */
+    (void)cksum_piece_worker( &cp );
+#ifdef HAVE_PTHREAD
+    for ( i = 0; i < started; i++ ) {
+	pthread_join( tids[ i ], NULL );
+    }
+    pthread_mutex_destroy( &cp.cp_mutex );
+#endif /* HAVE_PTHREAD */
+
+    if ( cp.cp_errno != 0 ) {
+	free( cp.cp_cvs );
+	if ( cp.cp_errno < 0 ) {
+	    return( 1 );
+	}
+	errno = cp.cp_errno;
+	return( -1 );
+    }
+
+    blake3_evp_pieces( mdctx, cp.cp_cvs, cp.cp_count, CKSUM_PIECE );
+    *size += len;
+    *cvs = cp.cp_cvs;
+    return( 0 );
+}
+
+/* keep the chaining values of a file of len bytes in cksum_piecedir */
+    static int
+cksum_store( uint8_t *cvs, off_t len, char *cksum_b64 )
+{
+    FILE		*f;
+    char		path[ MAXPATHLEN ], tmp[ MAXPATHLEN ];
+    char		*p;
+    size_t		i, j, count;
+    int			err;
+
+    if ( snprintf( path, MAXPATHLEN, "%s/%s", cksum_piecedir, cksum_b64 )
+	    >= MAXPATHLEN ) {
+	errno = ENAMETOOLONG;
+	return( -1 );
+    }
+    for ( p = path + strlen( cksum_piecedir ) + 1; *p != '\0'; p++ ) {
+	if ( *p == '/' ) {
+	    *p = '_';
+	}
+    }
+    /* the same checksum, so the same pieces */
+    if ( access( path, F_OK ) == 0 ) {
+	return( 0 );
+    }
+    if ( snprintf( tmp, MAXPATHLEN, "%s.%d", path, (int)getpid())
+	    >= MAXPATHLEN ) {
+	errno = ENAMETOOLONG;
+	return( -1 );
+    }
+
+    if (( f = fopen( tmp, "w" )) == NULL ) {
+	return( -1 );
+    }
+    fprintf( f, "blake3 %d %" PRIofft "d\n", CKSUM_PIECE, len );
+    count = ( len + CKSUM_PIECE - 1 ) / CKSUM_PIECE;
+    for ( i = 0; i < count; i++ ) {
+	for ( j = 0; j < BLAKE3_OUT_LEN; j++ ) {
+	    fprintf( f, "%02x", cvs[ i * BLAKE3_OUT_LEN + j ] );
+	}
+	putc( '\n', f );
+    }
+    if ( ferror( f )) {
+	err = errno;
+	fclose( f );
+	unlink( tmp );
+	errno = err;
+	return( -1 );
+    }
+    if ( fclose( f ) != 0 ) {
+	err = errno;
+	unlink( tmp );
+	errno = err;
+	return( -1 );
+    }
+    if ( rename( tmp, path ) != 0 ) {
+	err = errno;
+	unlink( tmp );
+	errno = err;
+	return( -1 );
+    }
+    return( 0 );
+}
+
+/*
+ * Checksum the file fd, from where it is, with mdctx, which is set up
+ * for md afresh.  len is fd's size if it's a regular file, else 0.
+ * Files that fit in CKSUM_SMALLREAD bytes are read onto the stack, most
+ * often in one read.  Larger ones are read as cksum_options() says,
+ * with the system told the reads are sequential, or with blake3 hashed
+ * in pieces.  Returns as do_fcksum().
+ */
+    static off_t
+cksum_fd( int fd, off_t len, EVP_MD_CTX *mdctx, char *cksum_b64 )
 {
     unsigned int	md_len;
     ssize_t		rr;
     off_t		size = 0;
-    unsigned char	buf[ 8192 ];
+    unsigned char	buf[ CKSUM_SMALLREAD ];
     extern EVP_MD	*md;
-    EVP_MD_CTX		*mdctx = EVP_MD_CTX_new();
     unsigned char	md_value[ SZ_BASE64_D( SZ_BASE64_E( EVP_MAX_MD_SIZE ) ) ];
+    uint8_t		*cvs = NULL;
+    int			rc = 0, err;
 
-    EVP_DigestInit( mdctx, md );
+    EVP_DigestInit_ex( mdctx, md, NULL );
 
-    while (( rr = read( fd, buf, sizeof( buf ))) > 0 ) {
-	size += rr;
-	EVP_DigestUpdate( mdctx, buf, (unsigned int)rr );
+    if ( len < (off_t)sizeof( buf )) {
+	while (( rr = read( fd, buf, sizeof( buf ))) > 0 ) {
+	    size += rr;
+	    EVP_DigestUpdate( mdctx, buf, (unsigned int)rr );
+	    /* a file that's grown is read as a large one */
+	    if ( size >= (off_t)sizeof( buf )) {
+		break;
+	    }
+	}
+	if ( rr < 0 ) {
+	    rc = -1;
+	} else if ( rr > 0 ) {
+	    rc = cksum_read( fd, 0, mdctx, &size );
+	}
+    } else {
+#ifdef POSIX_FADV_SEQUENTIAL
+	(void)posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif /* POSIX_FADV_SEQUENTIAL */
+	rc = 1;
+	if (( md == blake3_md()) && ( len > CKSUM_PIECE ) &&
+		( lseek( fd, 0, SEEK_CUR ) == 0 )) {
+	    rc = cksum_pieces( fd, len, mdctx, &size, &cvs );
+	}
+	if (( rc > 0 ) && ( cksum_flags & CKSUM_MMAP ) &&
+		( lseek( fd, 0, SEEK_CUR ) == 0 )) {
+	    rc = cksum_mmap( fd, len, mdctx, &size );
+	}
+	if ( rc > 0 ) {
+	    rc = cksum_read( fd, len, mdctx, &size );
+	}
     }
-    if ( rr < 0 ) {
+    if ( rc < 0 ) {
 	return( -1 );
     }
 
-    EVP_DigestFinal( mdctx, md_value, &md_len );
+    EVP_DigestFinal_ex( mdctx, md_value, &md_len );
     base64_e( md_value, md_len, cksum_b64 );
+
+    if ( cvs != NULL ) {
+	rc = 0;
+	if ( cksum_piecedir != NULL ) {
+	    rc = cksum_store( cvs, len, cksum_b64 );
+	}
+	err = errno;
+	free( cvs );
+	if ( rc != 0 ) {
+	    errno = err;
+	    return( -1 );
+	}
+    }
+
+    return( size );
+}
+
+/*
+ * do_cksum calculates the checksum for PATH and returns it base64 encoded
+ * in cksum_b64 which must be of size SZ_BASE64_E( EVP_MAX_MD_SIZE ).
+ * do_fcksum does the same for the open file fd, from where it is.
+ *
+ * return values:
+ *	< 0	system error: errno set, no message given
+ *	>= 0	number of bytes check summed
+ */
+
+    off_t 
+do_fcksum( int fd, char *cksum_b64 )
+{
+    struct stat		st;
+    off_t		len = 0, size;
+    EVP_MD_CTX		*mdctx;
+    int			err;
+
+    if (( fstat( fd, &st ) == 0 ) && S_ISREG( st.st_mode )) {
+	len = st.st_size;
+    }
+
+    if (( mdctx = EVP_MD_CTX_new()) == NULL ) {
+	errno = ENOMEM;
+	return( -1 );
+    }
+    size = cksum_fd( fd, len, mdctx, cksum_b64 );
+    err = errno;
     EVP_MD_CTX_free( mdctx );
+    errno = err;
 
     return( size );
 }
 
+/*
+ * Checksum n files, at most CKSUM_BATCH, as do_fcksum_batch().  Small
+ * files are asked for all at once, so the system can read them side
+ * by side rather than one after another, and blake3 files of a chunk
+ * or less are read whole and hashed together by blake3_many().
+ */
+    static void
+cksum_batch( struct cksum_file *cf, int n, EVP_MD_CTX *mdctx )
+{
+    extern EVP_MD	*md;
+    struct stat		st;
+    off_t		len[ CKSUM_BATCH ];
+    uint8_t		tiny[ CKSUM_BATCH ][ BLAKE3_CHUNK_LEN + 1 ];
+    const uint8_t	*inputs[ CKSUM_BATCH ];
+    size_t		lens[ CKSUM_BATCH ], got;
+    uint8_t		digests[ CKSUM_BATCH * BLAKE3_OUT_LEN ];
+    int			which[ CKSUM_BATCH ];
+    int			i, ntiny = 0;
+    ssize_t		rr = 0;
+
+    /* len is -1 for anything but a regular file */
+    for ( i = 0; i < n; i++ ) {
+	len[ i ] = -1;
+	if (( fstat( cf[ i ].cf_fd, &st ) == 0 ) && S_ISREG( st.st_mode )) {
+	    len[ i ] = st.st_size;
+	}
+#ifdef POSIX_FADV_WILLNEED
+	if (( len[ i ] > 0 ) && ( len[ i ] < CKSUM_SMALLREAD )) {
+	    (void)posix_fadvise( cf[ i ].cf_fd, 0, len[ i ],
+		    POSIX_FADV_WILLNEED );
+	}
+#endif /* POSIX_FADV_WILLNEED */
+    }
+
+    for ( i = 0; i < n; i++ ) {
+	cf[ i ].cf_errno = 0;
+	if (( md == blake3_md()) && ( len[ i ] >= 0 ) &&
+		( len[ i ] <= BLAKE3_CHUNK_LEN )) {
+	    /* one byte over a chunk, to see that it isn't more */
+	    for ( got = 0; got < sizeof( tiny[ 0 ] ); got += rr ) {
+		if (( rr = read( cf[ i ].cf_fd, tiny[ ntiny ] + got,
+			sizeof( tiny[ 0 ] ) - got )) <= 0 ) {
+		    break;
+		}
+	    }
+	    if ( rr < 0 ) {
+		cf[ i ].cf_errno = errno;
+		cf[ i ].cf_size = -1;
+		continue;
+	    }
+	    if ( got <= BLAKE3_CHUNK_LEN ) {
+		inputs[ ntiny ] = tiny[ ntiny ];
+		lens[ ntiny ] = got;
+		which[ ntiny++ ] = i;
+		cf[ i ].cf_size = got;
+		continue;
+	    }
+	    /* it's grown */
+	    if ( lseek( cf[ i ].cf_fd, -(off_t)got, SEEK_CUR ) < 0 ) {
+		cf[ i ].cf_errno = errno;
+		cf[ i ].cf_size = -1;
+		continue;
+	    }
+	}
+	if (( cf[ i ].cf_size = cksum_fd( cf[ i ].cf_fd,
+		( len[ i ] < 0 ) ? 0 : len[ i ], mdctx,
+		cf[ i ].cf_cksum_b64 )) < 0 ) {
+	    cf[ i ].cf_errno = errno;
+	}
+    }
+
+    if ( ntiny > 0 ) {
+	blake3_many( inputs, lens, ntiny, digests );
+	for ( i = 0; i < ntiny; i++ ) {
+	    base64_e( digests + i * BLAKE3_OUT_LEN, BLAKE3_OUT_LEN,
+		    cf[ which[ i ]].cf_cksum_b64 );
+	}
+    }
+}
+
+/*
+ * do_fcksum_batch checksums n open files as do_fcksum() would each,
+ * leaving what do_fcksum() would have returned in cf_size, errno in
+ * cf_errno if that's -1, and the checksum in cf_cksum_b64.  Files are
+ * taken CKSUM_BATCH at a time, with one digest context for them all,
+ * which for trees of many small files is much quicker than a call to
+ * do_fcksum() for each.
+ */
+    void
+do_fcksum_batch( struct cksum_file *cf, int n )
+{
+    EVP_MD_CTX		*mdctx;
+    int			i;
+
+    if (( mdctx = EVP_MD_CTX_new()) == NULL ) {
+	for ( i = 0; i < n; i++ ) {
+	    cf[ i ].cf_size = -1;
+	    cf[ i ].cf_errno = ENOMEM;
+	}
+	return;
+    }
+    for ( ; n > 0; n -= i, cf += i ) {
+	i = ( n < CKSUM_BATCH ) ? n : CKSUM_BATCH;
+	cksum_batch( cf, i, mdctx );
+    }
+    EVP_MD_CTX_free( mdctx );
+}
+
     off_t
 do_cksum( char *path, char *cksum_b64 )
 {
@@ -3,6 +3,36 @@
  * All Rights Reserved.  See COPYRIGHT.
  */
 
+/* do_fcksum() reads files smaller than this onto the stack */
+#define CKSUM_SMALLREAD	( 64 * 1024 )
+
+/* and larger ones this much at a time, by default */
+#define CKSUM_READSIZE	( 1024 * 1024 )
+#define CKSUM_MINREAD	( 8 * 1024 )
+#define CKSUM_MAXREAD	( 64 * 1024 * 1024 )
+#define CKSUM_ALIGN	4096
+
+/* blake3 files are hashed in pieces this big, a power of two of its chunks */
+#define CKSUM_PIECE	( 1024 * 1024 )
+#define CKSUM_MINPIECES	4
+#define CKSUM_MAXTHREADS	64
+
+#define CKSUM_MMAP	0x01
+#define CKSUM_DIRECT	0x02
+
+/* do_fcksum_batch() reads ahead and hashes this many files at once */
+#define CKSUM_BATCH	32
+
+struct cksum_file {
+    int		cf_fd;
+    char	*cf_cksum_b64;
+    off_t	cf_size;
+    int		cf_errno;
+};
+
+void cksum_add_digests( void );
+int cksum_options( char *spec );
 off_t do_fcksum( int fd, char *cksum_b64 );
+void do_fcksum_batch( struct cksum_file *cf, int n );
 off_t do_cksum( char *path, char *cksum_b64 );
 off_t do_acksum( char *path, char *cksum_b64, struct applefileinfo *afinfo );
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+
+#include "argcargv.h"
+#include "base64.h"
+#include "cksumcache.h"
+#include "largefile.h"
+
+/*
+ * A cache of file checksums, so that fsdiff -c need not read files that
+ * haven't changed since the last run.  An entry is only used if the
+ * device, inode, size, mtime and ctime of the file all match, and the
+ * cache was made with the same checksum.  Files changed at or after the
+ * start of the run aren't cached, since they may be changed again within
+ * the same second.
+ *
+ * The cache file is text, one entry per line:
+ *
+ *	dev ino size mtime ctime used checksum
+ *
+ * after a first line naming the format version and checksum.  "used" is
+ * the start of the last run that looked at the entry.  The file is
+ * rewritten at the end of each run.
+ */
+
+#define CC_VERSION	1
+
+struct cc_entry {
+    dev_t		ce_dev;
+    ino_t		ce_ino;
+    off_t		ce_size;
+    time_t		ce_mtime;
+    time_t		ce_ctime;
+    time_t		ce_used;
+    char		ce_cksum[ SZ_BASE64_E( EVP_MAX_MD_SIZE ) ];
+};
+
+static char		*cc_path = NULL;
+static char		*cc_algorithm;
+static int		cc_bypass;
+static int		cc_dirty = 0;
+static time_t		cc_start;
+
+static struct cc_entry	*cc_ents = NULL;
+static int		cc_count = 0;
+static int		cc_size = 0;
+
+/* open hash of indexes into cc_ents, -1 is empty */
+static int		*cc_index = NULL;
+static unsigned int	cc_mask = 0;
+
+    static unsigned int
+cc_hash( dev_t dev, ino_t ino )
+{
+    unsigned long long	h;
+
+    h = ((unsigned long long)dev * 0x9e3779b97f4a7c15ULL ) ^
+	    (unsigned long long)ino;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+
+    return( (unsigned int)h );
+}
+
+    static int *
+cc_slot( dev_t dev, ino_t ino )
+{
+    unsigned int	i;
+    struct cc_entry	*ce;
+
+    for ( i = cc_hash( dev, ino ) & cc_mask; cc_index[ i ] >= 0;
+	    i = ( i + 1 ) & cc_mask ) {
+	ce = &cc_ents[ cc_index[ i ]];
+	if (( ce->ce_dev == dev ) && ( ce->ce_ino == ino )) {
+	    break;
+	}
+    }
+
+    return( &cc_index[ i ] );
+}
+
+    static void
+cc_rehash( void )
+{
+    unsigned int	size, i;
+    struct cc_entry	*ce;
+
+    for ( size = 1024; size < (unsigned int)cc_size * 2; size <<= 1 )
+	;
+    free( cc_index );
+    if (( cc_index = (int *)malloc( size * sizeof( int ))) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    memset( cc_index, 0xff, size * sizeof( int ));
+    cc_mask = size - 1;
+
+    for ( i = 0; i < (unsigned int)cc_count; i++ ) {
+	ce = &cc_ents[ i ];
+	*cc_slot( ce->ce_dev, ce->ce_ino ) = i;
+    }
+}
+
+    static struct cc_entry *
+cc_add( dev_t dev, ino_t ino )
+{
+    int			*slot;
+
+    if ( *( slot = cc_slot( dev, ino )) >= 0 ) {
+	return( &cc_ents[ *slot ] );
+    }
+
+    if ( cc_count >= cc_size ) {
+	cc_size = ( cc_size == 0 ) ? 1024 : cc_size * 2;
+	if (( cc_ents = (struct cc_entry *)realloc( cc_ents,
+		cc_size * sizeof( struct cc_entry ))) == NULL ) {
+	    perror( "realloc" );
+	    exit( 2 );
+	}
+	cc_rehash();
+	slot = cc_slot( dev, ino );
+    }
+
+    *slot = cc_count;
+    memset( &cc_ents[ cc_count ], 0, sizeof( struct cc_entry ));
+    cc_ents[ cc_count ].ce_dev = dev;
+    cc_ents[ cc_count ].ce_ino = ino;
+
+    return( &cc_ents[ cc_count++ ] );
+}
+
+/*
+ * Read the cache at path.  A missing cache is empty.  A cache that is
+ * damaged, or was made with another checksum, is thrown away.  With
+ * bypass, nothing is found in the cache, but it is still rewritten with
+ * the checksums from this run.
+ */
+    void
+cc_init( char *path, char *algorithm, int bypass )
+{
+    FILE		*f;
+    char		line[ MAXPATHLEN ];
+    char		**argv;
+    int			ac, linenum = 0;
+    struct cc_entry	*ce;
+
+    cc_path = path;
+    cc_algorithm = algorithm;
+    cc_bypass = bypass;
+    cc_start = time( NULL );
+    cc_rehash();
+
+    if (( f = fopen( cc_path, "r" )) == NULL ) {
+	if ( errno == ENOENT ) {
+	    return;
+	}
+	perror( cc_path );
+	exit( 2 );
+    }
+
+    while ( fgets( line, sizeof( line ), f ) != NULL ) {
+	linenum++;
+	if ( line[ strlen( line ) - 1 ] != '\n' ) {
+	    fprintf( stderr, "%s: line %d: line too long\n", cc_path, linenum );
+	    break;
+	}
+	ac = argcargv( line, &argv );
+
+	if ( linenum == 1 ) {
+	    if (( ac != 2 ) || ( atoi( argv[ 0 ] ) != CC_VERSION ) ||
+		    ( strcmp( argv[ 1 ], cc_algorithm ) != 0 )) {
+		break;
+	    }
+	    continue;
+	}
+
+	if (( ac != 7 ) ||
+		( strlen( argv[ 6 ] ) >= sizeof( ce->ce_cksum ))) {
+	    fprintf( stderr, "%s: line %d: bad cache entry\n",
+		    cc_path, linenum );
+	    break;
+	}
+	ce = cc_add( (dev_t)strtoull( argv[ 0 ], NULL, 10 ),
+		(ino_t)strtoull( argv[ 1 ], NULL, 10 ));
+	ce->ce_size = strtoofft( argv[ 2 ], NULL, 10 );
+	ce->ce_mtime = strtotimet( argv[ 3 ], NULL, 10 );
+	ce->ce_ctime = strtotimet( argv[ 4 ], NULL, 10 );
+	ce->ce_used = strtotimet( argv[ 5 ], NULL, 10 );
+	strcpy( ce->ce_cksum, argv[ 6 ] );
+    }
+    if ( ferror( f )) {
+	perror( cc_path );
+	exit( 2 );
+    }
+
+    if ( !feof( f )) {
+	/* start over with an empty cache */
+	cc_count = 0;
+	cc_rehash();
+	cc_dirty = 1;
+    }
+    fclose( f );
+}
+
+/*
+ * If the cache has a checksum for the file described by st, copy it to
+ * cksum_b64 and return 1.
+ */
+    int
+cc_lookup( struct stat *st, char *cksum_b64 )
+{
+    int			i;
+    struct cc_entry	*ce;
+
+    if (( cc_path == NULL ) || cc_bypass ) {
+	return( 0 );
+    }
+    if (( i = *cc_slot( st->st_dev, st->st_ino )) < 0 ) {
+	return( 0 );
+    }
+    ce = &cc_ents[ i ];
+    if (( ce->ce_size != st->st_size ) || ( ce->ce_mtime != st->st_mtime ) ||
+	    ( ce->ce_ctime != st->st_ctime )) {
+	return( 0 );
+    }
+
+    if ( ce->ce_used != cc_start ) {
+	ce->ce_used = cc_start;
+	cc_dirty = 1;
+    }
+    strcpy( cksum_b64, ce->ce_cksum );
+    return( 1 );
+}
+
+    void
+cc_store( struct stat *st, char *cksum_b64 )
+{
+    struct cc_entry	*ce;
+
+    if ( cc_path == NULL ) {
+	return;
+    }
+    if (( st->st_mtime >= cc_start ) || ( st->st_ctime >= cc_start )) {
+	return;
+    }
+
+    ce = cc_add( st->st_dev, st->st_ino );
+    ce->ce_size = st->st_size;
+    ce->ce_mtime = st->st_mtime;
+    ce->ce_ctime = st->st_ctime;
+    ce->ce_used = cc_start;
+    strcpy( ce->ce_cksum, cksum_b64 );
+    cc_dirty = 1;
+}
+
+    static int
+cc_usedcmp( const void *a, const void *b )
+{
+    const struct cc_entry	*ca = a, *cb = b;
+
+    if ( ca->ce_used != cb->ce_used ) {
+	return(( ca->ce_used > cb->ce_used ) ? -1 : 1 );
+    }
+    return( 0 );
+}
+
+/*
+ * Replace the cache file, keeping at most CC_MAXENTRIES entries.
+ */
+    void
+cc_write( void )
+{
+    FILE		*f;
+    char		temp[ MAXPATHLEN ];
+    int			fd, i;
+    struct cc_entry	*ce;
+
+    if (( cc_path == NULL ) || !cc_dirty ) {
+	return;
+    }
+
+    if ( cc_count > CC_MAXENTRIES ) {
+	qsort( cc_ents, cc_count, sizeof( struct cc_entry ), cc_usedcmp );
+	cc_count = CC_MAXENTRIES;
+    }
+
+    if ( snprintf( temp, sizeof( temp ), "%s.XXXXXX", cc_path )
+	    >= (int)sizeof( temp )) {
+	fprintf( stderr, "%s: path too long\n", cc_path );
+	exit( 2 );
+    }
+    if (( fd = mkstemp( temp )) < 0 ) {
+	perror( temp );
+	exit( 2 );
+    }
+    if (( f = fdopen( fd, "w" )) == NULL ) {
+	perror( temp );
+	exit( 2 );
+    }
+
+    fprintf( f, "%d %s\n", CC_VERSION, cc_algorithm );
+    for ( i = 0; i < cc_count; i++ ) {
+	ce = &cc_ents[ i ];
+	fprintf( f, "%llu %llu %" PRIofft "d %" PRItimet "d %" PRItimet "d "
+		"%" PRItimet "d %s\n",
+		(unsigned long long)ce->ce_dev, (unsigned long long)ce->ce_ino,
+		ce->ce_size, ce->ce_mtime, ce->ce_ctime, ce->ce_used,
+		ce->ce_cksum );
+    }
+
+    if ( fclose( f ) != 0 ) {
+	perror( temp );
+	unlink( temp );
+	exit( 2 );
+    }
+    if ( rename( temp, cc_path ) != 0 ) {
+	perror( cc_path );
+	unlink( temp );
+	exit( 2 );
+    }
+
+    free( cc_ents );
+    free( cc_index );
+    cc_ents = NULL;
+    cc_index = NULL;
+    cc_count = cc_size = 0;
+    cc_path = NULL;
+}
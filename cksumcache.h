@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+/* entries kept in the cache file, the least recently used go first */
+#define CC_MAXENTRIES	( 4 * 1024 * 1024 )
+
+void	cc_init( char *path, char *algorithm, int bypass );
+int	cc_lookup( struct stat *st, char *cksum_b64 );
+void	cc_store( struct stat *st, char *cksum_b64 );
+void	cc_write( void );
@@ -10,6 +10,9 @@
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif /* HAVE_SENDFILE */
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -20,6 +23,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <ctype.h>
 
@@ -51,14 +55,18 @@ extern SSL_CTX  *ctx;
 #include "argcargv.h"
 #include "cksum.h"
 #include "code.h"
-#include "list.h"
 #include "wildcard.h"
 #include "largefile.h"
 #include "mkdirs.h"
 #include "connect.h"
+#include "statcache.h"
+#include "pathset.h"
 
 #define RADMIND_MAX_INCLUDE_DEPTH	10
 
+/* closures of command files kept for later connections */
+#define RADMIND_MAX_KCLOSURES		1024
+
 #define	DEFAULT_MODE 0444
 #define DEFAULT_UID     0
 #define DEFAULT_GID     0
@@ -68,7 +76,33 @@ extern SSL_CTX  *ctx;
 #define K_SPECIAL 3
 #define K_FILE 4
 
-int 		read_kfile( SNET *sn, char *kfile );
+/*
+ * The closure of a command file: every command file, transcript and
+ * special file it names, directly or through other command files, is an
+ * access list entry.  A closure is good while none of the command files
+ * read for it have changed since, per their stamps, and none had changed
+ * as late as the second it was built.
+ */
+struct kstamp {
+    char		*ks_path;
+    dev_t		ks_dev;
+    ino_t		ks_ino;
+    off_t		ks_size;
+    time_t		ks_mtime;
+    time_t		ks_ctime;
+};
+
+struct kclosure {
+    char		*kc_kfile;
+    time_t		kc_built;
+    struct kstamp	*kc_stamps;
+    int			kc_nstamps;
+    struct pathset	*kc_paths;
+    struct kclosure	*kc_next;
+};
+
+int 		read_kfile( SNET *sn, struct kclosure *kc, char *kfile );
+int		kfile_closure( SNET *sn, char *kfile );
 
 int		f_quit( SNET *, int, char *[] );
 int		f_noop( SNET *, int, char *[] );
@@ -99,7 +133,8 @@ char		special_dir[ MAXPATHLEN ];
 char		command_file[ MAXPATHLEN ];
 char		upload_xscript[ MAXPATHLEN ];
 const EVP_MD    *md = NULL;
-struct list	*access_list = NULL;
+struct pathset	*access_list = NULL;
+static struct kclosure	*kclosures = NULL;	/* most recently used first */
 int		ncommands = 0;
 int		authorized = 0;
 int		prevstor = 0;
@@ -166,6 +201,20 @@ struct command	auth[] = {
 
 struct command *commands  = NULL;
 
+/*
+ * A command that ends the connection returns cmd_close( status ), and
+ * cmdloop() returns status without saying goodbye.  A pooled worker then
+ * goes on to its next connection, where once the child would have exited.
+ */
+static int	close_status = -1;
+
+    static int
+cmd_close( int status )
+{
+    close_status = status;
+    return( -1 );
+}
+
     int
 f_quit( SNET *sn, int ac, char **av )
 {
@@ -173,7 +222,7 @@ f_quit( SNET *sn, int ac, char **av )
 #ifdef HAVE_ZLIB
     if ( debug && max_zlib_level > 0 ) print_stats( sn );
 #endif /* HAVE_ZLIB */
-    exit( 0 );
+    return( cmd_close( 0 ));
 }
 
     int
@@ -194,14 +243,14 @@ f_help( SNET *sn, int ac, char **av )
 f_noauth( SNET *sn, int ac, char **av )
 {
     snet_writef( sn, "%d No access for %s\r\n", 500, remote_host );
-    exit( 1 );
+    return( cmd_close( 1 ));
 }
 
     int
 f_notls( SNET *sn, int ac, char **av )
 {
     snet_writef( sn, "%d Must issue a STARTTLS command first\r\n", 530 );
-    exit( 1 );
+    return( cmd_close( 1 ));
 }
 
     int
@@ -300,6 +349,160 @@ keyword( int ac, char *av[] )
     return( rc );
 }
 
+#if defined( HAVE_SENDFILE ) || defined( HAVE_SSL_SENDFILE )
+/*
+ * Wait, as snet_write() does, up to 60 seconds for the client to make
+ * room on the connection.
+ */
+    static int
+retr_wait( SNET *sn )
+{
+    struct timeval	tv;
+    fd_set		fds;
+    int			rc;
+
+    tv.tv_sec = 60;
+    tv.tv_usec = 0;
+    FD_ZERO( &fds );
+    FD_SET( snet_fd( sn ), &fds );
+    if (( rc = select( snet_fd( sn ) + 1, NULL, &fds, NULL, &tv )) < 0 ) {
+	return( ( errno == EINTR ) ? 0 : -1 );
+    }
+    if ( rc == 0 ) {
+	errno = ETIMEDOUT;
+	return( -1 );
+    }
+    return( 0 );
+}
+#endif /* HAVE_SENDFILE || HAVE_SSL_SENDFILE */
+
+#ifdef HAVE_SENDFILE
+/*
+ * Send the len bytes of fd from the page cache straight to a plain,
+ * uncompressed connection.  Returns 1, having sent nothing, if the
+ * connection or file can't be sent this way.
+ */
+    static int
+retr_sendfile( SNET *sn, int fd, off_t len )
+{
+    off_t		off = 0;
+    ssize_t		wlen;
+    int			flags, rc = 0;
+
+    if ( snet_flags( sn ) & SNET_TLS ) {
+	return( 1 );
+    }
+#ifdef HAVE_ZLIB
+    if ( snet_flags( sn ) & SNET_ZLIB ) {
+	return( 1 );
+    }
+#endif /* HAVE_ZLIB */
+
+    if (( flags = fcntl( snet_fd( sn ), F_GETFL )) < 0 ||
+	    fcntl( snet_fd( sn ), F_SETFL, flags | O_NONBLOCK ) < 0 ) {
+	syslog( LOG_ERR, "fcntl: %m" );
+	return( -1 );
+    }
+    while ( off < len ) {
+	if (( wlen = sendfile( snet_fd( sn ), fd, &off,
+		(size_t)( len - off ))) > 0 ) {
+	    continue;
+	}
+	if ( wlen == 0 ) {
+	    syslog( LOG_ERR, "sendfile: file shrank" );
+	    rc = -1;
+	    break;
+	}
+	if ( errno == EAGAIN ) {
+	    if (( rc = retr_wait( sn )) < 0 ) {
+		syslog( LOG_ERR, "sendfile: %m" );
+		break;
+	    }
+	} else if ( errno != EINTR ) {
+	    if (( off == 0 ) && (( errno == EINVAL ) || ( errno == ENOSYS ))) {
+		rc = 1;
+	    } else {
+		syslog( LOG_ERR, "sendfile: %m" );
+		rc = -1;
+	    }
+	    break;
+	}
+    }
+    if ( fcntl( snet_fd( sn ), F_SETFL, flags ) < 0 ) {
+	syslog( LOG_ERR, "fcntl: %m" );
+	return( -1 );
+    }
+
+    return( rc );
+}
+#endif /* HAVE_SENDFILE */
+
+#ifdef HAVE_SSL_SENDFILE
+/*
+ * As retr_sendfile(), for a TLS connection whose records OpenSSL has
+ * handed to the kernel.
+ */
+    static int
+retr_ssl_sendfile( SNET *sn, int fd, off_t len )
+{
+    off_t		off = 0;
+    ossl_ssize_t	wlen;
+    int			flags, rc = 0;
+
+    if (( snet_flags( sn ) & SNET_TLS ) == 0 ||
+	    !BIO_get_ktls_send( SSL_get_wbio( sn->sn_ssl ))) {
+	return( 1 );
+    }
+#ifdef HAVE_ZLIB
+    if ( snet_flags( sn ) & SNET_ZLIB ) {
+	return( 1 );
+    }
+#endif /* HAVE_ZLIB */
+
+    if (( flags = fcntl( snet_fd( sn ), F_GETFL )) < 0 ||
+	    fcntl( snet_fd( sn ), F_SETFL, flags | O_NONBLOCK ) < 0 ) {
+	syslog( LOG_ERR, "fcntl: %m" );
+	return( -1 );
+    }
+    while ( off < len ) {
+	if (( wlen = SSL_sendfile( sn->sn_ssl, fd, off,
+		(size_t)( len - off ), 0 )) > 0 ) {
+	    off += wlen;
+	    continue;
+	}
+	switch ( SSL_get_error( sn->sn_ssl, (int)wlen )) {
+	case SSL_ERROR_WANT_WRITE:
+	    if (( rc = retr_wait( sn )) < 0 ) {
+		syslog( LOG_ERR, "SSL_sendfile: %m" );
+	    }
+	    break;
+
+	case SSL_ERROR_SYSCALL:
+	    if ( errno != EINTR ) {
+		syslog( LOG_ERR, "SSL_sendfile: %m" );
+		rc = -1;
+	    }
+	    break;
+
+	default:
+	    syslog( LOG_ERR, "SSL_sendfile: %s",
+		    ERR_error_string( ERR_get_error(), NULL ));
+	    rc = -1;
+	    break;
+	}
+	if ( rc < 0 ) {
+	    break;
+	}
+    }
+    if ( fcntl( snet_fd( sn ), F_SETFL, flags ) < 0 ) {
+	syslog( LOG_ERR, "fcntl: %m" );
+	return( -1 );
+    }
+
+    return( rc );
+}
+#endif /* HAVE_SSL_SENDFILE */
+
     int
 f_retr( SNET *sn, int ac, char **av )
 {
@@ -310,7 +513,7 @@ f_retr( SNET *sn, int ac, char **av )
     char		buf[8192];
     char		path[ MAXPATHLEN ];
     char		*d_path, *d_tran;
-    int			fd;
+    int			fd, rc;
 
     switch ( keyword( ac, av )) {
     case K_COMMAND:
@@ -331,7 +534,7 @@ f_retr( SNET *sn, int ac, char **av )
 	    } 
 
 	    /* Check for access */
-	    if ( !list_check( access_list, d_path )) {
+	    if ( !pathset_check( access_list, d_path )) {
 		syslog( LOG_WARNING | LOG_AUTH, "attempt to access: %s",
 		    d_path );
 		snet_writef( sn, "%d No access for %s\r\n", 540, d_path );
@@ -355,7 +558,7 @@ f_retr( SNET *sn, int ac, char **av )
 	} 
 
 	/* Check for access */
-	if ( !list_check( access_list, d_tran )) {
+	if ( !pathset_check( access_list, d_tran )) {
 	    syslog( LOG_WARNING | LOG_AUTH, "attempt to access: %s", d_tran );
 	    snet_writef( sn, "%d No access for %s\r\n", 540, d_tran );
 	    return( 1 );
@@ -402,7 +605,7 @@ f_retr( SNET *sn, int ac, char **av )
 	} 
 
 	/* Check for access */
-	if ( !list_check( access_list, d_tran )) {
+	if ( !pathset_check( access_list, d_tran )) {
 	    syslog( LOG_WARNING | LOG_AUTH, "attempt to access: %s", d_tran );
 	    snet_writef( sn, "%d No access for %s:%s\r\n", 540, d_tran,
 		d_path );
@@ -447,22 +650,40 @@ f_retr( SNET *sn, int ac, char **av )
      */
     snet_writef( sn, "240 Retrieving file\r\n%" PRIofft "d\r\n", st.st_size );
 
-    /* dump file */
+    /* dump file, without copying it if the connection allows */
 
-    while (( readlen = read( fd, buf, sizeof( buf ))) > 0 ) {
-	tv.tv_sec = 60 ;
-	tv.tv_usec = 0;
-	if ( snet_write( sn, buf, readlen, &tv ) != readlen ) {
-	    syslog( LOG_ERR, "snet_write: %m" );
-	    return( -1 );
-	}
+    rc = 1;
+#ifdef HAVE_SENDFILE
+    rc = retr_sendfile( sn, fd, st.st_size );
+#endif /* HAVE_SENDFILE */
+#ifdef HAVE_SSL_SENDFILE
+    if ( rc > 0 ) {
+	rc = retr_ssl_sendfile( sn, fd, st.st_size );
     }
-
-    if ( readlen < 0 ) {
-	syslog( LOG_ERR, "read: %m" );
+#endif /* HAVE_SSL_SENDFILE */
+    if ( rc < 0 ) {
+	(void)close( fd );
 	return( -1 );
     }
 
+    if ( rc > 0 ) {
+	while (( readlen = read( fd, buf, sizeof( buf ))) > 0 ) {
+	    tv.tv_sec = 60 ;
+	    tv.tv_usec = 0;
+	    if ( snet_write( sn, buf, readlen, &tv ) != readlen ) {
+		syslog( LOG_ERR, "snet_write: %m" );
+		(void)close( fd );
+		return( -1 );
+	    }
+	}
+
+	if ( readlen < 0 ) {
+	    syslog( LOG_ERR, "read: %m" );
+	    (void)close( fd );
+	    return( -1 );
+	}
+    }
+
     snet_writef( sn, ".\r\n" );
 
     if ( close( fd ) < 0 ) {
@@ -571,6 +792,7 @@ f_stat( SNET *sn, int ac, char *av[] )
     char 		path[ MAXPATHLEN ];
     char		cksum_b64[ SZ_BASE64_E( EVP_MAX_MD_SIZE ) ];
     struct stat		st;
+    time_t		start;
     int			key;
     char		*enc_file, *d_tran, *d_path;
 
@@ -592,7 +814,7 @@ f_stat( SNET *sn, int ac, char *av[] )
 	    } 
 
 	    /* Check for access */
-	    if ( !list_check( access_list, d_path )) {
+	    if ( !pathset_check( access_list, d_path )) {
 		syslog( LOG_WARNING | LOG_AUTH, "attempt to access: %s",
 		    d_path );
 		snet_writef( sn, "%d No access for %s\r\n", 540, d_path );
@@ -616,7 +838,7 @@ f_stat( SNET *sn, int ac, char *av[] )
 	} 
 
 	/* Check for access */
-	if ( !list_check( access_list, d_tran )) {
+	if ( !pathset_check( access_list, d_tran )) {
 	    syslog( LOG_WARNING | LOG_AUTH, "attempt to access: %s", d_tran );
 	    snet_writef( sn, "%d No access for %s\r\n", 540, d_tran );
 	    return( 1 );
@@ -652,6 +874,7 @@ f_stat( SNET *sn, int ac, char *av[] )
         
     syslog( LOG_DEBUG, "f_stat: returning infomation for %s", path );
 
+    start = time( NULL );
     if ( stat( path, &st ) < 0 ) {
         syslog( LOG_ERR, "f_stat: stat: %m" );
 	snet_writef( sn, "%d Access Error: %s\r\n", 531, path );
@@ -659,17 +882,20 @@ f_stat( SNET *sn, int ac, char *av[] )
     }
 
     /* XXX cksums here, totally the wrong place to do this! */
-    OpenSSL_add_all_digests();
-    md = EVP_get_digestbyname( "sha1" );
-    if ( !md ) {
-	/* XXX */
-	fprintf( stderr, "%s: unsupported checksum\n", "sha1" );
-	exit( 1 );
-    }
-    if ( do_cksum( path, cksum_b64 ) < 0 ) {
-	syslog( LOG_ERR, "do_cksum: %s: %m", path );
-	snet_writef( sn, "%d Checksum Error: %s: %m\r\n", 500, path );
-	return( 1 );
+    if ( !sc_lookup( &st, cksum_b64 )) {
+	OpenSSL_add_all_digests();
+	md = EVP_get_digestbyname( "sha1" );
+	if ( !md ) {
+	    /* XXX */
+	    fprintf( stderr, "%s: unsupported checksum\n", "sha1" );
+	    return( cmd_close( 1 ));
+	}
+	if ( do_cksum( path, cksum_b64 ) < 0 ) {
+	    syslog( LOG_ERR, "do_cksum: %s: %m", path );
+	    snet_writef( sn, "%d Checksum Error: %s: %m\r\n", 500, path );
+	    return( 1 );
+	}
+	sc_store( &st, start, cksum_b64 );
     }
 
     snet_writef( sn, "%d Returning STAT information\r\n", 230 );
@@ -764,7 +990,7 @@ f_stor( SNET *sn, int ac, char *av[] )
 
     if ( checkuser && ( !authorized )) {
 	snet_writef( sn, "%d Not logged in\r\n", 551 );
-	exit( 1 );
+	return( cmd_close( 1 ));
     }
     /* decode() uses static mem, so strdup() */
     if (( d_tran = decode( av[ 2 ] )) == NULL ) {
@@ -807,11 +1033,11 @@ f_stor( SNET *sn, int ac, char *av[] )
 	if ( mkdir( xscriptdir, 0777 ) < 0 ) {
 	    if ( errno == EEXIST ) {
 	        snet_writef( sn, "%d Transcript exists\r\n", 551 );
-		exit( 1 );
+		return( cmd_close( 1 ));
 	    }
 	    snet_writef( sn, "%d %s: %s\r\n",
 		    551, xscriptdir, strerror( errno ));
-	    exit( 1 );
+	    return( cmd_close( 1 ));
 	}
 	break;
 
@@ -821,7 +1047,7 @@ f_stor( SNET *sn, int ac, char *av[] )
 	 */
 	if (( strcmp( upload_xscript, av[ 2 ] ) != 0 )) {
 	    snet_writef( sn, "%d Incorrect Transcript %s\r\n", 552, av[ 2 ] );
-	    exit( 1 );
+	    return( cmd_close( 1 ));
 	}
 
 	/* decode() uses static mem, so strdup() */
@@ -856,19 +1082,19 @@ f_stor( SNET *sn, int ac, char *av[] )
 
     default:
         snet_writef( sn, "%d STOR Syntax error\r\n", 550 );
-	exit( 1 ); 
+	return( cmd_close( 1 ));
     }
 
     if (( fd = open( upload, O_CREAT|O_EXCL|O_WRONLY, 0666 )) < 0 ) {
 	if ( mkdirs( upload ) < 0 ) {
 	    syslog( LOG_ERR, "f_stor: mkdir: %s: %m", upload );
 	    snet_writef( sn, "%d %s: %s\r\n", 555, upload, strerror( errno ));
-	    exit( 1 );
+	    return( cmd_close( 1 ));
 	}
 	if (( fd = open( upload, O_CREAT|O_EXCL|O_WRONLY, 0666 )) < 0 ) {
 	    syslog( LOG_ERR, "f_stor: open: %s: %m", upload );
 	    snet_writef( sn, "%d %s: %s\r\n", 555, upload, strerror( errno ));
-	    exit( 1 );
+	    return( cmd_close( 1 ));
 	}
     }
 
@@ -879,6 +1105,7 @@ f_stor( SNET *sn, int ac, char *av[] )
     tv.tv_usec = 0;
     if ( ( sizebuf = snet_getline( sn, &tv ) ) == NULL ) {
 	syslog( LOG_ERR, "f_stor: snet_getline: %m" );
+	(void)close( fd );
 	return( -1 );
     }
     /* Will there be a limit? */
@@ -894,24 +1121,27 @@ f_stor( SNET *sn, int ac, char *av[] )
 	    } else {
 		syslog( LOG_ERR, "f_stor: snet_read: %m" );
 	    }
+	    (void)close( fd );
 	    return( -1 );
 	}
 
 	if ( write( fd, buf, rc ) != rc ) {
 	    snet_writef( sn, "%d %s: %s\r\n", 555, upload, strerror( errno ));
-	    exit( 1 );
+	    (void)close( fd );
+	    return( cmd_close( 1 ));
 	}
     }
 
     if ( len != 0 ) {
 	syslog( LOG_ERR, "f_stor: len is %" PRIofft "d", len );
 	snet_writef( sn, "%d %s: internal error!\r\n", 555, upload );
-	exit( 1 );
+	(void)close( fd );
+	return( cmd_close( 1 ));
     }
 
     if ( close( fd ) < 0 ) {
 	snet_writef( sn, "%d %s: %s\r\n", 555, upload, strerror( errno ));
-	exit( 1 );
+	return( cmd_close( 1 ));
     }
 
     syslog( LOG_DEBUG, "f_stor: file %s stored", upload );
@@ -929,7 +1159,7 @@ f_stor( SNET *sn, int ac, char *av[] )
 	snet_writef( sn, "%d Length doesn't match sent data %s\r\n",
 		555, upload );
 	(void)unlink( upload );
-	exit( 1 );
+	return( cmd_close( 1 ));
     }
 
     snet_writef( sn, "%d File stored\r\n", 250 );
@@ -1033,9 +1263,9 @@ f_starttls( SNET *sn, int ac, char **av )
 	commands  = auth;
 	ncommands = sizeof( auth ) / sizeof( auth[ 0 ] );
 
-	if ( read_kfile( sn, command_file ) != 0 ) {
-	    /* error message given in list_transcripts */
-	    exit( 1 );
+	if ( kfile_closure( sn, command_file ) != 0 ) {
+	    /* error message given in read_kfile */
+	    return( cmd_close( 1 ));
 	}
     }
 
@@ -1172,6 +1402,7 @@ f_login( SNET *sn, int ac, char **av )
 	return( 1 );
     }
     free( password );
+    password = NULL;
 
     /* permitted access? */
     if (( retval = pam_acct_mgmt( pamh, 0 )) != PAM_SUCCESS ) {
@@ -1361,7 +1592,7 @@ command_k_done:
 }
 
     int
-read_kfile( SNET *sn, char *kfile )
+read_kfile( SNET *sn, struct kclosure *kc, char *kfile )
 {
     int		ac;
     int		linenum = 0;
@@ -1370,6 +1601,8 @@ read_kfile( SNET *sn, char *kfile )
     char	path[ MAXPATHLEN ];
     ACAV	*acav;
     FILE	*f;
+    struct stat	st;
+    struct kstamp	*ks;
 
     if ( snprintf( path, MAXPATHLEN, "command/%s", kfile ) >= MAXPATHLEN ) {
 	syslog( LOG_ERR, "read_kfile: command/%s: path too long", kfile );
@@ -1389,9 +1622,39 @@ read_kfile( SNET *sn, char *kfile )
 	syslog( LOG_ERR, "fopen: %s: %m", path );
 	snet_writef( sn,
 	    "%d Service not available, closing transmission channel\r\n", 421 );
+	acav_free( acav );
 	return( -1 );
     }
 
+    /* stamp the command file, so the closure can tell when it changes */
+    if ( fstat( fileno( f ), &st ) != 0 ) {
+	syslog( LOG_ERR, "fstat: %s: %m", path );
+	snet_writef( sn,
+	    "%d Service not available, closing transmission channel\r\n", 421 );
+	goto error;
+    }
+    if (( ks = (struct kstamp *)realloc( kc->kc_stamps,
+	    ( kc->kc_nstamps + 1 ) * sizeof( struct kstamp ))) == NULL ) {
+	syslog( LOG_ERR, "realloc: %m" );
+	snet_writef( sn,
+	    "%d Service not available, closing transmission channel\r\n", 421 );
+	goto error;
+    }
+    kc->kc_stamps = ks;
+    ks = &kc->kc_stamps[ kc->kc_nstamps ];
+    if (( ks->ks_path = strdup( path )) == NULL ) {
+	syslog( LOG_ERR, "strdup: %m" );
+	snet_writef( sn,
+	    "%d Service not available, closing transmission channel\r\n", 421 );
+	goto error;
+    }
+    ks->ks_dev = st.st_dev;
+    ks->ks_ino = st.st_ino;
+    ks->ks_size = st.st_size;
+    ks->ks_mtime = st.st_mtime;
+    ks->ks_ctime = st.st_ctime;
+    kc->kc_nstamps++;
+
     while ( fgets( line, MAXPATHLEN, f ) != NULL ) {
 	linenum++;
 
@@ -1423,14 +1686,14 @@ read_kfile( SNET *sn, char *kfile )
 
 	switch( *av[ 0 ] ) {
 	case 'k':
-	    if ( !list_check( access_list, av[ 1 ] )) {
-		if ( list_insert( access_list, av[ 1 ] ) != 0 ) {
-		    syslog( LOG_ERR, "list_insert: %m" );
+	    if ( !pathset_check( kc->kc_paths, av[ 1 ] )) {
+		if ( pathset_insert( kc->kc_paths, av[ 1 ] ) != 0 ) {
+		    syslog( LOG_ERR, "pathset_insert: %m" );
 		    snet_writef( sn,
 	"%d Service not available, closing transmission channel\r\n", 421 );
 		    goto error;
 		}
-		if ( read_kfile( sn, av[ 1 ] ) != 0 ) {
+		if ( read_kfile( sn, kc, av[ 1 ] ) != 0 ) {
 		    goto error;
 		}
 	    }
@@ -1438,13 +1701,11 @@ read_kfile( SNET *sn, char *kfile )
 
 	case 'p':
 	case 'n':
-	    if ( !list_check( access_list, av[ 1 ] )) {
-		if ( list_insert( access_list, av[ 1 ] ) != 0 ) {
-		    syslog( LOG_ERR, "list_insert: %m" );
-		    snet_writef( sn,
+	    if ( pathset_insert( kc->kc_paths, av[ 1 ] ) != 0 ) {
+		syslog( LOG_ERR, "pathset_insert: %m" );
+		snet_writef( sn,
 	"%d Service not available, closing transmission channel\r\n", 421 );
-		    goto error;
-		}
+		goto error;
 	    }
 	    break;
 
@@ -1494,6 +1755,107 @@ error:
     return( -1 );
 }
 
+    static void
+kclosure_free( struct kclosure *kc )
+{
+    int			i;
+
+    for ( i = 0; i < kc->kc_nstamps; i++ ) {
+	free( kc->kc_stamps[ i ].ks_path );
+    }
+    free( kc->kc_stamps );
+    if ( kc->kc_paths != NULL ) {
+	pathset_free( kc->kc_paths );
+    }
+    free( kc->kc_kfile );
+    free( kc );
+}
+
+    static int
+kclosure_good( struct kclosure *kc )
+{
+    struct kstamp	*ks;
+    struct stat		st;
+    int			i;
+
+    for ( i = 0; i < kc->kc_nstamps; i++ ) {
+	ks = &kc->kc_stamps[ i ];
+	if ( stat( ks->ks_path, &st ) != 0 ) {
+	    return( 0 );
+	}
+	if (( st.st_dev != ks->ks_dev ) || ( st.st_ino != ks->ks_ino ) ||
+		( st.st_size != ks->ks_size ) ||
+		( st.st_mtime != ks->ks_mtime ) ||
+		( st.st_ctime != ks->ks_ctime ) ||
+		( st.st_mtime >= kc->kc_built ) ||
+		( st.st_ctime >= kc->kc_built )) {
+	    return( 0 );
+	}
+    }
+
+    return( 1 );
+}
+
+/*
+ * Set access_list to the closure of kfile, reusing the one built by an
+ * earlier connection to this process if it's still good.  Errors are
+ * given to the client, as in read_kfile().
+ */
+    int
+kfile_closure( SNET *sn, char *kfile )
+{
+    struct kclosure	*kc, **kcp;
+    int			n;
+
+    access_list = NULL;
+
+    for ( kcp = &kclosures; ( kc = *kcp ) != NULL; kcp = &kc->kc_next ) {
+	if ( strcmp( kc->kc_kfile, kfile ) == 0 ) {
+	    *kcp = kc->kc_next;
+	    if ( kclosure_good( kc )) {
+		kc->kc_next = kclosures;
+		kclosures = kc;
+		access_list = kc->kc_paths;
+		return( 0 );
+	    }
+	    kclosure_free( kc );
+	    break;
+	}
+    }
+
+    if (( kc = (struct kclosure *)calloc( 1, sizeof( struct kclosure )))
+	    == NULL || ( kc->kc_kfile = strdup( kfile )) == NULL ||
+	    ( kc->kc_paths = pathset_new( )) == NULL ) {
+	syslog( LOG_ERR, "kfile_closure: %m" );
+	snet_writef( sn,
+	    "%d Service not available, closing transmission channel\r\n", 421 );
+	if ( kc != NULL ) {
+	    kclosure_free( kc );
+	}
+	return( -1 );
+    }
+    kc->kc_built = time( NULL );
+    if ( read_kfile( sn, kc, kfile ) != 0 ) {
+	kclosure_free( kc );
+	return( -1 );
+    }
+
+    kc->kc_next = kclosures;
+    kclosures = kc;
+    access_list = kc->kc_paths;
+
+    /* forget the least recently used */
+    for ( n = 1, kcp = &kc->kc_next; *kcp != NULL; n++, kcp = &(*kcp)->kc_next ) {
+	if ( n >= RADMIND_MAX_KCLOSURES ) {
+	    kclosure_free( *kcp );
+	    *kcp = NULL;
+	    break;
+	}
+    }
+
+    return( 0 );
+}
+
     int
 cmdloop( int fd, struct sockaddr_in *sin )
 {
@@ -1501,6 +1863,7 @@ cmdloop( int fd, struct sockaddr_in *sin )
     struct hostent	*hp;
     char		*p;
     int			ac, i;
+    int			rc = 0;
     int			one = 1;
     unsigned int	n;
     char		**av, *line;
@@ -1517,10 +1880,17 @@ cmdloop( int fd, struct sockaddr_in *sin )
 	commands = notls;
 	ncommands = sizeof( notls ) / sizeof( notls[ 0 ] );
     }
+    close_status = -1;
+    authorized = 0;
+    prevstor = 0;
+    *command_file = '\0';
+    *special_dir = '\0';
+    *upload_xscript = '\0';
 
     if (( sn = snet_attach( fd, 1024 * 1024 )) == NULL ) {
 	syslog( LOG_ERR, "snet_attach: %m" );
-	exit( 1 );
+	(void)close( fd );
+	return( 1 );
     }
     remote_addr = strdup( inet_ntoa( sin->sin_addr ));
 
@@ -1547,37 +1917,37 @@ cmdloop( int fd, struct sockaddr_in *sin )
 	    syslog( LOG_INFO, "%s: connection refused: server busy\r\n",
 		    remote_host );
 	    snet_writef( sn, "%d Server busy\r\n", 420 );
-	    exit( 1 );
+	    rc = 1;
+	    goto done;
 	}
     }
 
-    if (( access_list = list_new( )) == NULL ) {
-	syslog( LOG_ERR, "new_list: %m" );
-	snet_writef( sn,
-	    "%d Service not available, closing transmission channel\r\n", 421 );
-	return( -1 );
-    }
-    
+    access_list = NULL;
+
     if ( authlevel == 0 ) {
 	/* lookup proper command file based on the hostname, IP or CN */
 	if ( command_k( "config", 0 ) < 0 ) {
 	    syslog( LOG_INFO, "%s: Access denied: Not in config file",
 		remote_host );
 	    snet_writef( sn, "%d No access for %s\r\n", 500, remote_host );
-	    exit( 1 );
+	    rc = 1;
+	    goto done;
 	} else {
-	    if ( read_kfile( sn, command_file ) != 0 ) {
+	    if ( kfile_closure( sn, command_file ) != 0 ) {
 		/* error message given in read_kfile */
-		exit( 1 );
+		rc = 1;
+		goto done;
 	    }
 	    commands = auth;
 	    ncommands = sizeof( auth ) / sizeof( auth[ 0 ] );
 	}
     }
 
-    if ( gethostname( hostname, MAXHOSTNAMELEN ) < 0 ) {
+    if (( *hostname == '\0' ) &&
+	    ( gethostname( hostname, MAXHOSTNAMELEN ) < 0 )) {
 	syslog( LOG_ERR, "gethostname: %m" );
-	exit( 1 );
+	rc = 1;
+	goto done;
     }
 
     snet_writef( sn, "200%sRAP 1 %s %s radmind access protocol\r\n",
@@ -1610,7 +1980,8 @@ cmdloop( int fd, struct sockaddr_in *sin )
 
 	if (( ac = argcargv( line, &av )) < 0 ) {
 	    syslog( LOG_ERR, "argcargv: %m" );
-	    return( 1 );
+	    rc = 1;
+	    goto done;
 	}
 
 	if ( ac == 0 ) {
@@ -1634,10 +2005,30 @@ cmdloop( int fd, struct sockaddr_in *sin )
 
     }
 
+    if ( close_status >= 0 ) {
+	rc = close_status;
+	goto done;
+    }
+
     snet_writef( sn, "%d Server closing connection\r\n", 444 );
 
     if ( line == NULL ) {
 	syslog( LOG_ERR, "snet_getline: %m" );
     }
-    return( 0 );
+
+done:
+    /* leave nothing of this client behind for the next */
+    if ( snet_close( sn ) != 0 ) {
+	syslog( LOG_ERR, "snet_close: %m" );
+    }
+    access_list = NULL;
+    free( remote_addr );
+    free( remote_host );
+    free( remote_cn );
+    free( user );
+    free( password );
+    remote_addr = remote_host = remote_cn = user = password = NULL;
+    ERR_clear_error();
+
+    return( rc );
 }
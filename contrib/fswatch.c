@@ -0,0 +1,560 @@
+/*
+ * Copyright 2010 The Regents of The University of Michigan
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby granted,
+ * provided that the above copyright notice appears in all copies and
+ * that both that copyright notice and this permission notice appear
+ * in supporting documentation, and that the name of The University
+ * of Michigan not be the software without specific, written prior
+ * permission. This software is supplied as is without expressed or
+ * implied warranties of any kind.
+ */
+
+/*
+ * fswatch is fsspy for Linux: it watches a tree with inotify and keeps a
+ * journal of the paths that changed, sorted the way radmind sorts them,
+ * one per line, ready for
+ *
+ *	fsdiff -1 -K command.K - < journal
+ *
+ * Paths are added to the journal every few seconds.  Anything already in
+ * the journal is kept, so a consumer can take the journal away with mv(1)
+ * at any time, and the next write starts a new one.  If the kernel's
+ * event queue overflows, changes may have been missed, so the whole tree
+ * is walked again and every path under it is journaled.
+ *
+ * Like fsdiff -1, this only sees paths that exist: files removed since
+ * the last full fsdiff are not reported.  fswatch exits with 3 if the
+ * event queue overflowed while it ran.
+ *
+ * To compile:
+	gcc -g -o fswatch fswatch.c
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_MASK	( IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | \
+			  IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+			  IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR )
+
+#define SET_SIZE	4096
+
+struct path {
+    struct path		*p_next;
+    char		*p_path;
+};
+
+struct path		*set[ SET_SIZE ];
+int			set_count = 0;
+
+/* path of each watched directory, by watch descriptor */
+char			**watches = NULL;
+int			nwatches = 0;
+
+int			ifd;
+int			debug = 0;
+int			case_sensitive = 1;
+int			overflows = 0;
+char			*root;
+char			*journal = NULL;
+char			*journal_name = NULL;
+dev_t			journal_dev;
+ino_t			journal_ino;
+int			journal_wd = -1;
+
+volatile sig_atomic_t	done = 0;
+
+/* the same order as radmind's pathcasecmp(): '/' sorts before anything */
+    int
+pathcasecmp( const char *p1, const char *p2, int case_sensitive )
+{
+    int		rc;
+
+    do {
+	if ( case_sensitive ) {
+	    rc = ( (unsigned char)*p1 - (unsigned char)*p2 );
+	} else {
+	    rc = ( tolower( *p1 ) - tolower( *p2 ));
+	}
+
+	if ( rc != 0 ) {
+	    if (( *p2 != '\0' ) && ( *p1 == '/' )) {
+		return( -1 );
+	    } else if (( *p1 != '\0' ) && ( *p2 == '/' )) {
+		return( 1 );
+	    } else {
+		return( rc );
+	    }
+	}
+	p2++;
+    } while ( *p1++ != '\0' );
+
+    return( 0 );
+}
+
+    int
+path_cmp( const void *a, const void *b )
+{
+    return( pathcasecmp( *(char **)a, *(char **)b, case_sensitive ));
+}
+
+    unsigned int
+path_hash( char *path )
+{
+    unsigned int	h = 5381;
+
+    while ( *path != '\0' ) {
+	h = h * 33 + (unsigned char)*path++;
+    }
+    return( h % SET_SIZE );
+}
+
+    void
+path_add( char *path )
+{
+    struct path		*p;
+    unsigned int	h;
+
+    h = path_hash( path );
+    for ( p = set[ h ]; p != NULL; p = p->p_next ) {
+	if ( strcmp( p->p_path, path ) == 0 ) {
+	    return;
+	}
+    }
+
+    if (( p = (struct path *)malloc( sizeof( struct path ))) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    if (( p->p_path = strdup( path )) == NULL ) {
+	perror( "strdup" );
+	exit( 2 );
+    }
+    p->p_next = set[ h ];
+    set[ h ] = p;
+    set_count++;
+
+    if ( debug ) {
+	fprintf( stderr, "+ %s\n", path );
+    }
+}
+
+    int
+path_join( char *buf, char *dir, char *name )
+{
+    int		len;
+
+    len = strlen( dir );
+    if (( len > 0 ) && ( dir[ len - 1 ] == '/' )) {
+	len = snprintf( buf, MAXPATHLEN, "%s%s", dir, name );
+    } else {
+	len = snprintf( buf, MAXPATHLEN, "%s/%s", dir, name );
+    }
+    if ( len >= MAXPATHLEN ) {
+	fprintf( stderr, "%s/%s: path too long\n", dir, name );
+	return( -1 );
+    }
+    return( 0 );
+}
+
+/*
+ * Watch dir and everything under it.  With record, journal every path
+ * found, because things may have changed there before the watch was in
+ * place.
+ */
+    void
+watch_tree( char *dir, int record )
+{
+    DIR			*d;
+    struct dirent	*de;
+    struct stat		st;
+    char		path[ MAXPATHLEN ];
+    int			wd;
+
+    if ( lstat( dir, &st ) != 0 ) {
+	if ( errno != ENOENT ) {
+	    perror( dir );
+	}
+	return;
+    }
+    if ( record ) {
+	path_add( dir );
+    }
+    if ( !S_ISDIR( st.st_mode )) {
+	return;
+    }
+
+    if (( wd = inotify_add_watch( ifd, dir, WATCH_MASK )) < 0 ) {
+	if ( errno == ENOENT || errno == ENOTDIR ) {
+	    return;
+	}
+	perror( dir );
+	if ( errno == ENOSPC ) {
+	    fprintf( stderr, "raise fs.inotify.max_user_watches\n" );
+	}
+	exit( 2 );
+    }
+    if ( wd >= nwatches ) {
+	if (( watches = (char **)realloc( watches,
+		( wd + 1024 ) * sizeof( char * ))) == NULL ) {
+	    perror( "realloc" );
+	    exit( 2 );
+	}
+	memset( watches + nwatches, 0,
+		( wd + 1024 - nwatches ) * sizeof( char * ));
+	nwatches = wd + 1024;
+    }
+    free( watches[ wd ] );
+    if (( watches[ wd ] = strdup( dir )) == NULL ) {
+	perror( "strdup" );
+	exit( 2 );
+    }
+    if (( journal != NULL ) && ( st.st_dev == journal_dev ) &&
+	    ( st.st_ino == journal_ino )) {
+	journal_wd = wd;
+    }
+
+    if (( d = opendir( dir )) == NULL ) {
+	if ( errno != ENOENT ) {
+	    perror( dir );
+	}
+	return;
+    }
+    while (( de = readdir( d )) != NULL ) {
+	if (( strcmp( de->d_name, "." ) == 0 ) ||
+		( strcmp( de->d_name, ".." ) == 0 )) {
+	    continue;
+	}
+	if ( path_join( path, dir, de->d_name ) != 0 ) {
+	    continue;
+	}
+	if (( de->d_type == DT_DIR ) || ( de->d_type == DT_UNKNOWN )) {
+	    watch_tree( path, record );
+	} else if ( record ) {
+	    path_add( path );
+	}
+    }
+    closedir( d );
+}
+
+/*
+ * A directory was moved away.  Its watches, and those below it, now
+ * name the wrong place, so drop them.  If it moved somewhere we watch,
+ * the IN_MOVED_TO will watch it again.
+ */
+    void
+unwatch_tree( char *dir )
+{
+    int			wd, len;
+
+    len = strlen( dir );
+    for ( wd = 0; wd < nwatches; wd++ ) {
+	if (( watches[ wd ] != NULL ) &&
+		( strncmp( watches[ wd ], dir, len ) == 0 ) &&
+		(( watches[ wd ][ len ] == '\0' ) ||
+		( watches[ wd ][ len ] == '/' ))) {
+	    inotify_rm_watch( ifd, wd );
+	    free( watches[ wd ] );
+	    watches[ wd ] = NULL;
+	}
+    }
+}
+
+    void
+event( struct inotify_event *ev )
+{
+    char		path[ MAXPATHLEN ];
+    char		*dir;
+
+    if ( ev->mask & IN_Q_OVERFLOW ) {
+	fprintf( stderr, "%s: event queue overflowed, rescanning\n", root );
+	overflows++;
+	watch_tree( root, 1 );
+	return;
+    }
+    if (( ev->wd < 0 ) || ( ev->wd >= nwatches ) ||
+	    (( dir = watches[ ev->wd ] ) == NULL )) {
+	return;
+    }
+    if ( ev->mask & IN_IGNORED ) {
+	free( watches[ ev->wd ] );
+	watches[ ev->wd ] = NULL;
+	return;
+    }
+
+    /* an event on the watched directory itself */
+    if ( ev->len == 0 ) {
+	path_add( dir );
+	return;
+    }
+
+    /* don't journal the journal */
+    if (( ev->wd == journal_wd ) && ( strncmp( ev->name, journal_name,
+	    strlen( journal_name )) == 0 )) {
+	return;
+    }
+
+    if ( path_join( path, dir, ev->name ) != 0 ) {
+	return;
+    }
+    if (( ev->mask & IN_ISDIR ) && ( ev->mask & IN_MOVED_FROM )) {
+	unwatch_tree( path );
+    }
+    if (( ev->mask & IN_ISDIR ) && ( ev->mask & ( IN_CREATE | IN_MOVED_TO ))) {
+	watch_tree( path, 1 );
+	return;
+    }
+    path_add( path );
+}
+
+/*
+ * Write out the paths seen since the last call, merged with whatever is
+ * still in the journal.
+ */
+    void
+flush( void )
+{
+    FILE		*f;
+    struct path		*p, *next;
+    char		**paths;
+    char		line[ MAXPATHLEN + 1 ];
+    char		temp[ MAXPATHLEN ];
+    int			i, n, fd, len;
+
+    if ( set_count == 0 ) {
+	return;
+    }
+
+    if ( journal != NULL ) {
+	if (( f = fopen( journal, "r" )) != NULL ) {
+	    while ( fgets( line, sizeof( line ), f ) != NULL ) {
+		len = strlen( line );
+		if (( len > 1 ) && ( line[ len - 1 ] == '\n' )) {
+		    line[ len - 1 ] = '\0';
+		    path_add( line );
+		}
+	    }
+	    fclose( f );
+	} else if ( errno != ENOENT ) {
+	    perror( journal );
+	    exit( 2 );
+	}
+    }
+
+    if (( paths = (char **)malloc( set_count * sizeof( char * ))) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    for ( i = 0, n = 0; i < SET_SIZE; i++ ) {
+	for ( p = set[ i ]; p != NULL; p = p->p_next ) {
+	    paths[ n++ ] = p->p_path;
+	}
+    }
+    qsort( paths, n, sizeof( char * ), path_cmp );
+
+    if ( journal != NULL ) {
+	if ( snprintf( temp, sizeof( temp ), "%s.XXXXXX", journal )
+		>= sizeof( temp )) {
+	    fprintf( stderr, "%s: path too long\n", journal );
+	    exit( 2 );
+	}
+	if (( fd = mkstemp( temp )) < 0 ) {
+	    perror( temp );
+	    exit( 2 );
+	}
+	if (( f = fdopen( fd, "w" )) == NULL ) {
+	    perror( temp );
+	    exit( 2 );
+	}
+    } else {
+	f = stdout;
+    }
+
+    for ( i = 0; i < n; i++ ) {
+	fprintf( f, "%s\n", paths[ i ] );
+    }
+
+    if ( journal != NULL ) {
+	if ( fclose( f ) != 0 ) {
+	    perror( temp );
+	    exit( 2 );
+	}
+	if ( rename( temp, journal ) != 0 ) {
+	    perror( journal );
+	    exit( 2 );
+	}
+    } else {
+	fflush( stdout );
+    }
+
+    free( paths );
+    for ( i = 0; i < SET_SIZE; i++ ) {
+	for ( p = set[ i ]; p != NULL; p = next ) {
+	    next = p->p_next;
+	    free( p->p_path );
+	    free( p );
+	}
+	set[ i ] = NULL;
+    }
+    set_count = 0;
+}
+
+    void
+stop( int sig )
+{
+    done = 1;
+}
+
+    int
+main( int ac, char *av[] )
+{
+    struct sigaction	sa;
+    struct pollfd	pfd;
+    struct stat		st;
+    struct inotify_event *ev;
+    char		buf[ 64 * 1024 ]
+			__attribute__(( aligned( __alignof__( struct inotify_event ))));
+    char		dir[ MAXPATHLEN ], *slash;
+    time_t		now, stoptime = 0, flushtime;
+    ssize_t		rr;
+    char		*p;
+    int			latency = 2;
+    int			c, err = 0;
+
+    extern int		optind;
+    extern char		*optarg;
+
+    while (( c = getopt( ac, av, "dIl:o:t:" )) != -1 ) {
+	switch ( c ) {
+	case 'd':		/* debug */
+	    debug = 1;
+	    break;
+
+	case 'I':		/* case-insensitive path comparisons */
+	    case_sensitive = 0;
+	    break;
+
+	case 'l':		/* seconds between journal writes */
+	    if (( latency = atoi( optarg )) < 1 ) {
+		err++;
+	    }
+	    break;
+
+	case 'o':		/* journal file */
+	    journal = optarg;
+	    break;
+
+	case 't':		/* time in seconds to watch */
+	    stoptime = time( NULL ) + atoi( optarg );
+	    break;
+
+	default:
+	    err++;
+	    break;
+	}
+    }
+
+    if ( err || ( ac - optind ) != 1 ) {
+	fprintf( stderr, "usage: %s [ -dI ] [ -l seconds ] [ -o journal ] "
+			 "[ -t run_time_in_seconds ] path\n", av[ 0 ] );
+	exit( 1 );
+    }
+    root = av[ optind ];
+
+    if ( journal != NULL ) {
+	if ( strlen( journal ) >= sizeof( dir )) {
+	    fprintf( stderr, "%s: path too long\n", journal );
+	    exit( 2 );
+	}
+	strcpy( dir, journal );
+	if (( slash = strrchr( dir, '/' )) == NULL ) {
+	    strcpy( dir, "." );
+	    journal_name = journal;
+	} else {
+	    *slash = '\0';
+	    journal_name = slash + 1;
+	    if ( *dir == '\0' ) {
+		strcpy( dir, "/" );
+	    }
+	}
+	if ( stat( dir, &st ) != 0 ) {
+	    perror( dir );
+	    exit( 2 );
+	}
+	journal_dev = st.st_dev;
+	journal_ino = st.st_ino;
+    }
+
+    memset( &sa, 0, sizeof( sa ));
+    sa.sa_handler = stop;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+    sigaction( SIGHUP, &sa, NULL );
+
+    if (( ifd = inotify_init1( IN_CLOEXEC )) < 0 ) {
+	perror( "inotify_init1" );
+	exit( 2 );
+    }
+    watch_tree( root, 0 );
+
+    pfd.fd = ifd;
+    pfd.events = POLLIN;
+    flushtime = time( NULL ) + latency;
+
+    while ( !done ) {
+	now = time( NULL );
+	if ( stoptime && now >= stoptime ) {
+	    break;
+	}
+	if ( now >= flushtime ) {
+	    flush();
+	    flushtime = now + latency;
+	}
+
+	if ( poll( &pfd, 1, 1000 ) < 0 ) {
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    perror( "poll" );
+	    exit( 2 );
+	}
+	if ( !( pfd.revents & POLLIN )) {
+	    continue;
+	}
+
+	if (( rr = read( ifd, buf, sizeof( buf ))) < 0 ) {
+	    if ( errno == EINTR ) {
+		continue;
+	    }
+	    perror( "read" );
+	    exit( 2 );
+	}
+	for ( p = buf; p < buf + rr;
+		p += sizeof( struct inotify_event ) + ev->len ) {
+	    ev = (struct inotify_event *)p;
+	    event( ev );
+	}
+    }
+
+    flush();
+
+    return( overflows ? 3 : 0 );
+}
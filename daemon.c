@@ -41,10 +41,16 @@
 
 #include <snet.h>
 
+#include "applefile.h"
+#include "cksum.h"
 #include "command.h"
 #include "logname.h"
+#include "statcache.h"
 #include "tls.h"
 
+/* a pooled worker exits after this many connections, and is replaced */
+#define RADMIND_WORKER_CONNS	1000
+
 void            (*logger)( char * ) = NULL;
 
 int		debug = 0;
@@ -59,6 +65,9 @@ int             child_signal = 0;
 int		maxconnections = _RADMIND_MAXCONNECTIONS; /* 0 = no limit */
 int		rap_extensions = 1;			/* 1 for REPO */
 int             reinit_ssl_signal = 0;
+int		term_signal = 0;
+int		workers = 0;		/* 0 forks a child per connection */
+pid_t		*worker_pids = NULL;
 char		*radmind_path = _RADMIND_PATH;
 SSL_CTX         *ctx = NULL;
 
@@ -71,6 +80,8 @@ extern char	*version;
 void		hup( int );
 void		usr1( int );
 void		chld( int );
+void		term( int );
+void		worker( int );
 int		main( int, char *av[] );
 
     void
@@ -96,6 +107,57 @@ chld( int sig )
 
 }
 
+    void
+term( int sig )
+{
+    term_signal = 1;
+    return;
+}
+
+/*
+ * A pooled worker takes connections on s one after another, up to
+ * RADMIND_WORKER_CONNS of them.  It keeps the SSL context it was forked
+ * with, so on SIGUSR1 it finishes its client and exits, and the parent
+ * forks a new worker with the new context.
+ */
+    void
+worker( int s )
+{
+    struct sockaddr_in	sin;
+    socklen_t		addrlen;
+    sigset_t		usr1, omask;
+    int			fd, n = 0;
+
+    sigemptyset( &usr1 );
+    sigaddset( &usr1, SIGUSR1 );
+
+    /* the size of the pool limits connections, not -m */
+    connections = 0;
+
+    while (( n < RADMIND_WORKER_CONNS ) && !reinit_ssl_signal ) {
+	addrlen = sizeof( struct sockaddr_in );
+	if (( fd = accept( s, (struct sockaddr *)&sin, &addrlen )) < 0 ) {
+	    if ( errno != EINTR ) {
+		syslog( LOG_ERR, "accept: %m" );
+	    }
+	    continue;
+	}
+	n++;
+
+	if ( sigprocmask( SIG_BLOCK, &usr1, &omask ) < 0 ) {
+	    syslog( LOG_ERR, "sigprocmask: %m" );
+	    exit( 1 );
+	}
+	(void)cmdloop( fd, &sin );
+	if ( sigprocmask( SIG_SETMASK, &omask, NULL ) < 0 ) {
+	    syslog( LOG_ERR, "sigprocmask: %m" );
+	    exit( 1 );
+	}
+    }
+
+    exit( 0 );
+}
+
 #ifdef HAVE_DNSSD
     static void
 dnsreg_callback( DNSServiceRef dnssrv, DNSServiceFlags flags,
@@ -137,11 +199,12 @@ register_service( DNSServiceRef *dnssrv, unsigned int port,
     int
 main( int ac, char **av )
 {
-    struct sigaction	sa, osahup, osausr1, osachld;
+    struct sigaction	sa, osahup, osausr1, osachld, osaterm;
+    sigset_t		sigs, waitmask;
     struct sockaddr_in	sin;
     struct in_addr	b_addr;
     struct servent	*se;
-    int			c, s, err = 0, fd, trueint;
+    int			c, i, s, err = 0, fd, trueint;
     socklen_t		addrlen;
     int			dontrun = 0, fg = 0;
     int			use_randfile = 0;
@@ -175,7 +238,7 @@ main( int ac, char **av )
     cert = "cert/cert.pem"; 	 
     privatekey = "cert/cert.pem";
 
-#define RADMIND_DAEMON_OPTS	"a:Bb:C:dD:F:fL:m:p:P:Rru:UVw:x:y:z:Z:"
+#define RADMIND_DAEMON_OPTS	"a:Bb:C:dD:F:fj:L:m:O:p:P:Rru:UVw:x:y:z:Z:"
     while (( c = getopt( ac, av, RADMIND_DAEMON_OPTS )) != EOF ) {
 	switch ( c ) {
 	case 'a' :		/* bind address */ 
@@ -233,6 +296,10 @@ main( int ac, char **av )
 	    fg = 1;
 	    break;
 
+	case 'j' :		/* pre-forked workers */
+	    workers = atoi( optarg );
+	    break;
+
 	case 'L' :		/* syslog level */
 	    if (( level = sysloglevel( optarg )) == -1 ) {
 		fprintf( stderr, "%s: unknown syslog level\n", optarg );
@@ -244,6 +311,13 @@ main( int ac, char **av )
 	    maxconnections = atoi( optarg );	/* Set max connections */
 	    break;
 
+	case 'O' :		/* how to read files to checksum */
+	    if ( cksum_options( optarg ) != 0 ) {
+		fprintf( stderr, "%s: bad read options\n", optarg );
+		exit( 1 );
+	    }
+	    break;
+
 	case 'p' :		/* TCP port */
 	    port = htons( atoi( optarg ));
 	    break;
@@ -323,7 +397,9 @@ main( int ac, char **av )
 	fprintf( stderr, "Usage: radmind [ -dBrUV ] [ -a bind-address ] " );
 	fprintf( stderr, "[ -b backlog ] [ -C crl-pem-file-or-dir ] " );
 	fprintf( stderr, "[ -D path ] [ -F syslog-facility ]" );
+	fprintf( stderr, "[ -j workers ] " );
 	fprintf( stderr, "[ -L syslog-level ] [ -m max-connections ] " );
+	fprintf( stderr, "[ -O read-options ] " );
 	fprintf( stderr, "[ -p port ] [ -P ca-pem-directory ] [ -u umask ] " );
 	fprintf( stderr, "[ -w auth-level ] [ -x ca-pem-file ] " );
 	fprintf( stderr, "[ -y cert-pem-file] [ -z key-pem-file ] " );
@@ -336,6 +412,11 @@ main( int ac, char **av )
 	exit( 1 );
     }
 
+    if ( workers < 0 ) {
+	fprintf( stderr, "%d: invalid number of workers\n", workers );
+	exit( 1 );
+    }
+
     if ( checkuser && ( authlevel < 1 )) {
 	fprintf( stderr, "-U requires auth-level > 0\n" );
 	exit( 1 );
@@ -505,6 +586,35 @@ main( int ac, char **av )
 	exit( 1 );
     }
 
+    /* checksums for STAT, shared by the children */
+    sc_init();
+
+    if ( workers > 0 ) {
+	if (( worker_pids = (pid_t *)calloc( workers, sizeof( pid_t )))
+		== NULL ) {
+	    syslog( LOG_ERR, "calloc: %m" );
+	    exit( 1 );
+	}
+
+	/* catch SIGTERM, to let the workers finish their clients */
+	memset( &sa, 0, sizeof( struct sigaction ));
+	sa.sa_handler = term;
+	if ( sigaction( SIGTERM, &sa, &osaterm ) < 0 ) {
+	    syslog( LOG_ERR, "sigaction: %m" );
+	    exit( 1 );
+	}
+
+	/* only take signals while waiting in sigsuspend() */
+	sigemptyset( &sigs );
+	sigaddset( &sigs, SIGCHLD );
+	sigaddset( &sigs, SIGUSR1 );
+	sigaddset( &sigs, SIGTERM );
+	if ( sigprocmask( SIG_BLOCK, &sigs, &waitmask ) < 0 ) {
+	    syslog( LOG_ERR, "sigprocmask: %m" );
+	    exit( 1 );
+	}
+    }
+
     syslog( LOG_INFO, "restart %s", version );
 
     /*
@@ -538,6 +648,13 @@ main( int ac, char **av )
             reinit_ssl_signal = 0;
 
             syslog( LOG_NOTICE, "reinitialized SSL context" );
+
+	    /* have the workers make way for ones with the new context */
+	    for ( i = 0; i < workers; i++ ) {
+		if ( worker_pids[ i ] != 0 ) {
+		    (void)kill( worker_pids[ i ], SIGUSR1 );
+		}
+	    }
         }
 
 	if ( child_signal > 0 ) {
@@ -550,7 +667,15 @@ main( int ac, char **av )
 #else
             while (( pid = wait3(&status, WNOHANG, &usage )) > 0 ) {
 #endif
-		connections--;
+		if ( workers > 0 ) {
+		    for ( i = 0; i < workers; i++ ) {
+			if ( worker_pids[ i ] == pid ) {
+			    worker_pids[ i ] = 0;
+			}
+		    }
+		} else {
+		    connections--;
+		}
 
 		/* Print stats */
 		utime = usage.ru_utime.tv_sec
@@ -591,6 +716,45 @@ main( int ac, char **av )
 	    }
 	}
 
+	if ( workers > 0 ) {
+	    if ( term_signal ) {
+		for ( i = 0; i < workers; i++ ) {
+		    if ( worker_pids[ i ] != 0 ) {
+			(void)kill( worker_pids[ i ], SIGUSR1 );
+		    }
+		}
+		exit( 0 );
+	    }
+
+	    /* replace workers that have exited */
+	    for ( i = 0; i < workers; i++ ) {
+		if ( worker_pids[ i ] != 0 ) {
+		    continue;
+		}
+		if (( c = fork()) == 0 ) {
+		    /* keep USR1, and reset CHLD, HUP and TERM */
+		    if ( sigaction( SIGCHLD, &osachld, 0 ) < 0 ||
+			    sigaction( SIGHUP, &osahup, 0 ) < 0 ||
+			    sigaction( SIGTERM, &osaterm, 0 ) < 0 ||
+			    sigprocmask( SIG_SETMASK, &waitmask, NULL ) < 0 ) {
+			syslog( LOG_ERR, "sigaction: %m" );
+			exit( 1 );
+		    }
+		    worker( s );
+		}
+		if ( c < 0 ) {
+		    syslog( LOG_ERR, "fork: %m" );
+		    sleep( 10 );
+		    break;
+		}
+		worker_pids[ i ] = c;
+		syslog( LOG_INFO, "worker %d started", c );
+	    }
+
+	    sigsuspend( &waitmask );
+	    continue;
+	}
+
 	addrlen = sizeof( struct sockaddr_in );
 	if (( fd = accept( s, (struct sockaddr *)&sin, &addrlen )) < 0 ) {
 	    if ( errno != EINTR ) {
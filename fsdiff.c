@@ -12,87 +12,637 @@
 #include <errno.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 
 #include <openssl/evp.h>
 
 #include "applefile.h"
+#include "cksum.h"
 #include "transcript.h"
 #include "pathcmp.h"
 #include "radstat.h"
+#include "stats.h"
+#include "cksumcache.h"
+#include "workq.h"
 
 void            (*logger)( char * ) = NULL;
 
 extern char	*version, *checksumlist;
 
-void		fs_walk( char *, struct stat *, char *, struct applefileinfo *,
-	int, int, int );
+struct fs_job;
+
+void		fs_walk( char *, int, char *, struct stat *, char *,
+	struct applefileinfo *, int, int, int, struct fs_job * );
 int		dodots = 0;
-int		dotfd;
 int		lastpercent = -1;
 int		case_sensitive = 1;
 int		tran_format = -1; 
 extern int	exclude_warnings;
+extern int	closure;
 const EVP_MD    *md;
 
-static struct fs_list *fs_insert( struct fs_list **, struct fs_list *,
-	char *, int (*)( const char *, const char * ));
-
+/* fl_type is '\0' for an excluded entry that hasn't been radstat'd */
 struct fs_list {
-    struct fs_list		*fl_next;
     char			*fl_name;
+    size_t			fl_off;
+    struct fs_job		*fl_job;
     struct stat			fl_stat;
     char			fl_type;
     struct applefileinfo	fl_afinfo;
 };
 
+/*
+ * A directory listing.  Entries are read in one pass into fd_ents, with
+ * every name packed into a single arena, and sorted once when the read
+ * is complete.  The whole listing is released with fs_dir_free().
+ */
+struct fs_dir {
+    struct fs_list		*fd_ents;
+    struct fs_list		**fd_sorted;
+    int				fd_count;
+    int				fd_size;
+    char			*fd_names;
+    size_t			fd_nlen;
+    size_t			fd_nsize;
+};
+
+/*
+ * With -j, directories are read and their entries radstat'd by the
+ * worker pool ahead of the walk.  The walk still visits entries, and
+ * calls transcript(), strictly in order; it only waits for the listing
+ * of each directory it enters.  A job that hits any error is thrown
+ * away and the walk reads that directory itself, so errors are reported
+ * exactly as they are without -j.
+ */
+struct fs_job {
+    int				fj_state;
+    int				fj_abandoned;
+    int				fj_failed;
+    int				fj_pending;
+    int				fj_fd;
+    char			*fj_path;
+    struct fs_dir		fj_dir;
+};
+
+struct fs_chunk {
+    struct fs_job		*fc_job;
+    int				fc_start;
+    int				fc_end;
+};
+
+#define FJ_QUEUED	0
+#define FJ_READING	1
+#define FJ_DONE		2
+#define FJ_FAILED	3
+
+#define FS_CHUNK	64	/* entries radstat'd per task */
+#define FS_AHEAD	2	/* directories read ahead per thread */
+
+static struct fs_list	*fs_dir_add( struct fs_dir *, char * );
+static void		fs_dir_names( struct fs_dir * );
+static void		fs_dir_sort( struct fs_dir * );
+static int		fs_dir_open( int, char * );
+static struct dirent	*fs_readdir( DIR * );
+static int		fs_radstatat( int, char *, struct stat *, char *,
+	struct applefileinfo * );
+static void		fs_dir_read( struct fs_dir *, char *, int );
+static void		fs_dir_free( struct fs_dir * );
+static int		fs_namecmp( const void *, const void * );
+static int		fs_path( char *, char *, char * );
+static size_t		fs_prefix( char *, char * );
+static int		fs_skip( char *, size_t, char * );
+static void		fs_stat( int, char *, char *, struct fs_list * );
+static struct fs_job	*fs_job_new( char * );
+static void		fs_job_read( void * );
+static void		fs_job_stat( void * );
+static void		fs_job_finish( struct fs_job *, int );
+static int		fs_job_claim( struct fs_job *, struct fs_dir * );
+static void		fs_job_release( struct fs_job * );
+static void		fs_job_free( struct fs_job * );
+static void		fs_prefetch( struct fs_dir *, int, char * );
+
+static int		(*fs_cmp)( const char *, const char * );
+static int		fs_threads = 1;
+
     static struct fs_list *
-fs_insert( struct fs_list **head, struct fs_list *last,
-	char *name, int (*cmp)( const char *, const char * ))
+fs_dir_add( struct fs_dir *dir, char *name )
+{
+    struct fs_list	*new;
+    size_t		len;
+
+    if ( dir->fd_count >= dir->fd_size ) {
+	dir->fd_size = ( dir->fd_size == 0 ) ? 64 : dir->fd_size * 2;
+	if (( new = realloc( dir->fd_ents,
+		dir->fd_size * sizeof( struct fs_list ))) == NULL ) {
+	    return( NULL );
+	}
+	dir->fd_ents = new;
+    }
+
+    len = strlen( name ) + 1;
+    if ( dir->fd_nlen + len > dir->fd_nsize ) {
+	char		*names;
+
+	if ( dir->fd_nsize == 0 ) {
+	    dir->fd_nsize = 4096;
+	}
+	while ( dir->fd_nlen + len > dir->fd_nsize ) {
+	    dir->fd_nsize *= 2;
+	}
+	if (( names = realloc( dir->fd_names, dir->fd_nsize )) == NULL ) {
+	    return( NULL );
+	}
+	dir->fd_names = names;
+    }
+
+    /* the arena may move while reading, so remember offsets for now */
+    new = &dir->fd_ents[ dir->fd_count++ ];
+    memcpy( dir->fd_names + dir->fd_nlen, name, len );
+    new->fl_name = NULL;
+    new->fl_off = dir->fd_nlen;
+    new->fl_job = NULL;
+    dir->fd_nlen += len;
+
+    return( new );
+}
+
+/* Once nothing more will be added, point each entry at its name. */
+    static void
+fs_dir_names( struct fs_dir *dir )
+{
+    int			i;
+
+    for ( i = 0; i < dir->fd_count; i++ ) {
+	dir->fd_ents[ i ].fl_name = dir->fd_names + dir->fd_ents[ i ].fl_off;
+    }
+}
+
+    static int
+fs_namecmp( const void *a, const void *b )
+{
+    const struct fs_list	*fa = *(const struct fs_list **)a;
+    const struct fs_list	*fb = *(const struct fs_list **)b;
+    int				rc;
+
+    if (( rc = (*fs_cmp)( fa->fl_name, fb->fl_name )) != 0 ) {
+	return( rc );
+    }
+
+    /*
+     * Names that only differ by case under -I keep the order the old
+     * sorted insert gave them: most recently read first.
+     */
+    if ( fa > fb ) {
+	return( -1 );
+    }
+    return( fa < fb );
+}
+
+    static void
+fs_dir_sort( struct fs_dir *dir )
+{
+    int			i;
+
+    if ( dir->fd_count == 0 ) {
+	return;
+    }
+    if (( dir->fd_sorted = malloc( dir->fd_count *
+	    sizeof( struct fs_list * ))) == NULL ) {
+	perror( "malloc" );
+	exit( 1 );
+    }
+    fs_dir_names( dir );
+    for ( i = 0; i < dir->fd_count; i++ ) {
+	dir->fd_sorted[ i ] = &dir->fd_ents[ i ];
+    }
+
+    qsort( dir->fd_sorted, dir->fd_count, sizeof( struct fs_list * ),
+	    fs_namecmp );
+}
+
+    static void
+fs_dir_free( struct fs_dir *dir )
+{
+    free( dir->fd_sorted );
+    free( dir->fd_ents );
+    free( dir->fd_names );
+    memset( dir, 0, sizeof( struct fs_dir ));
+}
+
+    static int
+fs_path( char *buf, char *path, char *name )
 {
-    struct fs_list	**current, *new;
+    int			len;
 
-    if (( last != NULL ) && ( (*cmp)( name, last->fl_name ) > 0 )) {
-	current = &last->fl_next;
+    len = strlen( path );
+    if ( path[ len - 1 ] == '/' ) {
+	if ( snprintf( buf, MAXPATHLEN, "%s%s", path, name ) >= MAXPATHLEN ) {
+	    return( -1 );
+	}
     } else {
-	current = head;
+	if ( snprintf( buf, MAXPATHLEN, "%s/%s", path, name ) >= MAXPATHLEN ) {
+	    return( -1 );
+	}
+    }
+    return( 0 );
+}
+
+/* Copy path and a separator to buf, returning the length. */
+    static size_t
+fs_prefix( char *buf, char *path )
+{
+    size_t		len;
+
+    len = strlen( path );
+    memcpy( buf, path, len );
+    if ( path[ len - 1 ] != '/' ) {
+	buf[ len++ ] = '/';
     }
+    return( len );
+}
 
-    /* find where in the list to put the new entry */
-    for ( ; *current != NULL; current = &(*current)->fl_next) {
-	if ( (*cmp)( name, (*current)->fl_name ) <= 0 ) {
-	    break;
+/*
+ * Will transcript() skip name, in the directory whose fs_prefix() is
+ * in buf, without looking at it?  Then there's no need to stat it.
+ */
+    static int
+fs_skip( char *buf, size_t len, char *name )
+{
+    size_t		nlen;
+
+    nlen = strlen( name );
+    if ( len + nlen >= MAXPATHLEN ) {
+	/* let the walk complain */
+	return( 0 );
+    }
+    memcpy( buf + len, name, nlen + 1 );
+    return( transcript_skip( buf ));
+}
+
+/* radstat ent, name in the directory path open as fd, exiting on error. */
+    static void
+fs_stat( int fd, char *name, char *path, struct fs_list *ent )
+{
+    switch ( fs_radstatat( fd, name, &ent->fl_stat, &ent->fl_type,
+	    &ent->fl_afinfo )) {
+    case 0:
+	break;
+    case 1:
+	fprintf( stderr, "%s is of an unknown type\n", path );
+	exit( 2 );
+    default:
+	if (( errno != ENOTDIR ) && ( errno != ENOENT )) {
+	    perror( path );
+	    exit( 2 );
 	}
     }
+}
 
-    if (( new = malloc( sizeof( struct fs_list ))) == NULL ) {
-	return( NULL );
+/*
+ * Open the directory name, relative to dfd, for reading and for looking
+ * up its entries.  Returns -1 with errno set on error.
+ */
+    static int
+fs_dir_open( int dfd, char *name )
+{
+    stats_count( SC_OPENDIR, 1 );
+    return( openat( dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW ));
+}
+
+/* readdir() and radstatat(), counted and timed for -S */
+    static struct dirent *
+fs_readdir( DIR *dir )
+{
+    struct dirent	*de;
+    int			phase;
+
+    phase = stats_enter( SP_READDIR );
+    de = readdir( dir );
+    stats_leave( phase );
+    stats_count( SC_READDIR, 1 );
+
+    return( de );
+}
+
+    static int
+fs_radstatat( int fd, char *name, struct stat *st, char *type,
+	struct applefileinfo *afinfo )
+{
+    int			rc, phase;
+
+    phase = stats_enter( SP_STAT );
+    rc = radstatat( fd, name, st, type, afinfo );
+    stats_leave( phase );
+    stats_count( SC_STAT, 1 );
+
+    return( rc );
+}
+
+/*
+ * Read and radstat the directory path, open as fd, into list, exiting
+ * on any error.
+ */
+    static void
+fs_dir_read( struct fs_dir *list, char *path, int fd )
+{
+    DIR			*dir;
+    struct dirent	*de;
+    struct fs_list	*new;
+    char		temp[ MAXPATHLEN ];
+    size_t		len;
+    int			dirfd;
+
+    /* closedir() closes the descriptor it is given, and we need fd */
+    if ((( dirfd = dup( fd )) < 0 ) ||
+	    (( dir = fdopendir( dirfd )) == NULL )) {
+	perror( path );
+	exit( 2 );	
     }
-    if (( new->fl_name = strdup( name )) == NULL ) {
-	free( new );
-	return( NULL );
+
+    len = fs_prefix( temp, path );
+
+    /* read contents of directory */
+    while (( de = fs_readdir( dir )) != NULL ) {
+
+	/* don't include . and .. */
+	if (( strcmp( de->d_name, "." ) == 0 ) || 
+		( strcmp( de->d_name, ".." ) == 0 )) {
+	    continue;
+	}
+
+	if (( new = fs_dir_add( list, de->d_name )) == NULL ) {
+	    perror( "malloc" );
+	    exit( 1 );
+	}
+
+	if ( fs_skip( temp, len, de->d_name )) {
+	    new->fl_type = '\0';
+	    continue;
+	}
+	fs_stat( fd, de->d_name, path, new );
+    }
+
+    if ( closedir( dir ) != 0 ) {
+	perror( "closedir" );
+	exit( 2 );
     }
 
-    new->fl_next = *current;
-    *current = new; 
-    return( new ); 
+    fs_dir_sort( list );
 }
 
-    void
-fs_walk( char *path, struct stat *st, char *type, struct applefileinfo *afinfo,
-	int start, int finish, int pdel ) 
+    static struct fs_job *
+fs_job_new( char *path )
 {
+    struct fs_job	*job;
+
+    if (( job = calloc( 1, sizeof( struct fs_job ))) == NULL ) {
+	perror( "calloc" );
+	exit( 2 );
+    }
+    if (( job->fj_path = strdup( path )) == NULL ) {
+	perror( "strdup" );
+	exit( 2 );
+    }
+    job->fj_state = FJ_QUEUED;
+    job->fj_fd = -1;
+
+    wq_push( fs_job_read, job, WQ_HEAD );
+
+    return( job );
+}
+
+    static void
+fs_job_free( struct fs_job *job )
+{
+    fs_dir_free( &job->fj_dir );
+    if ( job->fj_fd >= 0 ) {
+	close( job->fj_fd );
+    }
+    free( job->fj_path );
+    free( job );
+}
+
+/* worker: read the names in a directory, then radstat them in chunks */
+    static void
+fs_job_read( void *arg )
+{
+    struct fs_job	*job = arg;
+    struct fs_chunk	*chunk;
     DIR			*dir;
     struct dirent	*de;
-    struct fs_list	*head = NULL, *cur, *new = NULL, *next;
-    int			len;
-    int			count = 0;
+    int			i, count, fd, failed = 0;
+
+    wq_lock();
+    job->fj_state = FJ_READING;
+    wq_unlock();
+
+    if (( job->fj_fd = fs_dir_open( AT_FDCWD, job->fj_path )) < 0 ) {
+	fs_job_finish( job, 1 );
+	return;
+    }
+    if ((( fd = dup( job->fj_fd )) < 0 ) ||
+	    (( dir = fdopendir( fd )) == NULL )) {
+	if ( fd >= 0 ) {
+	    close( fd );
+	}
+	fs_job_finish( job, 1 );
+	return;
+    }
+    while (( de = fs_readdir( dir )) != NULL ) {
+	if (( strcmp( de->d_name, "." ) == 0 ) || 
+		( strcmp( de->d_name, ".." ) == 0 )) {
+	    continue;
+	}
+	if ( fs_dir_add( &job->fj_dir, de->d_name ) == NULL ) {
+	    failed = 1;
+	    break;
+	}
+    }
+    if ( closedir( dir ) != 0 ) {
+	failed = 1;
+    }
+
+    if ( failed || ( job->fj_dir.fd_count == 0 )) {
+	fs_job_finish( job, failed );
+	return;
+    }
+
+    fs_dir_names( &job->fj_dir );
+    count = job->fj_dir.fd_count;
+
+    wq_lock();
+    job->fj_pending = ( count + FS_CHUNK - 1 ) / FS_CHUNK;
+    wq_unlock();
+
+    /* the last chunk to finish may free job, so don't touch it after */
+    for ( i = 0; i < count; i += FS_CHUNK ) {
+	if (( chunk = malloc( sizeof( struct fs_chunk ))) == NULL ) {
+	    perror( "malloc" );
+	    exit( 2 );
+	}
+	chunk->fc_job = job;
+	chunk->fc_start = i;
+	chunk->fc_end = MIN( i + FS_CHUNK, count );
+	wq_push( fs_job_stat, chunk, WQ_HEAD );
+    }
+}
+
+    static void
+fs_job_stat( void *arg )
+{
+    struct fs_chunk	*chunk = arg;
+    struct fs_job	*job = chunk->fc_job;
+    struct fs_list	*cur;
+    char		temp[ MAXPATHLEN ];
+    size_t		len;
+    int			i, done, failed = 0;
+
+    len = fs_prefix( temp, job->fj_path );
+    for ( i = chunk->fc_start; i < chunk->fc_end && !failed; i++ ) {
+	cur = &job->fj_dir.fd_ents[ i ];
+	if ( fs_skip( temp, len, cur->fl_name )) {
+	    cur->fl_type = '\0';
+	    continue;
+	}
+	switch ( fs_radstatat( job->fj_fd, cur->fl_name, &cur->fl_stat,
+		&cur->fl_type, &cur->fl_afinfo )) {
+	case 0:
+	    break;
+	case 1:
+	    failed = 1;
+	    break;
+	default:
+	    if (( errno != ENOTDIR ) && ( errno != ENOENT )) {
+		failed = 1;
+	    }
+	}
+    }
+    free( chunk );
+
+    wq_lock();
+    if ( failed ) {
+	job->fj_failed = 1;
+    }
+    done = ( --job->fj_pending == 0 );
+    wq_unlock();
+
+    if ( done ) {
+	fs_job_finish( job, job->fj_failed );
+    }
+}
+
+    static void
+fs_job_finish( struct fs_job *job, int failed )
+{
+    if ( !failed ) {
+	fs_dir_sort( &job->fj_dir );
+    }
+
+    /* don't hold descriptors for directories the walk hasn't reached */
+    if ( job->fj_fd >= 0 ) {
+	close( job->fj_fd );
+	job->fj_fd = -1;
+    }
+
+    wq_lock();
+    job->fj_state = failed ? FJ_FAILED : FJ_DONE;
+    if ( job->fj_abandoned ) {
+	fs_job_free( job );
+    }
+    wq_unlock();
+}
+
+/*
+ * Wait for job and move its listing into list.  Returns -1 if the job
+ * failed and the caller must read the directory itself.
+ */
+    static int
+fs_job_claim( struct fs_job *job, struct fs_dir *list )
+{
+    int			rc = -1;
+
+    wq_lock();
+    if ( job->fj_state == FJ_QUEUED ) {
+	/* we need it now */
+	wq_promote( job );
+    }
+    while (( job->fj_state == FJ_QUEUED ) ||
+	    ( job->fj_state == FJ_READING )) {
+	wq_wait();
+    }
+    if ( job->fj_state == FJ_DONE ) {
+	*list = job->fj_dir;
+	memset( &job->fj_dir, 0, sizeof( struct fs_dir ));
+	rc = 0;
+    }
+    wq_unlock();
+
+    return( rc );
+}
+
+/* Called by whoever created job, once the walk is past it. */
+    static void
+fs_job_release( struct fs_job *job )
+{
+    if ( job == NULL ) {
+	return;
+    }
+
+    wq_lock();
+    if (( job->fj_state == FJ_QUEUED ) && wq_cancel( job )) {
+	fs_job_free( job );
+    } else if (( job->fj_state == FJ_QUEUED ) ||
+	    ( job->fj_state == FJ_READING )) {
+	/* a worker has it, and will free it when done */
+	job->fj_abandoned = 1;
+    } else {
+	fs_job_free( job );
+    }
+    wq_unlock();
+}
+
+/* Start reading the next few subdirectories the walk will enter. */
+    static void
+fs_prefetch( struct fs_dir *list, int i, char *path )
+{
+    struct fs_list	*cur;
+    char		temp[ MAXPATHLEN ];
+    int			end;
+
+    end = MIN( list->fd_count, i + ( fs_threads * FS_AHEAD ));
+    for ( ; i < end; i++ ) {
+	cur = list->fd_sorted[ i ];
+	if (( cur->fl_type != 'd' ) || ( cur->fl_job != NULL )) {
+	    continue;
+	}
+	if ( fs_path( temp, path, cur->fl_name ) != 0 ) {
+	    continue;
+	}
+	cur->fl_job = fs_job_new( temp );
+    }
+}
+
+/*
+ * Walk path, which is name relative to the open directory dfd.  Each
+ * directory is held open while its entries are visited, and they are
+ * looked up relative to it.
+ */
+    void
+fs_walk( char *path, int dfd, char *name, struct stat *st, char *type,
+	struct applefileinfo *afinfo, int start, int finish, int pdel,
+	struct fs_job *job ) 
+{
+    struct fs_dir	list;
+    struct fs_list	*cur;
+    struct fs_job	*own = NULL;
+    int			i, fd, top;
+    size_t		len, nlen;
     int			del_parent;
     float		chunk, f = start;
     char		temp[ MAXPATHLEN ];
     struct transcript	*tran;
-    int			(*cmp)( const char *, const char * );
 
     if (( finish > 0 ) && ( start != lastpercent )) {
 	lastpercent = start;
@@ -100,8 +650,10 @@ fs_walk( char *path, struct stat *st, char *type, struct applefileinfo *afinfo,
 	fflush( stdout );
     }
 
+    stats_count( SC_ENTRIES, 1 );
+
     /* call the transcript code */
-    switch ( transcript( path, st, type, afinfo, pdel )) {
+    switch ( transcript( path, dfd, name, st, type, afinfo, pdel )) {
     case 2 :			/* negative directory */
 	for (;;) {
 	    tran = transcript_select();
@@ -115,7 +667,8 @@ fs_walk( char *path, struct stat *st, char *type, struct applefileinfo *afinfo,
 		struct applefileinfo	afinfo0;
 
 		strcpy( temp, tran->t_pinfo.pi_name );
-		switch ( radstat( temp, &st0, &type0, &afinfo0 )) {
+		switch ( fs_radstatat( AT_FDCWD, temp, &st0, &type0,
+			&afinfo0 )) {
 		case 0:
 		    break;
 		case 1:
@@ -128,7 +681,8 @@ fs_walk( char *path, struct stat *st, char *type, struct applefileinfo *afinfo,
 		    }
 		}
 
-		fs_walk( temp, &st0, &type0, &afinfo0, start, finish, pdel );
+		fs_walk( temp, AT_FDCWD, temp, &st0, &type0, &afinfo0,
+			start, finish, pdel, NULL );
 	    } else {
 		return;
 	    }
@@ -158,93 +712,70 @@ fs_walk( char *path, struct stat *st, char *type, struct applefileinfo *afinfo,
      */
     del_parent = fs_minus;
 
-    if ( case_sensitive ) {
-	cmp = strcmp;
-    } else {
-	cmp = strcasecmp;
+    /* there'd be nothing to see in a directory that's wholly excluded */
+    if ( !del_parent && ( finish <= 0 ) && transcript_covered( path )) {
+	return;
     }
 
-    if ( chdir( path ) < 0 ) {
+    memset( &list, 0, sizeof( struct fs_dir ));
+    if (( job == NULL ) && ( fs_threads > 1 )) {
+	job = own = fs_job_new( path );
+    }
+    if (( fd = fs_dir_open( dfd, name )) < 0 ) {
 	perror( path );
 	exit( 2 );
     }
-
-    /* open directory */
-    if (( dir = opendir( "." )) == NULL ) {
-	perror( path );
-	exit( 2 );	
+    if (( job == NULL ) || ( fs_job_claim( job, &list ) != 0 )) {
+	fs_dir_read( &list, path, fd );
     }
+    fs_job_release( own );
 
-    /* read contents of directory */
-    while (( de = readdir( dir )) != NULL ) {
-
-	/* don't include . and .. */
-	if (( strcmp( de->d_name, "." ) == 0 ) || 
-		( strcmp( de->d_name, ".." ) == 0 )) {
-	    continue;
-	}
+    chunk = (( finish - start ) / ( float )list.fd_count );
 
-	count++;
+    /* each entry's path is its name appended to ours */
+    len = fs_prefix( temp, path );
 
-	if (( new = fs_insert( &head, new, de->d_name, cmp )) == NULL ) {
-	    perror( "malloc" );
-	    exit( 1 );
-	}
-
-	switch ( radstat( new->fl_name, &new->fl_stat, &new->fl_type,
-		&new->fl_afinfo )) {
-	case 0:
-	    break;
-	case 1:
-	    fprintf( stderr, "%s is of an unknown type\n", path );
+    /* call fswalk on each element in the sorted list */
+    for ( i = 0; i < list.fd_count; i++ ) {
+	cur = list.fd_sorted[ i ];
+	nlen = strlen( cur->fl_name );
+	if ( len + nlen >= MAXPATHLEN ) {
+	    temp[ len ] = '\0';
+	    fprintf( stderr, "%s%s: path too long\n", temp, cur->fl_name );
 	    exit( 2 );
-	default:
-	    if (( errno != ENOTDIR ) && ( errno != ENOENT )) {
-		perror( path );
-		exit( 2 );
-	    }
 	}
-    }
-
-    if ( closedir( dir ) != 0 ) {
-	perror( "closedir" );
-	exit( 2 );
-    }
-
-    if ( fchdir( dotfd ) < 0 ) {
-	perror( "OOPS!" );
-	exit( 2 );
-    }
-
-    chunk = (( finish - start ) / ( float )count );
+	memcpy( temp + len, cur->fl_name, nlen + 1 );
 
-    len = strlen( path );
+	/* excluded entries are looked at after all if we're removing this */
+	if (( cur->fl_type == '\0' ) && del_parent ) {
+	    fs_stat( fd, cur->fl_name, path, cur );
+	}
 
-    /* call fswalk on each element in the sorted list */
-    for ( cur = head; cur != NULL; cur = next ) {
-	if ( path[ len - 1 ] == '/' ) {
-	    if ( snprintf( temp, MAXPATHLEN, "%s%s", path, cur->fl_name )
-		    >= MAXPATHLEN ) {
-                fprintf( stderr, "%s%s: path too long\n", path, cur->fl_name );
-		exit( 2 );
-	    }
-	} else {
-            if ( snprintf( temp, MAXPATHLEN, "%s/%s", path, cur->fl_name )
-		    >= MAXPATHLEN ) {
-                fprintf( stderr, "%s/%s: path too long\n", path, cur->fl_name );
-                exit( 2 );
-            }
+	if ( fs_threads > 1 ) {
+	    fs_prefetch( &list, i, path );
 	}
 
-	fs_walk( temp, &cur->fl_stat, &cur->fl_type, &cur->fl_afinfo,
-		(int)f, (int)( f + chunk ), del_parent );
+	/* -S times each directory at the top of the walk */
+	top = ( path == path_prefix ) && ( cur->fl_type == 'd' );
+	if ( top ) {
+	    stats_dir_begin( temp );
+	}
+	fs_walk( temp, fd, cur->fl_name, &cur->fl_stat, &cur->fl_type,
+		&cur->fl_afinfo, (int)f, (int)( f + chunk ), del_parent,
+		cur->fl_job );
+	if ( top ) {
+	    stats_dir_end();
+	}
+	fs_job_release( cur->fl_job );
 
 	f += chunk;
+    }
 
-	next = cur->fl_next;
-	free( cur->fl_name );
-	free( cur );
+    if ( close( fd ) != 0 ) {
+	perror( path );
+	exit( 2 );
     }
+    fs_dir_free( &list );
 
     return;
 }
@@ -327,11 +858,6 @@ fsdiff( char *path, char *kfile, int start, int finish, int pdel )
     char			lpath[ MAXPATHLEN ];
     int				len;
 
-    if (( dotfd = open( ".", O_RDONLY, 0 )) < 0 ) {
-	perror( "OOPS!" );
-	exit( 2 );
-    }
-
     if ( skip && strcmp( path, "-" ) == 0 ) {
 	/* leave excludes in place */
 	skip = skip & ~T_SKIP_EXCLUDES;
@@ -358,7 +884,7 @@ fsdiff( char *path, char *kfile, int start, int finish, int pdel )
 		fprintf( stderr, "Warning: %s: %s\n", path, strerror( errno ));
 		continue;
 	    }
-	    (void)transcript( path, &st, &type, &afinfo, pdel );
+	    (void)transcript( path, AT_FDCWD, path, &st, &type, &afinfo, pdel );
 	}
 	if ( ferror( stdin )) {
 	    perror( "fgets" );
@@ -375,16 +901,32 @@ fsdiff( char *path, char *kfile, int start, int finish, int pdel )
 	    exit( 2 );
 	}
 
-	fs_walk( path_prefix, &st, &type, &afinfo, start, finish, pdel );
+	if ( case_sensitive ) {
+	    fs_cmp = strcmp;
+	} else {
+	    fs_cmp = strcasecmp;
+	}
+	if (( fs_threads > 1 ) && ( wq_init( fs_threads ) < 0 )) {
+	    perror( "pthread_create" );
+	    exit( 2 );
+	}
+	if ( wq_threads() == 0 ) {
+	    fs_threads = 1;
+	}
+
+	fs_walk( path_prefix, AT_FDCWD, path_prefix, &st, &type, &afinfo,
+		start, finish, pdel, NULL );
     }
 
     if ( finish > 0 ) {
 	printf( "%%%d\n", ( int )finish );
     }
 
-    /* free the transcripts */
+    /* free the transcripts, the workers may still be checksumming for them */
     transcript_free( );
     hardlink_free( );
+    wq_free();
+    cc_write();
 }
 
     int
@@ -393,15 +935,17 @@ main( int argc, char **argv )
     extern char 	*optarg;
     extern int		optind;
     char		*kfile = _RADMIND_COMMANDFILE;
+    char		*cachefile = NULL, *algorithm = NULL;
+    char		*statsfile = NULL;
     int 		c, len, edit_path_change = 0;
-    int 		errflag = 0, use_outfile = 0;
+    int 		errflag = 0, use_outfile = 0, bypass = 0;
     int			finish = 0;
 
     edit_path = CREATABLE;
     cksum = 0;
     outtran = stdout;
 
-    while (( c = getopt( argc, argv, "%1ACc:IK:o:VvW" )) != EOF ) {
+    while (( c = getopt( argc, argv, "%1ACc:EH:Ij:K:NO:o:S:VvW" )) != EOF ) {
 	switch( c ) {
 	case '%':
 	case 'v':
@@ -409,19 +953,49 @@ main( int argc, char **argv )
 	    break;
 
 	case 'c':
-            OpenSSL_add_all_digests();
+            cksum_add_digests();
             md = EVP_get_digestbyname( optarg );
             if ( !md ) {
                 fprintf( stderr, "%s: unsupported checksum\n", optarg );
                 exit( 2 );
             }
             cksum = 1;
+	    algorithm = optarg;
             break;
 
+	case 'E':		/* keep the command file's closure */
+	    closure = 1;
+	    break;
+
+	case 'H':
+	    cachefile = optarg;
+	    break;
+
 	case 'I':
 	    case_sensitive = 0;
 	    break;
 
+	case 'j':
+	    if (( fs_threads = atoi( optarg )) < 1 ) {
+		errflag++;
+	    }
+	    break;
+
+	case 'N':		/* don't trust the checksum cache */
+	    bypass = 1;
+	    break;
+
+	case 'O':		/* how to read files to checksum */
+	    if ( cksum_options( optarg ) != 0 ) {
+		fprintf( stderr, "%s: bad read options\n", optarg );
+		exit( 2 );
+	    }
+	    break;
+
+	case 'S':
+	    statsfile = optarg;
+	    break;
+
 	case 'o':
 	    if (( outtran = fopen( optarg, "w" )) == NULL ) {
 		perror( optarg );
@@ -474,6 +1048,9 @@ main( int argc, char **argv )
     if ( edit_path_change > 1 ) {
 	errflag++;
     }
+    if (( cachefile != NULL ) && ( !cksum )) {
+	errflag++;
+    }
 
     /* Check that kfile isn't an abvious directory */
     len = strlen( kfile );
@@ -482,13 +1059,22 @@ main( int argc, char **argv )
     }
 
     if ( errflag || ( argc - optind != 1 )) {
-	fprintf( stderr, "usage: %s { -C | -A | -1 } " "[ -IVW ] ", argv[ 0 ] );
-	fprintf( stderr, "[ -K command ] " );
-	fprintf( stderr, "[ -c checksum ] [ -o file [ -%% ] ] path\n" );
+	fprintf( stderr, "usage: %s { -C | -A | -1 } " "[ -EIVW ] ", argv[ 0 ] );
+	fprintf( stderr, "[ -K command ] [ -j threads ] " );
+	fprintf( stderr, "[ -c checksum [ -H cache [ -N ] ] [ -O read ] ] " );
+	fprintf( stderr, "[ -o file [ -%% ] ] [ -S stats ] path\n" );
 	exit ( 2 );
     }
 
+    if ( cachefile != NULL ) {
+	cc_init( cachefile, algorithm, bypass );
+    }
+    if ( statsfile != NULL ) {
+	stats_init( statsfile );
+    }
+
     fsdiff( argv[ optind ], kfile, 0, finish, 0 );
+    stats_write( path_prefix, fs_threads );
 
     /* close the output file */     
     fclose( outtran );
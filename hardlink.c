@@ -14,158 +14,181 @@
 #include "applefile.h"
 #include "transcript.h"
 
-struct devlist {
-    struct devlist	*d_next;
-    dev_t		d_dev;
-    struct inolist	*d_ilist;
+/*
+ * Files seen with more than one link, by device and inode, so that later
+ * links to the same file are recorded as hardlinks to the first name
+ * seen.  Entries are found through an open hash of indexes into hl_ents,
+ * and names are kept end to end in hl_names.
+ */
+struct hl_entry {
+    dev_t		h_dev;
+    ino_t		h_ino;
+    size_t		h_name;		/* offset into hl_names */
+    int			h_flag;
 };
 
-struct inolist {
-    struct inolist	*i_next;
-    ino_t		i_ino;
-    char		*i_name;
-    int			i_flag;
-};
+static struct hl_entry	*hl_ents = NULL;
+static int		hl_count = 0;
+static int		hl_size = 0;
 
+/* open hash of indexes into hl_ents, -1 is empty */
+static int		*hl_index = NULL;
+static unsigned int	hl_mask = 0;
 
-static struct devlist	*dev_head = NULL;
+static char		*hl_names = NULL;
+static size_t		hl_nlen = 0;
+static size_t		hl_nsize = 0;
 
-static char		*i_insert( struct devlist *dev_head,
-				struct pathinfo *pinfo );
-static struct devlist	*d_insert( struct devlist **dev_head,
-				struct pathinfo *pinfo );
+static unsigned int	hl_hash( dev_t, ino_t );
+static int		*hl_slot( dev_t, ino_t );
+static void		hl_rehash( void );
 void			hardlink_free( void );
 
-    char *
-hardlink( struct pathinfo *pinfo )
+    static unsigned int
+hl_hash( dev_t dev, ino_t ino )
 {
-    struct devlist	*device;
+    unsigned long long	h;
 
-    device = d_insert( &dev_head, pinfo );
+    h = ((unsigned long long)dev * 0x9e3779b97f4a7c15ULL ) ^
+	    (unsigned long long)ino;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
 
-    return( i_insert( device, pinfo ));
+    return( (unsigned int)h );
 }
 
-    static struct devlist * 
-d_insert( struct devlist **dev_head, struct pathinfo *pinfo )
+    static int *
+hl_slot( dev_t dev, ino_t ino )
 {
-    struct devlist	*new, **cur;
+    unsigned int	i;
+    struct hl_entry	*he;
 
-    for ( cur = dev_head; *cur != NULL; cur = &(*cur)->d_next ) {
-	if ( pinfo->pi_stat.st_dev <= (*cur)->d_dev ) {
+    for ( i = hl_hash( dev, ino ) & hl_mask; hl_index[ i ] >= 0;
+	    i = ( i + 1 ) & hl_mask ) {
+	he = &hl_ents[ hl_index[ i ]];
+	if (( he->h_dev == dev ) && ( he->h_ino == ino )) {
 	    break;
 	}
     }
 
-    if (( (*cur) != NULL ) && ( pinfo->pi_stat.st_dev == (*cur)->d_dev )) {
-	return( *cur );
-    }
+    return( &hl_index[ i ] );
+}
 
-    if (( new = ( struct devlist * ) malloc( sizeof( struct devlist ))) 
-	    == NULL ) {
-	perror( "d_insert malloc" );
+    static void
+hl_rehash( void )
+{
+    unsigned int	size, i;
+    struct hl_entry	*he;
+
+    for ( size = 1024; size < (unsigned int)hl_size * 2; size <<= 1 )
+	;
+    free( hl_index );
+    if (( hl_index = (int *)malloc( size * sizeof( int ))) == NULL ) {
+	perror( "hl_rehash malloc" );
 	exit( 2 );
     }
+    memset( hl_index, 0xff, size * sizeof( int ));
+    hl_mask = size - 1;
 
-    new->d_dev = pinfo->pi_stat.st_dev; 
-    new->d_ilist = NULL;
-    new->d_next = *cur;
-    *cur = new;
-
-    return( *cur );
+    for ( i = 0; i < (unsigned int)hl_count; i++ ) {
+	he = &hl_ents[ i ];
+	*hl_slot( he->h_dev, he->h_ino ) = i;
+    }
 }
 
-    static char *
-i_insert( struct devlist *dev_head, struct pathinfo *pinfo )
+/*
+ * Return the name first seen for pinfo's file, or NULL if this is the
+ * first.  The name is good until the next call.
+ */
+    char *
+hardlink( struct pathinfo *pinfo )
 {
-    struct inolist	*new, **cur;
+    struct hl_entry	*he;
+    int			*slot;
+    size_t		len;
 
-    for ( cur = &dev_head->d_ilist; *cur != NULL; cur = &(*cur)->i_next ) {
-	if ( pinfo->pi_stat.st_ino <= (*cur)->i_ino ) {
-	    break;
-	}
+    if ( hl_index == NULL ) {
+	hl_rehash();
     }
-
-    if (( (*cur) != NULL ) && ( pinfo->pi_stat.st_ino == (*cur)->i_ino )) {
-	return( (*cur)->i_name );
+    if ( *( slot = hl_slot( pinfo->pi_stat.st_dev,
+	    pinfo->pi_stat.st_ino )) >= 0 ) {
+	return( hl_names + hl_ents[ *slot ].h_name );
     }
 
-    if (( new = ( struct inolist * ) malloc( sizeof( struct inolist ))) 
-	    == NULL ) {
-	perror( "i_insert malloc" );
-	exit( 2 );
+    if ( hl_count >= hl_size ) {
+	hl_size = ( hl_size == 0 ) ? 1024 : hl_size * 2;
+	if (( hl_ents = (struct hl_entry *)realloc( hl_ents,
+		hl_size * sizeof( struct hl_entry ))) == NULL ) {
+	    perror( "hardlink realloc" );
+	    exit( 2 );
+	}
+	hl_rehash();
+	slot = hl_slot( pinfo->pi_stat.st_dev, pinfo->pi_stat.st_ino );
     }
 
-    if (( new->i_name = ( char * ) malloc( strlen( pinfo->pi_name ) + 1 ))
-	    == NULL ) {
-	perror( "i_insert malloc" );
-	exit( 2 );
+    len = strlen( pinfo->pi_name ) + 1;
+    if ( hl_nlen + len > hl_nsize ) {
+	if ( hl_nsize == 0 ) {
+	    hl_nsize = 64 * 1024;
+	}
+	while ( hl_nlen + len > hl_nsize ) {
+	    hl_nsize *= 2;
+	}
+	if (( hl_names = (char *)realloc( hl_names, hl_nsize )) == NULL ) {
+	    perror( "hardlink realloc" );
+	    exit( 2 );
+	}
     }
 
-    strcpy( new->i_name, pinfo->pi_name );
-    new->i_ino = pinfo->pi_stat.st_ino;
-    new->i_flag = 0;
-
-    new->i_next = *cur;
-    *cur = new;
+    he = &hl_ents[ hl_count ];
+    he->h_dev = pinfo->pi_stat.st_dev;
+    he->h_ino = pinfo->pi_stat.st_ino;
+    he->h_name = hl_nlen;
+    he->h_flag = 0;
+    memcpy( hl_names + hl_nlen, pinfo->pi_name, len );
+    hl_nlen += len;
+    *slot = hl_count++;
 
     return( NULL );
-
 }
 
     void
 hardlink_free( )
 {
-    struct devlist	*dev_next;
-    struct inolist	*ino_head, *ino_next;
-
-    while ( dev_head != NULL ) {
-	dev_next = dev_head->d_next;
-	ino_head = dev_head->d_ilist;
-	while ( ino_head != NULL ) {
-	    ino_next = ino_head->i_next;
-	    free( ino_head->i_name);
-	    free( ino_head );
-	    ino_head = ino_next;
-	}
-	free( dev_head );
-	dev_head = dev_next;
-    }
+    free( hl_ents );
+    free( hl_index );
+    free( hl_names );
+    hl_ents = NULL;
+    hl_index = NULL;
+    hl_names = NULL;
+    hl_count = hl_size = 0;
+    hl_nlen = hl_nsize = 0;
+    hl_mask = 0;
 }
 
     int
 hardlink_changed( struct pathinfo *pinfo, int set )
 {
-    struct devlist	*dcur;
-    struct inolist	*icur;
-
-    for ( dcur = dev_head; dcur != NULL; dcur = dcur->d_next ) {
-	if ( pinfo->pi_stat.st_dev <= dcur->d_dev ) {
-	    break;
+    struct hl_entry	*he;
+    int			i;
+
+    if (( hl_index == NULL ) || (( i = *hl_slot( pinfo->pi_stat.st_dev,
+	    pinfo->pi_stat.st_ino )) < 0 )) {
+	for ( i = 0; i < hl_count; i++ ) {
+	    if ( hl_ents[ i ].h_dev == pinfo->pi_stat.st_dev ) {
+		break;
+	    }
 	}
-    }
-    
-    if (( dcur == NULL ) || ( pinfo->pi_stat.st_dev != dcur->d_dev )) {
-	fprintf( stderr, "hardlink_changed: %s: dev not found\n",
-		pinfo->pi_name );
-	exit( 2 );
-    }
-
-    for ( icur = dcur->d_ilist; icur != NULL; icur = icur->i_next ) {
-	if ( pinfo->pi_stat.st_ino <= icur->i_ino ) {
-	    break;
-	}
-    }
-
-    if (( icur == NULL ) || ( pinfo->pi_stat.st_ino != icur->i_ino )) {
-	fprintf( stderr, "hardlink_changed: %s: ino not found\n",
-		pinfo->pi_name );
+	fprintf( stderr, "hardlink_changed: %s: %s not found\n",
+		pinfo->pi_name, ( i < hl_count ) ? "ino" : "dev" );
 	exit( 2 );
     }
 
+    he = &hl_ents[ i ];
     if ( set ) {
-	icur->i_flag = 1;
+	he->h_flag = 1;
     }
 
-    return( icur->i_flag );
+    return( he->h_flag );
 }
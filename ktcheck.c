@@ -566,14 +566,14 @@ main( int argc, char **argv )
     char		*event = "ktcheck";	/* report event type */
 
     while (( c = getopt( argc, argv,
-	    "Cc:D:e:h:IiK:np:P:qrvVw:x:y:z:Z:" )) != EOF ) {
+	    "Cc:D:e:h:IiK:nO:p:P:qrvVw:x:y:z:Z:" )) != EOF ) {
 	switch( c ) {
 	case 'C':	/* clean up dir containing command.K */
 	    clean = 1;
 	    break;
 
 	case 'c':
-            OpenSSL_add_all_digests();
+            cksum_add_digests();
             md = EVP_get_digestbyname( optarg );
             if ( !md ) {
                 fprintf( stderr, "%s: unsupported checksum\n", optarg );
@@ -610,6 +610,13 @@ main( int argc, char **argv )
 	    update = 0;
 	    break;
 
+	case 'O':		/* how to read files to checksum */
+	    if ( cksum_options( optarg ) != 0 ) {
+		fprintf( stderr, "%s: bad read options\n", optarg );
+		exit( 2 );
+	    }
+	    break;
+
 	case 'p':
 	    /* connect.c handles things if atoi returns 0 */
 	    port = htons( atoi( optarg )); 
@@ -688,7 +695,7 @@ main( int argc, char **argv )
 	fprintf( stderr, "usage: %s ", argv[ 0 ] );
 	fprintf( stderr, "[ -CIinrV ] [ -q | -v ] " );
 	fprintf( stderr, "[ -c checksum ] [ -D radmind_path ] " );
-	fprintf( stderr, "[ -K command file ] " );
+	fprintf( stderr, "[ -K command file ] [ -O read ] " );
 	fprintf( stderr, "[ -h host ] [ -p port ] [ -P ca-pem-directory ] " );
 	fprintf( stderr, "[ -w auth-level ] [ -x ca-pem-file ] " );
 	fprintf( stderr, "[ -y cert-pem-file] [ -z key-pem-file ] " );
@@ -889,6 +896,16 @@ done:
 
     if ( change ) {
 	if ( update ) {
+	    /* fsdiff -E rebuilds the closure from what's been retrieved */
+	    if ( snprintf( path, MAXPATHLEN, "%s.closure", base_kfile )
+		    >= MAXPATHLEN ) {
+		fprintf( stderr, "%s.closure: path too long\n", base_kfile );
+		exit( 2 );
+	    }
+	    if (( unlink( path ) != 0 ) && ( errno != ENOENT )) {
+		perror( path );
+		exit( 2 );
+	    }
 	    if ( report ) {
 		if ( report_event( sn, event, "Updates retrieved" ) != 0 ) {
 		    fprintf( stderr, "warning: could not report event\n" );
@@ -290,7 +290,7 @@ main( int argc, char **argv )
 	    break;
 
 	case 'c':
-            OpenSSL_add_all_digests();
+            cksum_add_digests();
             md = EVP_get_digestbyname( optarg );
             if ( !md ) {
                 fprintf( stderr, "%s: unsupported checksum\n", optarg );
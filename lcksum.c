@@ -27,6 +27,7 @@
 #include "largefile.h"
 #include "progress.h"
 #include "root.h"
+#include "tindex.h"
 
 void            (*logger)( char * ) = NULL;
 
@@ -37,6 +38,7 @@ int		case_sensitive = 1;
 int		checkall = 0;
 int		checkapplefile = 0;
 int		updatetran = 1;
+int		writeindex = 0;
 char		*prefix = NULL;
 char		*radmind_path = _RADMIND_PATH;
 const EVP_MD	*md;
@@ -127,6 +129,174 @@ invalid_applefile:
     return( -1 );
 }
 
+/*
+ * do_lcksum() reads transcript lines through lc_getline(), which reads
+ * up to CKSUM_BATCH lines ahead, and opens and checksums the files
+ * they list all together with do_fcksum_batch().  That way the system
+ * can be reading many small files at once.  Lines are then checked one
+ * at a time as before, with each file's checksum from lc_file().
+ */
+struct lc_line {
+    char		ll_line[ MAXPATHLEN ];
+    char		ll_path[ 2 * MAXPATHLEN ];	/* "" if not a file */
+    int			ll_fd;
+    int			ll_fstat;	/* 1 if fstat() failed */
+    int			ll_errno;
+    struct stat		ll_st;
+    off_t		ll_size;
+    char		ll_cksum[ SZ_BASE64_E( EVP_MAX_MD_SIZE ) ];
+};
+
+static struct lc_line	lc_lines[ CKSUM_BATCH ];
+static int		lc_count = 0;
+static int		lc_next = 0;
+static ACAV		*lc_acav = NULL;
+
+/*
+ * Is line one whose file do_lcksum() will checksum?  If so, path is
+ * set to the file.  Lines it would complain about are left to it.
+ */
+    static int
+lc_path( char *line, char *file_root, char *tran_name, char *path )
+{
+    char		buf[ MAXPATHLEN ];
+    char		*d_path;
+    char		**av;
+    int			ac;
+
+    if (( *line == '\0' ) || ( line[ strlen( line ) - 1 ] != '\n' )) {
+	return( 0 );
+    }
+    strcpy( buf, line );
+    if ( lc_acav == NULL ) {
+	if (( lc_acav = acav_alloc()) == NULL ) {
+	    perror( "acav_alloc" );
+	    exit( 2 );
+	}
+    }
+    ac = acav_parse( lc_acav, buf, &av );
+    if (( ac != 8 ) || (( *av[ 0 ] != 'f' ) && ( *av[ 0 ] != 'a' ))) {
+	return( 0 );
+    }
+
+    if ((( d_path = decode( av[ 1 ] )) == NULL ) ||
+	    ( strlen( d_path ) >= MAXPATHLEN )) {
+	return( 0 );
+    }
+    if (( prefix != NULL ) &&
+	    ( strncmp( d_path, prefix, strlen( prefix )) != 0 )) {
+	return( 0 );
+    }
+    if ( snprintf( path, MAXPATHLEN, "%s/%s/%s", file_root, tran_name,
+	    d_path ) >= MAXPATHLEN ) {
+	return( 0 );
+    }
+    return( 1 );
+}
+
+/* open the file ll lists, so that it can be checksummed */
+    static int
+lc_open( struct lc_line *ll )
+{
+    ll->ll_fstat = 0;
+    ll->ll_errno = 0;
+    ll->ll_size = -1;
+    if (( ll->ll_fd = open( ll->ll_path, O_RDONLY, 0 )) < 0 ) {
+	ll->ll_errno = errno;
+	return( -1 );
+    }
+    if ( fstat( ll->ll_fd, &ll->ll_st ) != 0 ) {
+	ll->ll_fstat = 1;
+	ll->ll_errno = errno;
+	return( -1 );
+    }
+    return( 0 );
+}
+
+/* read the next batch of lines, and checksum their files */
+    static void
+lc_fill( FILE *f, char *file_root, char *tran_name )
+{
+    struct cksum_file	cf[ CKSUM_BATCH ];
+    struct lc_line	*ll;
+    int			which[ CKSUM_BATCH ];
+    int			i, n = 0;
+
+    lc_count = lc_next = 0;
+    while ( lc_count < CKSUM_BATCH ) {
+	ll = &lc_lines[ lc_count ];
+	if ( fgets( ll->ll_line, MAXPATHLEN, f ) == NULL ) {
+	    break;
+	}
+	lc_count++;
+
+	ll->ll_fd = -1;
+	if ( !lc_path( ll->ll_line, file_root, tran_name, ll->ll_path )) {
+	    *ll->ll_path = '\0';
+	    continue;
+	}
+	if ( lc_open( ll ) != 0 ) {
+	    continue;
+	}
+	cf[ n ].cf_fd = ll->ll_fd;
+	cf[ n ].cf_cksum_b64 = ll->ll_cksum;
+	which[ n++ ] = lc_count - 1;
+    }
+
+    do_fcksum_batch( cf, n );
+    for ( i = 0; i < n; i++ ) {
+	lc_lines[ which[ i ]].ll_size = cf[ i ].cf_size;
+	lc_lines[ which[ i ]].ll_errno = cf[ i ].cf_errno;
+    }
+}
+
+/* fgets() for do_lcksum(), reading ahead */
+    static char *
+lc_getline( FILE *f, char *file_root, char *tran_name, char *line )
+{
+    if ( lc_next == lc_count ) {
+	lc_fill( f, file_root, tran_name );
+	if ( lc_count == 0 ) {
+	    return( NULL );
+	}
+    }
+    strcpy( line, lc_lines[ lc_next++ ].ll_line );
+    return( line );
+}
+
+/*
+ * The file of the line lc_getline() last returned, path, opened and
+ * checksummed.  lc_path() should always have agreed it was a file, but
+ * if not, it's done now.
+ */
+    static struct lc_line *
+lc_file( char *path )
+{
+    struct lc_line	*ll = &lc_lines[ lc_next - 1 ];
+
+    if ( strcmp( ll->ll_path, path ) != 0 ) {
+	strcpy( ll->ll_path, path );
+	if ( lc_open( ll ) == 0 ) {
+	    if (( ll->ll_size = do_fcksum( ll->ll_fd, ll->ll_cksum )) < 0 ) {
+		ll->ll_errno = errno;
+	    }
+	}
+    }
+    return( ll );
+}
+
+/* close the files of lines read ahead but not yet checked */
+    static void
+lc_discard( void )
+{
+    for ( ; lc_next < lc_count; lc_next++ ) {
+	if ( lc_lines[ lc_next ].ll_fd >= 0 ) {
+	    (void)close( lc_lines[ lc_next ].ll_fd );
+	}
+    }
+    lc_count = lc_next = 0;
+}
+
     static void
 cleanup( int clean, char *path )
 {
@@ -164,6 +334,7 @@ do_lcksum( char *tpath )
     char		lcksum[ SZ_BASE64_E( EVP_MAX_MD_SIZE ) ];
     FILE		*f, *ufs = NULL;
     struct stat		st;
+    struct lc_line	*ll;
     off_t		cksumsize;
 
     if ( getcwd( cwd, MAXPATHLEN ) == NULL ) {
@@ -243,7 +414,7 @@ do_lcksum( char *tpath )
 
     memset( prepath, 0, sizeof( prepath ));
 
-    while ( fgets( tline, MAXPATHLEN, f ) != NULL ) {
+    while ( lc_getline( f, file_root, tran_name, tline ) != NULL ) {
 	linenum++;
 	updateline = 0;
 
@@ -360,25 +531,28 @@ do_lcksum( char *tpath )
 	 * do_acksum( ) creates a cksum for the associated applesingle file.
 	 */
 
-	/* open file here to save us some other open calls */
-	if (( fd = open( path, O_RDONLY, 0 )) < 0 ) {
+	/* opened and checksummed as it was read */
+	ll = lc_file( path );
+	if (( fd = ll->ll_fd ) < 0 ) {
 	    fprintf( stderr, "line %d: open %s: %s\n",
-			linenum, d_path, strerror( errno ));
+			linenum, d_path, strerror( ll->ll_errno ));
 	    goto badline;
 	}
 
 	/* check size */
-	if ( fstat( fd, &st) != 0 ) {
+	if ( ll->ll_fstat ) {
 	    fprintf( stderr, "line %d: fstat failed: %s\n",
-			linenum, strerror( errno ));
+			linenum, strerror( ll->ll_errno ));
 	    goto badline;
 	}
+	st = ll->ll_st;
 
-	if (( cksumsize = do_fcksum( fd, lcksum )) < 0 ) {
+	if (( cksumsize = ll->ll_size ) < 0 ) {
 	    fprintf( stderr, "line %d: %s: %s\n", linenum,
-			path, strerror( errno ));
+			path, strerror( ll->ll_errno ));
 	    goto badline;
 	}
+	strcpy( lcksum, ll->ll_cksum );
 
 	/* check size */
 	if ( cksumsize != strtoofft( targv[ 6 ], NULL, 10 )) {
@@ -472,6 +646,11 @@ done:
     }
 
     if ( updatetran ) {
+	if ( fclose( ufs ) != 0 ) {
+	    fprintf( stderr, "%s: fclose failed: %s\n", upath, strerror( errno ));
+	    cleanup( updatetran, upath );
+	    exit( 2 );
+	}
 	if ( ucount ) {
 	    if ( rename( upath, tpath ) != 0 ) {
 		fprintf( stderr, "rename %s to %s failed: %s\n", upath, tpath,
@@ -501,6 +680,7 @@ done:
     /* this restores -a functionality. can't wait to replace lcksum. */
 badline:
     exitval = 1;
+    lc_discard();
 
     if ( fclose( f ) != 0 ) {
 	fprintf( stderr, "%s: fclose failed: %s\n", path, strerror( errno ));
@@ -521,7 +701,7 @@ main( int argc, char **argv )
     extern int          optind;
     char		*tpath = NULL;
 
-    while (( c = getopt( argc, argv, "%Aac:D:iInP:qV" )) != EOF ) {
+    while (( c = getopt( argc, argv, "%Aac:D:iInO:P:qVx" )) != EOF ) {
 	switch( c ) {
 	case 'a':
 	    checkall = 1;
@@ -536,7 +716,7 @@ main( int argc, char **argv )
 	    break;
 
 	case 'c':
-	    OpenSSL_add_all_digests();
+	    cksum_add_digests();
 	    md = EVP_get_digestbyname( optarg );
 	    if ( !md ) {
 		fprintf( stderr, "%s: unsupported checksum\n", optarg );
@@ -557,6 +737,13 @@ main( int argc, char **argv )
 	    radmind_path = optarg;
 	    break;
 
+	case 'O':	/* how to read files to checksum */
+	    if ( cksum_options( optarg ) != 0 ) {
+		fprintf( stderr, "%s: bad read options\n", optarg );
+		exit( 2 );
+	    }
+	    break;
+
 	case 'P':
 	    prefix = optarg;
 	    break;
@@ -575,6 +762,10 @@ main( int argc, char **argv )
 	    printf( "%s\n", checksumlist );
 	    exit( 0 );
 
+	case 'x':
+	    writeindex = 1;
+	    break;
+
 	case '?':
 	    err++;
 	    break;
@@ -594,9 +785,10 @@ main( int argc, char **argv )
     }
 
     if ( err || (( argc - optind ) == 0 )) {
-	fprintf( stderr, "usage: %s [ -%%AiIqV ] ", argv[ 0 ] );
+	fprintf( stderr, "usage: %s [ -%%AiIqVx ] ", argv[ 0 ] );
 	fprintf( stderr, "[ -D path ] " );
 	fprintf( stderr, "[ -n [ -a ] ] " );
+	fprintf( stderr, "[ -O read ] " );
 	fprintf( stderr, "[ -P prefix ] " );
 	fprintf( stderr, "-c checksum transcript\n" );
 	exit( 2 );
@@ -620,6 +812,10 @@ main( int argc, char **argv )
 	default:
 	    break;
 	}
+
+	if ( writeindex && ( tindex_write( tpath ) != 0 )) {
+	    exit( 2 );
+	}
     }
 
     exit( err );
@@ -97,7 +97,7 @@ main( int argc, char **argv )
     char                *password = NULL;
 	char               **capa = NULL; /* capabilities */
 
-    while (( c = getopt( argc, argv, "%c:Fh:ilnNp:P:qrt:TU:vVw:x:y:z:Z:" ))
+    while (( c = getopt( argc, argv, "%c:Fh:ilnNO:p:P:qrt:TU:vVw:x:y:z:Z:" ))
 	    != EOF ) {
 	switch( c ) {
 	case '%':
@@ -105,7 +105,7 @@ main( int argc, char **argv )
 	    break;
 
         case 'c':
-            OpenSSL_add_all_digests();
+            cksum_add_digests();
             md = EVP_get_digestbyname( optarg );
             if ( !md ) {
                 fprintf( stderr, "%s: unsupported checksum\n", optarg );
@@ -138,6 +138,13 @@ main( int argc, char **argv )
 	    negative = 1;
 	    break;
 
+	case 'O':		/* how to read files to checksum */
+	    if ( cksum_options( optarg ) != 0 ) {
+		fprintf( stderr, "%s: bad read options\n", optarg );
+		exit( 2 );
+	    }
+	    break;
+
 	case 'p':
 	    /* connect.c handles things if atoi returns 0 */
             port = htons( atoi( optarg ));
@@ -233,7 +240,7 @@ main( int argc, char **argv )
 
     if ( err || ( argc - optind != 1 ))   {
 	fprintf( stderr, "usage: lcreate [ -%%FlnNrTV ] [ -q | -v | -i ] " );
-	fprintf( stderr, "[ -c checksum ] " );
+	fprintf( stderr, "[ -c checksum ] [ -O read ] " );
 	fprintf( stderr, "[ -h host ] [ -p port ] [ -P ca-pem-directory ] " );
 	fprintf( stderr, "[ -t stored-name ] [ -U user ] " );
         fprintf( stderr, "[ -w auth-level ] [ -x ca-pem-file ] " );
@@ -20,6 +20,7 @@
 #include "mkdirs.h"
 #include "pathcmp.h"
 #include "root.h"
+#include "tindex.h"
 
 int		cksum = 1;
 int		verbose = 0;
@@ -246,6 +247,7 @@ main( int argc, char **argv )
     int			c, i, j, cmpval, err = 0, tcount = 0, candidate = 0;
     int			force = 0, ofd, fileloc = 0, match = 0;
     int			merge_trans_only = 0;
+    int			writeindex = 0;
     int			copy = 0, rc;
     char		*file = NULL;
     char		npath[ 2 * MAXPATHLEN ];
@@ -263,7 +265,7 @@ main( int argc, char **argv )
     FILE		*ofs;
     mode_t		mask;
 
-    while ( ( c = getopt( argc, argv, "CD:fInTu:Vv" ) ) != EOF ) {
+    while ( ( c = getopt( argc, argv, "CD:fInTu:Vvx" ) ) != EOF ) {
 	switch( c ) {
 	case 'C':		/* copy files instead of using hardlinks */
 	    copy = 1;
@@ -298,6 +300,9 @@ main( int argc, char **argv )
 	case 'T':
 		merge_trans_only = 1;
 		break;
+	case 'x':
+	    writeindex = 1;
+	    break;
 	default:
 	    err++;
 	    break;
@@ -327,13 +332,13 @@ main( int argc, char **argv )
     }
 
     if ( err ) {
-	fprintf( stderr, "Usage: %s [-vCIVT] [ -D path ] [ -u umask ] ",
+	fprintf( stderr, "Usage: %s [-vCIVTx] [ -D path ] [ -u umask ] ",
 	    argv[ 0 ] );
 	fprintf( stderr, "transcript... dest\n" );
-	fprintf( stderr, "       %s -f [-vCIV] [ -D path ] [ -u umask ] ",
+	fprintf( stderr, "       %s -f [-vCIVx] [ -D path ] [ -u umask ] ",
 	    argv[ 0 ] );
 	fprintf( stderr, "transcript1 transcript2\n" );
-	fprintf( stderr, "       %s -n [-vCIVT] [ -D path ] [ -u umask ] ",
+	fprintf( stderr, "       %s -n [-vCIVTx] [ -D path ] [ -u umask ] ",
 	    argv[ 0 ] );
 	fprintf( stderr, "transcript1 transcript2 dest\n" );
 	exit( 2 );
@@ -699,6 +704,10 @@ skipline:
 	    }
 	}
     }
+    if ( fclose( ofs ) != 0 ) {
+	perror( opath );
+	exit( 2 );
+    }
 
     if ( force ) {
 	while ( dirlist != NULL ) {
@@ -765,6 +774,9 @@ skipline:
 	perror( npath );
 	exit( 2 );
     }
+    if ( writeindex && ( tindex_write( npath ) != 0 )) {
+	exit( 2 );
+    }
 
     exit( 0 );
 } 
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#include "config.h"
+
+#include <sys/param.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pathset.h"
+
+/*
+ * A set of paths, for the membership tests a struct list would answer
+ * with a walk of the whole list.  The paths are kept in an open hash,
+ * at most half full.
+ */
+
+    static unsigned int
+pathset_hash( char *path )
+{
+    unsigned long long	h = 0xcbf29ce484222325ULL;
+
+    for ( ; *path != '\0'; path++ ) {
+	h ^= (unsigned char)*path;
+	h *= 0x100000001b3ULL;
+    }
+
+    return( (unsigned int)( h ^ ( h >> 32 )));
+}
+
+    static char **
+pathset_slot( struct pathset *ps, char *path )
+{
+    unsigned int	i;
+
+    for ( i = pathset_hash( path ) & ps->ps_mask; ps->ps_paths[ i ] != NULL;
+	    i = ( i + 1 ) & ps->ps_mask ) {
+	if ( strcmp( ps->ps_paths[ i ], path ) == 0 ) {
+	    break;
+	}
+    }
+
+    return( &ps->ps_paths[ i ] );
+}
+
+    static int
+pathset_grow( struct pathset *ps )
+{
+    char		**old = ps->ps_paths;
+    unsigned int	i, size = ps->ps_mask + 1;
+
+    if (( ps->ps_paths = (char **)calloc( size * 2, sizeof( char * )))
+	    == NULL ) {
+	ps->ps_paths = old;
+	return( -1 );
+    }
+    ps->ps_mask = size * 2 - 1;
+
+    for ( i = 0; i < size; i++ ) {
+	if ( old[ i ] != NULL ) {
+	    *pathset_slot( ps, old[ i ] ) = old[ i ];
+	}
+    }
+    free( old );
+
+    return( 0 );
+}
+
+    struct pathset *
+pathset_new( void )
+{
+    struct pathset	*ps;
+
+    if (( ps = (struct pathset *)malloc( sizeof( struct pathset ))) == NULL ) {
+	return( NULL );
+    }
+    ps->ps_count = 0;
+    ps->ps_mask = 63;
+    if (( ps->ps_paths = (char **)calloc( ps->ps_mask + 1,
+	    sizeof( char * ))) == NULL ) {
+	free( ps );
+	return( NULL );
+    }
+
+    return( ps );
+}
+
+    void
+pathset_free( struct pathset *ps )
+{
+    unsigned int	i;
+
+    for ( i = 0; i <= ps->ps_mask; i++ ) {
+	free( ps->ps_paths[ i ] );
+    }
+    free( ps->ps_paths );
+    free( ps );
+}
+
+/*
+ * Add path to ps, if it isn't there already.  Like list_insert(), paths
+ * of MAXPATHLEN or more are refused.
+ */
+    int
+pathset_insert( struct pathset *ps, char *path )
+{
+    char		**slot;
+
+    if ( strlen( path ) >= MAXPATHLEN ) {
+	errno = ENAMETOOLONG;
+	return( -1 );
+    }
+    if ( *( slot = pathset_slot( ps, path )) != NULL ) {
+	return( 0 );
+    }
+
+    if ((unsigned int)( ps->ps_count + 1 ) * 2 > ps->ps_mask + 1 ) {
+	if ( pathset_grow( ps ) != 0 ) {
+	    return( -1 );
+	}
+	slot = pathset_slot( ps, path );
+    }
+    if (( *slot = strdup( path )) == NULL ) {
+	return( -1 );
+    }
+    ps->ps_count++;
+
+    return( 0 );
+}
+
+    int
+pathset_check( struct pathset *ps, char *path )
+{
+    if ( ps == NULL ) {
+	return( 0 );
+    }
+    return( *pathset_slot( ps, path ) != NULL );
+}
@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+struct pathset {
+    int			ps_count;
+    unsigned int	ps_mask;
+    char		**ps_paths;
+};
+
+struct pathset	*pathset_new( void );
+void		pathset_free( struct pathset *ps );
+int		pathset_insert( struct pathset *ps, char *path );
+int		pathset_check( struct pathset *ps, char *path );
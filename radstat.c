@@ -14,6 +14,7 @@
 #endif /* __APPLE__ */
 #include <sys/uio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -29,6 +30,17 @@
 
     int
 radstat( char *path, struct stat *st, char *type, struct applefileinfo *afinfo )
+{
+    return( radstatat( AT_FDCWD, path, st, type, afinfo ));
+}
+
+/*
+ * radstat() path relative to the open directory dfd, so a walk needn't
+ * have the whole path looked up again for every entry.
+ */
+    int
+radstatat( int dfd, char *path, struct stat *st, char *type,
+	struct applefileinfo *afinfo )
 {
 #ifdef __APPLE__
     static char			null_buf[ FINFOLEN ] = { 0 };
@@ -36,7 +48,7 @@ radstat( char *path, struct stat *st, char *type, struct applefileinfo *afinfo )
     extern struct attrlist 	getdiralist;
 #endif /* __APPLE__ */
 
-    if ( lstat( path, st ) != 0 ) {
+    if ( fstatat( dfd, path, st, AT_SYMLINK_NOFOLLOW ) != 0 ) {
 	if (( errno == ENOTDIR ) || ( errno == ENOENT )) {
 	    memset( st, 0, sizeof( struct stat ));
 	    *type = 'X';
@@ -49,7 +61,7 @@ radstat( char *path, struct stat *st, char *type, struct applefileinfo *afinfo )
 #ifdef __APPLE__
 	/* Check to see if it's an HFS+ file */
 	if ( afinfo != NULL ) {
-	    if (( getattrlist( path, &getalist, &afinfo->ai,
+	    if (( getattrlistat( dfd, path, &getalist, &afinfo->ai,
 		    sizeof( struct attr_info ), FSOPT_NOFOLLOW ) == 0 )) {
 		if (( afinfo->ai.ai_rsrc_len > 0 ) ||
 	( memcmp( afinfo->ai.ai_data, null_buf, FINFOLEN ) != 0 )) {
@@ -66,7 +78,7 @@ radstat( char *path, struct stat *st, char *type, struct applefileinfo *afinfo )
 #ifdef __APPLE__
 	/* Get any finder info */
 	if ( afinfo != NULL ) {
-	    getattrlist( path, &getdiralist, &afinfo->ai,
+	    getattrlistat( dfd, path, &getdiralist, &afinfo->ai,
 		sizeof( struct attr_info ), FSOPT_NOFOLLOW );
 	}
 #endif /* __APPLE__ */
@@ -5,3 +5,5 @@
 
 int radstat( char *path, struct stat *st, char *fstype,
     struct applefileinfo *afinfo );
+int radstatat( int dfd, char *path, struct stat *st, char *fstype,
+    struct applefileinfo *afinfo );
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+
+#include "base64.h"
+#include "statcache.h"
+
+/*
+ * A cache of the checksums radmind returns for STAT, so that thousands
+ * of clients asking after the same command files and transcripts don't
+ * each have them read and hashed again.  The cache is an anonymous
+ * shared mapping made by sc_init() before the daemon forks, and so is
+ * shared by every child.
+ *
+ * An entry is only used if the device, inode, size, mtime and ctime of
+ * the file all match.  Files changed at or after the time the caller
+ * started to stat them aren't stored, since they may change again within
+ * the same second.  Each (dev, ino) hashes to a set of SC_WAYS entries,
+ * and a new entry replaces the same file's, or else the one stored
+ * longest ago.
+ *
+ * Children update entries without a lock.  Each entry has a sequence
+ * number, odd while it's being written: a writer claims an entry by
+ * making the number odd with a compare and swap, and a reader copies the
+ * entry and uses it only if the number was even and unchanged across the
+ * copy.  A child that dies while writing leaves that entry unused until
+ * the daemon restarts.  Without atomic builtins, there is no cache.
+ */
+
+#ifndef MAP_ANON
+#define MAP_ANON	MAP_ANONYMOUS
+#endif /* MAP_ANON */
+
+#define SC_SEQ(se)	(*(volatile unsigned int *)&(se)->se_seq)
+
+struct sc_entry {
+    unsigned int	se_seq;
+    dev_t		se_dev;
+    ino_t		se_ino;
+    off_t		se_size;
+    time_t		se_mtime;
+    time_t		se_ctime;
+    time_t		se_stored;
+    char		se_cksum[ SZ_BASE64_E( EVP_MAX_MD_SIZE ) ];
+};
+
+static struct sc_entry	*sc_ents = NULL;
+
+#ifdef HAVE_SYNC_BUILTINS
+    static struct sc_entry *
+sc_set( dev_t dev, ino_t ino )
+{
+    unsigned long long	h;
+
+    h = ((unsigned long long)dev * 0x9e3779b97f4a7c15ULL ) ^
+	    (unsigned long long)ino;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+
+    return( &sc_ents[ ( h & ( SC_SETS - 1 )) * SC_WAYS ] );
+}
+#endif /* HAVE_SYNC_BUILTINS */
+
+    void
+sc_init( void )
+{
+#ifdef HAVE_SYNC_BUILTINS
+    void		*map;
+
+    if (( map = mmap( NULL, SC_SETS * SC_WAYS * sizeof( struct sc_entry ),
+	    PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0 ))
+	    == MAP_FAILED ) {
+	perror( "mmap" );
+	exit( 1 );
+    }
+    sc_ents = (struct sc_entry *)map;
+#endif /* HAVE_SYNC_BUILTINS */
+}
+
+/*
+ * If the cache has a checksum for the file described by st, copy it to
+ * cksum_b64 and return 1.
+ */
+    int
+sc_lookup( struct stat *st, char *cksum_b64 )
+{
+#ifdef HAVE_SYNC_BUILTINS
+    struct sc_entry	*set, e;
+    unsigned int	seq;
+    int			i;
+
+    if ( sc_ents == NULL ) {
+	return( 0 );
+    }
+
+    set = sc_set( st->st_dev, st->st_ino );
+    for ( i = 0; i < SC_WAYS; i++ ) {
+	if (( seq = SC_SEQ( &set[ i ] )) & 1 ) {
+	    continue;
+	}
+	__sync_synchronize();
+	memcpy( &e, &set[ i ], sizeof( struct sc_entry ));
+	__sync_synchronize();
+	if ( SC_SEQ( &set[ i ] ) != seq ) {
+	    continue;
+	}
+
+	if (( e.se_stored != 0 ) && ( e.se_dev == st->st_dev ) &&
+		( e.se_ino == st->st_ino ) && ( e.se_size == st->st_size ) &&
+		( e.se_mtime == st->st_mtime ) &&
+		( e.se_ctime == st->st_ctime )) {
+	    e.se_cksum[ sizeof( e.se_cksum ) - 1 ] = '\0';
+	    strcpy( cksum_b64, e.se_cksum );
+	    return( 1 );
+	}
+    }
+#endif /* HAVE_SYNC_BUILTINS */
+
+    return( 0 );
+}
+
+/*
+ * Store the checksum of the file described by st, which was stat'd no
+ * earlier than start.  If another child is writing the entry, give up.
+ */
+    void
+sc_store( struct stat *st, time_t start, char *cksum_b64 )
+{
+#ifdef HAVE_SYNC_BUILTINS
+    struct sc_entry	*set, *se = NULL;
+    unsigned int	seq;
+    int			i;
+
+    if ( sc_ents == NULL ) {
+	return;
+    }
+    if (( st->st_mtime >= start ) || ( st->st_ctime >= start ) ||
+	    ( strlen( cksum_b64 ) >= sizeof( se->se_cksum ))) {
+	return;
+    }
+
+    set = sc_set( st->st_dev, st->st_ino );
+    for ( i = 0; i < SC_WAYS; i++ ) {
+	if (( set[ i ].se_dev == st->st_dev ) &&
+		( set[ i ].se_ino == st->st_ino )) {
+	    se = &set[ i ];
+	    break;
+	}
+	if (( se == NULL ) || ( set[ i ].se_stored < se->se_stored )) {
+	    se = &set[ i ];
+	}
+    }
+
+    if ((( seq = SC_SEQ( se )) & 1 ) ||
+	    !__sync_bool_compare_and_swap( &se->se_seq, seq, seq + 1 )) {
+	return;
+    }
+    se->se_dev = st->st_dev;
+    se->se_ino = st->st_ino;
+    se->se_size = st->st_size;
+    se->se_mtime = st->st_mtime;
+    se->se_ctime = st->st_ctime;
+    se->se_stored = start;
+    strcpy( se->se_cksum, cksum_b64 );
+    __sync_fetch_and_add( &se->se_seq, 1 );
+#endif /* HAVE_SYNC_BUILTINS */
+}
@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+/* sets of entries in the shared STAT checksum cache, a power of two */
+#define SC_SETS		16384
+#define SC_WAYS		4
+
+void	sc_init( void );
+int	sc_lookup( struct stat *st, char *cksum_b64 );
+void	sc_store( struct stat *st, time_t start, char *cksum_b64 );
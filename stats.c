@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+#include "stats.h"
+
+/*
+ * Counters and per-phase times for fsdiff -S, written out as JSON when
+ * the run is over.  Each thread charges the time since it last changed
+ * phase to the phase it was in, so phase times are summed over threads
+ * and may add up to more than the wall time of the run.  Threads other
+ * than the main one start out idle, and idle time isn't charged to
+ * anything.  CPU time is per thread where the system can tell, and
+ * otherwise only the total is reported.
+ */
+
+/* not reported */
+#define SP_IDLE		SP_MAX
+
+struct stats_clock {
+    int			sk_phase;
+    struct timespec	sk_wall;
+    struct timespec	sk_cpu;
+};
+
+struct stats_dir {
+    char		*sd_path;
+    long long		sd_entries;
+    double		sd_wall;
+    double		sd_cpu;
+};
+
+static char *stats_names[ SP_MAX ] = {
+    "walk", "readdir", "stat", "hash", "parse", "exclude", "output",
+};
+
+static char *stats_cnames[ SC_MAX ] = {
+    "dirs_opened", "readdir_calls", "stat_calls", "entries",
+    "files_hashed", "bytes_hashed", "lines_parsed", "lines_skipped",
+    "exclude_matches", "lines_output",
+};
+
+int			stats = 0;
+static char		*stats_path;
+static long long	stats_counts[ SC_MAX ];
+static double		stats_wall[ SP_MAX + 1 ];
+static double		stats_cpu[ SP_MAX + 1 ];
+static struct timespec	stats_start;
+
+static struct stats_dir	*stats_dirs = NULL;
+static int		stats_ndirs = 0;
+static int		stats_dsize = 0;
+static struct timespec	stats_dwall;
+static double		stats_dcpu;
+static long long	stats_dentries;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t	stats_key;
+#else /* HAVE_PTHREAD */
+static struct stats_clock	stats_main;
+#endif /* HAVE_PTHREAD */
+
+static struct stats_clock *stats_clock( void );
+static void		stats_now( struct timespec *wall, struct timespec *cpu );
+static double		stats_diff( struct timespec *a, struct timespec *b );
+static double		stats_rusage( void );
+static void		stats_string( FILE *f, char *s );
+
+    static void
+stats_now( struct timespec *wall, struct timespec *cpu )
+{
+    clock_gettime( CLOCK_MONOTONIC, wall );
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, cpu );
+#else /* CLOCK_THREAD_CPUTIME_ID */
+    cpu->tv_sec = 0;
+    cpu->tv_nsec = 0;
+#endif /* CLOCK_THREAD_CPUTIME_ID */
+}
+
+    static double
+stats_diff( struct timespec *a, struct timespec *b )
+{
+    return(( b->tv_sec - a->tv_sec ) + ( b->tv_nsec - a->tv_nsec ) / 1e9 );
+}
+
+/* user and system time of the whole process */
+    static double
+stats_rusage( void )
+{
+    struct rusage	ru;
+
+    if ( getrusage( RUSAGE_SELF, &ru ) != 0 ) {
+	return( 0 );
+    }
+    return( ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6 );
+}
+
+/* this thread's clock, started idle the first time it's asked for */
+    static struct stats_clock *
+stats_clock( void )
+{
+    struct stats_clock	*sk;
+
+#ifdef HAVE_PTHREAD
+    if (( sk = pthread_getspecific( stats_key )) != NULL ) {
+	return( sk );
+    }
+    if (( sk = malloc( sizeof( struct stats_clock ))) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    if ( pthread_setspecific( stats_key, sk ) != 0 ) {
+	perror( "pthread_setspecific" );
+	exit( 2 );
+    }
+    sk->sk_phase = SP_IDLE;
+    stats_now( &sk->sk_wall, &sk->sk_cpu );
+#else /* HAVE_PTHREAD */
+    sk = &stats_main;
+#endif /* HAVE_PTHREAD */
+
+    return( sk );
+}
+
+    void
+stats_init( char *path )
+{
+    stats = 1;
+    stats_path = path;
+    clock_gettime( CLOCK_MONOTONIC, &stats_start );
+
+#ifdef HAVE_PTHREAD
+    if (( errno = pthread_key_create( &stats_key, free )) != 0 ) {
+	perror( "pthread_key_create" );
+	exit( 2 );
+    }
+#else /* HAVE_PTHREAD */
+    stats_now( &stats_main.sk_wall, &stats_main.sk_cpu );
+#endif /* HAVE_PTHREAD */
+
+    /* this is the main thread, which is walking */
+    stats_clock()->sk_phase = SP_WALK;
+}
+
+    void
+stats_count( int counter, long long n )
+{
+    if ( !stats ) {
+	return;
+    }
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+    stats_counts[ counter ] += n;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+}
+
+/*
+ * Charge this thread's time so far to the phase it's in, and move it to
+ * phase.  Returns the phase to give stats_leave() to move back.
+ */
+    int
+stats_enter( int phase )
+{
+    struct stats_clock	*sk;
+    struct timespec	wall, cpu;
+    int			prev;
+
+    if ( !stats ) {
+	return( SP_WALK );
+    }
+    sk = stats_clock();
+    stats_now( &wall, &cpu );
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+    stats_wall[ sk->sk_phase ] += stats_diff( &sk->sk_wall, &wall );
+    stats_cpu[ sk->sk_phase ] += stats_diff( &sk->sk_cpu, &cpu );
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+
+    prev = sk->sk_phase;
+    sk->sk_phase = phase;
+    sk->sk_wall = wall;
+    sk->sk_cpu = cpu;
+    return( prev );
+}
+
+    void
+stats_leave( int phase )
+{
+    (void)stats_enter( phase );
+}
+
+/* Start timing the walk of path, a directory at the top of the walk. */
+    void
+stats_dir_begin( char *path )
+{
+    struct stats_dir	*tmp;
+
+    if ( !stats ) {
+	return;
+    }
+    if ( stats_ndirs >= stats_dsize ) {
+	stats_dsize = ( stats_dsize == 0 ) ? 64 : stats_dsize * 2;
+	if (( tmp = realloc( stats_dirs,
+		stats_dsize * sizeof( struct stats_dir ))) == NULL ) {
+	    perror( "realloc" );
+	    exit( 2 );
+	}
+	stats_dirs = tmp;
+    }
+    if (( stats_dirs[ stats_ndirs ].sd_path = strdup( path )) == NULL ) {
+	perror( "strdup" );
+	exit( 2 );
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &stats_dwall );
+    stats_dcpu = stats_rusage();
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+    stats_dentries = stats_counts[ SC_ENTRIES ];
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+}
+
+    void
+stats_dir_end( void )
+{
+    struct stats_dir	*sd;
+    struct timespec	now;
+
+    if ( !stats ) {
+	return;
+    }
+    sd = &stats_dirs[ stats_ndirs++ ];
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    sd->sd_wall = stats_diff( &stats_dwall, &now );
+    sd->sd_cpu = stats_rusage() - stats_dcpu;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+    sd->sd_entries = stats_counts[ SC_ENTRIES ] - stats_dentries;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock( &stats_mutex );
+#endif /* HAVE_PTHREAD */
+}
+
+/* paths are written as they are, other than what JSON must escape */
+    static void
+stats_string( FILE *f, char *s )
+{
+    putc( '"', f );
+    for ( ; *s != '\0'; s++ ) {
+	if (( *s == '"' ) || ( *s == '\\' )) {
+	    fprintf( f, "\\%c", *s );
+	} else if ((unsigned char)*s < 0x20 ) {
+	    fprintf( f, "\\u%04x", (unsigned char)*s );
+	} else {
+	    putc( *s, f );
+	}
+    }
+    putc( '"', f );
+}
+
+/*
+ * Write what's been counted to the file given to stats_init().  path is
+ * where the walk started, and threads the number of threads walking.
+ * Call once the workers are done.
+ */
+    void
+stats_write( char *path, int threads )
+{
+    struct timespec	now;
+    FILE		*f;
+    int			i;
+
+    if ( !stats ) {
+	return;
+    }
+    (void)stats_enter( SP_WALK );
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    if (( f = fopen( stats_path, "w" )) == NULL ) {
+	perror( stats_path );
+	exit( 2 );
+    }
+    fprintf( f, "{\n  \"version\": 1,\n  \"path\": " );
+    stats_string( f, path );
+    fprintf( f, ",\n  \"threads\": %d,\n", threads );
+    fprintf( f, "  \"wall\": %.6f,\n  \"cpu\": %.6f,\n",
+	    stats_diff( &stats_start, &now ), stats_rusage());
+
+    fprintf( f, "  \"counters\": {" );
+    for ( i = 0; i < SC_MAX; i++ ) {
+	fprintf( f, "%s\n    \"%s\": %lld", ( i == 0 ) ? "" : ",",
+		stats_cnames[ i ], stats_counts[ i ] );
+    }
+    fprintf( f, "\n  },\n" );
+
+    fprintf( f, "  \"phases\": {" );
+    for ( i = 0; i < SP_MAX; i++ ) {
+	fprintf( f, "%s\n    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f }",
+		( i == 0 ) ? "" : ",", stats_names[ i ],
+		stats_wall[ i ], stats_cpu[ i ] );
+    }
+    fprintf( f, "\n  },\n" );
+
+    fprintf( f, "  \"dirs\": [" );
+    for ( i = 0; i < stats_ndirs; i++ ) {
+	fprintf( f, "%s\n    { \"path\": ", ( i == 0 ) ? "" : "," );
+	stats_string( f, stats_dirs[ i ].sd_path );
+	fprintf( f, ", \"entries\": %lld, \"wall\": %.6f, \"cpu\": %.6f }",
+		stats_dirs[ i ].sd_entries, stats_dirs[ i ].sd_wall,
+		stats_dirs[ i ].sd_cpu );
+    }
+    fprintf( f, "%s]\n}\n", ( stats_ndirs == 0 ) ? "" : "\n  " );
+
+    if ( fclose( f ) != 0 ) {
+	perror( stats_path );
+	exit( 2 );
+    }
+}
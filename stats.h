@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+/* phases that time is charged to */
+#define SP_WALK		0	/* anything not below */
+#define SP_READDIR	1
+#define SP_STAT		2
+#define SP_HASH		3
+#define SP_PARSE	4
+#define SP_EXCLUDE	5
+#define SP_OUTPUT	6
+#define SP_MAX		7
+
+/* counters */
+#define SC_OPENDIR	0
+#define SC_READDIR	1
+#define SC_STAT		2
+#define SC_ENTRIES	3
+#define SC_HASHED	4
+#define SC_HASHBYTES	5
+#define SC_PARSED	6
+#define SC_SKIPPED	7
+#define SC_EXCLUDED	8
+#define SC_OUTPUT	9
+#define SC_MAX		10
+
+extern int	stats;
+
+void	stats_init( char *path );
+void	stats_count( int counter, long long n );
+int	stats_enter( int phase );
+void	stats_leave( int phase );
+void	stats_dir_begin( char *path );
+void	stats_dir_end( void );
+void	stats_write( char *path, int threads );
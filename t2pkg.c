@@ -576,7 +576,7 @@ main( int ac, char *av[] )
 	    break;
 	    
 	case 'c':	/* cksum */
-	    OpenSSL_add_all_digests();
+	    cksum_add_digests();
 	    md = EVP_get_digestbyname( optarg );
 	    if ( !md ) {
 		fprintf( stderr, "%s: unsupported checksum\n", optarg );
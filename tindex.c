@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argcargv.h"
+#include "largefile.h"
+#include "tindex.h"
+
+/*
+ * An index of a transcript's lines, kept beside it in transcript.idx,
+ * so that a reader interested only in some subtree can start near it
+ * rather than at the top.  The index is text, one entry per line:
+ *
+ *	offset linenum path
+ *
+ * for the first line at or after every TI_INTERVAL bytes, with path as
+ * it appears in the transcript.  The first line names the format
+ * version and the size, mtime and a hash of the first TI_HEADLEN bytes
+ * of the transcript it was made from.  An index that doesn't match its
+ * transcript is ignored.
+ */
+
+#define TI_VERSION	1
+
+    unsigned int
+tindex_hash( char *head, size_t len )
+{
+    unsigned int	h = 2166136261U;
+
+    if ( len > TI_HEADLEN ) {
+	len = TI_HEADLEN;
+    }
+    for ( ; len > 0; len--, head++ ) {
+	h ^= (unsigned char)*head;
+	h *= 16777619U;
+    }
+
+    return( h );
+}
+
+    int
+tindex_write( char *tpath )
+{
+    FILE		*in, *out;
+    struct stat		st;
+    char		ipath[ MAXPATHLEN ], opath[ MAXPATHLEN ];
+    char		line[ MAXPATHLEN ];
+    char		head[ TI_HEADLEN ];
+    char		**argv;
+    int			ac, linenum;
+    size_t		len;
+    off_t		off, next;
+
+    if ( snprintf( ipath, MAXPATHLEN, "%s.idx", tpath ) >= MAXPATHLEN ) {
+	fprintf( stderr, "%s.idx: path too long\n", tpath );
+	return( -1 );
+    }
+    if ( snprintf( opath, MAXPATHLEN, "%s.%d", ipath, (int)getpid())
+	    >= MAXPATHLEN ) {
+	fprintf( stderr, "%s.%d: path too long\n", ipath, (int)getpid());
+	return( -1 );
+    }
+
+    if (( in = fopen( tpath, "r" )) == NULL ) {
+	perror( tpath );
+	return( -1 );
+    }
+    if ( fstat( fileno( in ), &st ) != 0 ) {
+	perror( tpath );
+	fclose( in );
+	return( -1 );
+    }
+    len = fread( head, 1, sizeof( head ), in );
+    if ( ferror( in ) || ( fseek( in, 0, SEEK_SET ) != 0 )) {
+	perror( tpath );
+	fclose( in );
+	return( -1 );
+    }
+
+    if (( out = fopen( opath, "w" )) == NULL ) {
+	perror( opath );
+	fclose( in );
+	return( -1 );
+    }
+    fprintf( out, "%d %" PRIofft "d %" PRItimet "d %08x\n", TI_VERSION,
+	    st.st_size, st.st_mtime, tindex_hash( head, len ));
+
+    next = TI_INTERVAL;
+    linenum = 0;
+    for ( off = 0; fgets( line, MAXPATHLEN, in ) != NULL; off += len ) {
+	linenum++;
+	len = strlen( line );
+	if ( line[ len - 1 ] != '\n' ) {
+	    fprintf( stderr, "%s: line %d: line too long\n", tpath, linenum );
+	    goto error;
+	}
+	if ( off < next ) {
+	    continue;
+	}
+
+	if ((( ac = argcargv( line, &argv )) == 0 ) || ( *argv[ 0 ] == '#' )) {
+	    continue;
+	}
+	if ( strcmp( argv[ 0 ], "-" ) == 0 ) {
+	    argv++;
+	    ac--;
+	}
+	if (( ac > 0 ) && ( strcmp( argv[ 0 ], "+" ) == 0 )) {
+	    argv++;
+	    ac--;
+	}
+	if ( ac < 2 ) {
+	    continue;
+	}
+	fprintf( out, "%" PRIofft "d %d %s\n", off, linenum, argv[ 1 ] );
+	next = off + TI_INTERVAL;
+    }
+    if ( ferror( in )) {
+	perror( tpath );
+	goto error;
+    }
+    fclose( in );
+    in = NULL;
+
+    if ( fclose( out ) != 0 ) {
+	perror( opath );
+	out = NULL;
+	goto error;
+    }
+    out = NULL;
+    if ( rename( opath, ipath ) != 0 ) {
+	fprintf( stderr, "rename %s to %s failed: %s\n", opath, ipath,
+		strerror( errno ));
+	goto error;
+    }
+    return( 0 );
+
+error:
+    if ( in != NULL ) {
+	fclose( in );
+    }
+    if ( out != NULL ) {
+	fclose( out );
+    }
+    unlink( opath );
+    return( -1 );
+}
+
+/*
+ * Read the index of tpath, whose first bytes are at head.  Returns NULL
+ * if there's no index, or it doesn't match st and head.
+ */
+    struct tindex *
+tindex_read( char *tpath, struct stat *st, char *head, int *count )
+{
+    FILE		*f;
+    struct tindex	*ti = NULL, *tmp;
+    char		ipath[ MAXPATHLEN ];
+    char		line[ MAXPATHLEN ];
+    char		**argv;
+    int			ac, size = 0;
+    off_t		off;
+
+    *count = 0;
+    if ( snprintf( ipath, MAXPATHLEN, "%s.idx", tpath ) >= MAXPATHLEN ) {
+	return( NULL );
+    }
+    if (( f = fopen( ipath, "r" )) == NULL ) {
+	return( NULL );
+    }
+
+    if (( fgets( line, MAXPATHLEN, f ) == NULL ) ||
+	    (( ac = argcargv( line, &argv )) != 4 ) ||
+	    ( atoi( argv[ 0 ] ) != TI_VERSION ) ||
+	    ( strtoofft( argv[ 1 ], NULL, 10 ) != st->st_size ) ||
+	    ( strtotimet( argv[ 2 ], NULL, 10 ) != st->st_mtime ) ||
+	    ( strtoul( argv[ 3 ], NULL, 16 ) != tindex_hash( head,
+	    ( st->st_size < TI_HEADLEN ) ? st->st_size : TI_HEADLEN ))) {
+	goto stale;
+    }
+
+    while ( fgets( line, MAXPATHLEN, f ) != NULL ) {
+	if (( ac = argcargv( line, &argv )) != 3 ) {
+	    goto stale;
+	}
+	off = strtoofft( argv[ 0 ], NULL, 10 );
+	if (( off >= st->st_size ) ||
+		(( *count > 0 ) && ( off <= ti[ *count - 1 ].ti_off ))) {
+	    goto stale;
+	}
+
+	if ( *count >= size ) {
+	    size = ( size == 0 ) ? 1024 : size * 2;
+	    if (( tmp = realloc( ti, size * sizeof( struct tindex ))) == NULL ) {
+		perror( "realloc" );
+		exit( 2 );
+	    }
+	    ti = tmp;
+	}
+	ti[ *count ].ti_off = off;
+	ti[ *count ].ti_linenum = atoi( argv[ 1 ] );
+	if (( ti[ *count ].ti_path = strdup( argv[ 2 ] )) == NULL ) {
+	    perror( "strdup" );
+	    exit( 2 );
+	}
+	(*count)++;
+    }
+    if ( ferror( f )) {
+	goto stale;
+    }
+    fclose( f );
+
+    if ( *count == 0 ) {
+	free( ti );
+	return( NULL );
+    }
+    return( ti );
+
+stale:
+    fclose( f );
+    tindex_free( ti, *count );
+    *count = 0;
+    return( NULL );
+}
+
+    void
+tindex_free( struct tindex *ti, int count )
+{
+    int			i;
+
+    for ( i = 0; i < count; i++ ) {
+	free( ti[ i ].ti_path );
+    }
+    free( ti );
+}
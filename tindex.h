@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+/* roughly how far apart indexed transcript lines are, in bytes */
+#define TI_INTERVAL	( 64 * 1024 )
+
+/* leading bytes of the transcript hashed into the index header */
+#define TI_HEADLEN	4096
+
+struct tindex {
+    off_t		ti_off;
+    int			ti_linenum;
+    char		*ti_path;
+};
+
+unsigned int	tindex_hash( char *head, size_t len );
+int		tindex_write( char *tpath );
+struct tindex	*tindex_read( char *tpath, struct stat *st, char *head,
+			int *count );
+void		tindex_free( struct tindex *ti, int count );
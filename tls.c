@@ -120,6 +120,11 @@ tls_server_setup( int use_randfile, int authlevel, char *caFile, char *caDir, ch
 	return( -1 );
     }
 
+#ifdef SSL_OP_ENABLE_KTLS
+    /* let the kernel encrypt, where it can, so RETR can use SSL_sendfile() */
+    SSL_CTX_set_options( ctx, SSL_OP_ENABLE_KTLS );
+#endif /* SSL_OP_ENABLE_KTLS */
+
     if ( authlevel >= 2 ) {
 	/* Set default CA location of not specified */
 	if ( caFile == NULL && caDir == NULL ) {
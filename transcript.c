@@ -7,6 +7,8 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef MAJOR_IN_SYSMACROS
 #include <sys/sysmacros.h>
@@ -16,9 +18,11 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -28,15 +32,28 @@
 #include "argcargv.h"
 #include "code.h"
 #include "cksum.h"
+#include "cksumcache.h"
 #include "pathcmp.h"
+#include "stats.h"
+#include "tindex.h"
 #include "largefile.h"
 #include "list.h"
 #include "wildcard.h"
+#include "workq.h"
 
 char * convert_path_type( char *path );
 int read_kfile( char *kfile, int location );
 static void t_remove( int type, char *shortname );
 static void t_display( void );
+static void t_output( struct pathinfo *, struct transcript *,
+	struct pathinfo *, int );
+static void t_parse( struct transcript *, char * );
+static void t_hashed( off_t );
+static int t_covered( char *, char * );
+static int t_less( struct transcript *, struct transcript * );
+static void t_heap_down( void );
+static void t_heap_push( struct transcript * );
+static void t_heap_init( void );
 
 struct transcript		*tran_head = NULL;
 static struct transcript	*prev_tran = NULL;
@@ -47,6 +64,15 @@ static char			*kdir;
 static struct list		*kfile_list;
 struct list			*special_list;
 struct list			*exclude_list;
+static struct wildset		*exclude_set = NULL;
+
+/*
+ * transcript_select()'s min-heap of the transcripts not at EOF, and the
+ * transcript returned when they all are.
+ */
+static struct transcript	**t_heap = NULL;
+static int			t_nheap = 0;
+static struct transcript	*t_last = NULL;
 
 char				*path_prefix = NULL;
 int				edit_path;
@@ -56,6 +82,47 @@ int				fs_minus;
 int				exclude_warnings = 0;
 FILE				*outtran;
 
+/*
+ * When fsdiff has worker threads, checksums are computed by the workers
+ * while the walk goes on.  Anything t_print() would have written after a
+ * pending checksum waits in this queue, so the output is in the same order
+ * as without threads.
+ *
+ * Files to checksum are gathered into batches, handed on CKSUM_BATCH at
+ * a time, or sooner when a line waiting on one is wanted, and hashed
+ * together by do_fcksum_batch().  Without threads a batch is hashed in
+ * place when it's handed on.
+ */
+#define TP_PRINT	0
+#define TP_COMPARE	1
+#define TP_WARN		2
+
+#define T_QUEUE		32	/* pending lines per worker thread */
+
+struct t_batch {
+    int			tb_count;
+    struct t_pending	*tb_tp[ CKSUM_BATCH ];
+};
+
+struct t_pending {
+    struct t_pending	*tp_next;
+    int			tp_kind;
+    int			tp_flag;
+    int			tp_busy;
+    int			tp_errno;
+    int			tp_nofs;
+    struct t_batch	*tp_batch;
+    struct transcript	*tp_tran;
+    struct pathinfo	*tp_cur;
+    struct pathinfo	tp_fs;
+    struct pathinfo	tp_tinfo;
+};
+
+static struct t_pending	*t_qhead = NULL;
+static struct t_pending	*t_qtail = NULL;
+static int		t_qlen = 0;
+static struct t_batch	*t_filling = NULL;
+
    char * 
 convert_path_type( char *path )
 {
@@ -105,31 +172,361 @@ convert_path_type( char *path )
     return( buf );
 }
 
+/*
+ * Transcripts are mapped whole, and each line is split into fields
+ * where it lies, without copying it or writing NULs into it.  Only the
+ * paths are copied out, and only those with escapes go through decode().
+ */
+#define T_MAXFIELDS	12
+
+/* closure lines may be longer, see t_closure_read() */
+#define T_CLOSURE_MAXLINE	( 3 * MAXPATHLEN )
+
+struct t_field {
+    char			*f_p;
+    int				f_len;
+};
+
+    static void
+t_map( struct transcript *tran, int fd )
+{
+    size_t			size;
+    ssize_t			rr;
+
+    if ( fstat( fd, &tran->t_st ) < 0 ) {
+	perror( tran->t_fullname );
+	exit( 2 );
+    }
+    if ( S_ISREG( tran->t_st.st_mode )) {
+	if ( tran->t_st.st_size == 0 ) {
+	    return;
+	}
+	if (( tran->t_map = mmap( NULL, tran->t_st.st_size, PROT_READ,
+		MAP_PRIVATE, fd, 0 )) != MAP_FAILED ) {
+	    tran->t_size = tran->t_st.st_size;
+	    tran->t_mapped = 1;
+#ifdef MADV_SEQUENTIAL
+	    madvise( tran->t_map, tran->t_size, MADV_SEQUENTIAL );
+#endif /* MADV_SEQUENTIAL */
+	    return;
+	}
+	tran->t_map = NULL;
+    }
+
+    /* can't be mapped, read it all in instead */
+    size = 0;
+    for ( ;; ) {
+	if ( tran->t_size == size ) {
+	    size += 64 * 1024;
+	    if (( tran->t_map = realloc( tran->t_map, size )) == NULL ) {
+		perror( "realloc" );
+		exit( 2 );
+	    }
+	}
+	if (( rr = read( fd, tran->t_map + tran->t_size,
+		size - tran->t_size )) < 0 ) {
+	    perror( tran->t_fullname );
+	    exit( 2 );
+	}
+	if ( rr == 0 ) {
+	    break;
+	}
+	tran->t_size += rr;
+    }
+}
+
+/*
+ * Point line at the next line of tran, and end at its newline.  A line
+ * without a newline in its first max bytes is too long.  For transcripts
+ * max is MAXPATHLEN - 1, as with fgets( line, MAXPATHLEN, ... ).
+ */
+    static int
+t_line( struct transcript *tran, char **line, char **end, size_t max )
+{
+    char			*nl;
+    size_t			len;
+
+    if ( tran->t_off >= tran->t_size ) {
+	return( 0 );
+    }
+    tran->t_linenum++;
+
+    *line = tran->t_map + tran->t_off;
+    if (( len = tran->t_size - tran->t_off ) > max ) {
+	len = max;
+    }
+    if (( nl = memchr( *line, '\n', len )) == NULL ) {
+	fprintf( stderr, "%s: line %d: line too long\n",
+		tran->t_fullname, tran->t_linenum );
+	exit( 2 );
+    }
+    *end = nl;
+    tran->t_off += nl - *line + 1;
+    return( 1 );
+}
+
+/*
+ * Split line into fields the way argcargv() would, returning the number
+ * of fields.  Only the first T_MAXFIELDS are kept, and any of those not
+ * on the line are left empty.
+ */
+    static int
+t_split( char *line, char *end, struct t_field *fv )
+{
+    char			*p;
+    int				ac, i;
+
+    for ( ac = 0; ; ac++ ) {
+	while (( line < end ) && (( *line == ' ' ) || ( *line == '\t' ))) {
+	    line++;
+	}
+	if ( line >= end ) {
+	    break;
+	}
+	for ( p = line; ( p < end ) && ( *p != ' ' ) && ( *p != '\t' ); p++ )
+	    ;
+	if ( ac < T_MAXFIELDS ) {
+	    fv[ ac ].f_p = line;
+	    fv[ ac ].f_len = p - line;
+	}
+	line = p;
+    }
+
+    for ( i = ac; i < T_MAXFIELDS; i++ ) {
+	fv[ i ].f_p = end;
+	fv[ i ].f_len = 0;
+    }
+    return( ac );
+}
+
+/*
+ * Copy the path in field f out, decoding it if it has any escapes.
+ */
+    static char *
+t_path( struct t_field *f )
+{
+    static char			buf[ MAXPATHLEN ];
+
+    if ( f->f_len >= MAXPATHLEN ) {
+	return( NULL );
+    }
+    memcpy( buf, f->f_p, f->f_len );
+    buf[ f->f_len ] = '\0';
+    if ( memchr( buf, '\\', f->f_len ) != NULL ) {
+	return( decode( buf ));
+    }
+    return( buf );
+}
+
+/*
+ * Fixed-base stand-ins for strtol( ..., 8 ) and atoi() / strtoll( ..., 10 )
+ * that stop at the end of the field.
+ */
+    static long
+t_octal( struct t_field *f )
+{
+    char			*p = f->f_p, *end = f->f_p + f->f_len;
+    unsigned long		n = 0;
+    int				neg = 0;
+
+    if (( p < end ) && (( *p == '-' ) || ( *p == '+' ))) {
+	neg = ( *p++ == '-' );
+    }
+    for ( ; ( p < end ) && ( *p >= '0' ) && ( *p <= '7' ); p++ ) {
+	n = ( n << 3 ) | ( *p - '0' );
+    }
+    return( neg ? -(long)n : (long)n );
+}
+
+    static long long
+t_decimal( struct t_field *f )
+{
+    char			*p = f->f_p, *end = f->f_p + f->f_len;
+    unsigned long long		n = 0;
+    int				neg = 0;
+
+    if (( p < end ) && (( *p == '-' ) || ( *p == '+' ))) {
+	neg = ( *p++ == '-' );
+    }
+    for ( ; ( p < end ) && ( *p >= '0' ) && ( *p <= '9' ); p++ ) {
+	n = n * 10 + ( *p - '0' );
+    }
+    return( neg ? -(long long)n : (long long)n );
+}
+
+/*
+ * Is the path on the transcript line in fv under dir?  Anything that
+ * doesn't parse isn't, so that t_parse() reports it.  The order of the
+ * paths passed over is still checked.
+ */
+    static int
+t_under( struct transcript *tran, int ac, struct t_field *fv, char *dir )
+{
+    char			*epath;
+
+    if (( ac > 0 ) && ( fv->f_len == 1 ) && ( *fv->f_p == '-' )) {
+	fv++;
+	ac--;
+    }
+    if (( ac > 0 ) && ( fv->f_len == 1 ) && ( *fv->f_p == '+' )) {
+	fv++;
+	ac--;
+    }
+    if (( ac < 2 ) || (( epath = t_path( &fv[ 1 ] )) == NULL ) ||
+	    (( epath = convert_path_type( epath )) == NULL )) {
+	return( 0 );
+    }
+    if ( !ischildcase( epath, dir, case_sensitive )) {
+	return( 0 );
+    }
+
+    if ( pathcasecmp( epath, tran->t_pinfo.pi_name, case_sensitive ) <= 0 ) {
+	fprintf( stderr, "%s: line %d: bad sort order\n",
+		tran->t_fullname, tran->t_linenum );
+	exit( 2 );
+    }
+    strcpy( tran->t_pinfo.pi_name, epath );
+    return( 1 );
+}
+
+/*
+ * If tran has an up to date index, start reading it at the last indexed
+ * line before path_prefix.  Everything above that line is outside of
+ * path_prefix, and would only be read to be passed over.
+ */
+    static void
+t_seek( struct transcript *tran )
+{
+    struct tindex		*ti, *e;
+    struct t_field		fields[ T_MAXFIELDS ];
+    struct t_field		*fv = fields;
+    char			*line, *end, *epath;
+    int				count, lo, hi, mid, ac;
+
+    if (( ti = tindex_read( tran->t_fullname, &tran->t_st, tran->t_map,
+	    &count )) == NULL ) {
+	return;
+    }
+
+    for ( lo = 0, hi = count; lo < hi; ) {
+	mid = ( lo + hi ) / 2;
+	epath = ti[ mid ].ti_path;
+	if (( strchr( epath, '\\' ) != NULL ) &&
+		(( epath = decode( epath )) == NULL )) {
+	    goto done;
+	}
+	if (( epath = convert_path_type( epath )) == NULL ) {
+	    goto done;
+	}
+	if ( pathcasecmp( epath, path_prefix, case_sensitive ) < 0 ) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    if ( lo == 0 ) {
+	goto done;
+    }
+    e = &ti[ lo - 1 ];
+
+    /* make sure the indexed line is where the index says it is */
+    if ( tran->t_map[ e->ti_off - 1 ] != '\n' ) {
+	goto done;
+    }
+    tran->t_off = e->ti_off;
+    tran->t_linenum = e->ti_linenum - 1;
+    if ( !t_line( tran, &line, &end, MAXPATHLEN - 1 )) {
+	goto reset;
+    }
+    ac = t_split( line, end, fv );
+    if (( ac > 0 ) && ( fv->f_len == 1 ) && ( *fv->f_p == '-' )) {
+	fv++;
+	ac--;
+    }
+    if (( ac > 0 ) && ( fv->f_len == 1 ) && ( *fv->f_p == '+' )) {
+	fv++;
+	ac--;
+    }
+    if (( ac < 2 ) || ( fv[ 1 ].f_len != (int)strlen( e->ti_path )) ||
+	    ( memcmp( fv[ 1 ].f_p, e->ti_path, fv[ 1 ].f_len ) != 0 )) {
+	goto reset;
+    }
+
+    tran->t_off = e->ti_off;
+    tran->t_linenum = e->ti_linenum - 1;
+    stats_count( SC_SKIPPED, tran->t_linenum );
+    goto done;
+
+reset:
+    tran->t_off = 0;
+    tran->t_linenum = 0;
+done:
+    tindex_free( ti, count );
+}
+
     void 
 transcript_parse( struct transcript *tran ) 
 {
-    char			line[ 2 * MAXPATHLEN ];
-    int				length;
+    /* a transcript read from a closure moves the closure along */
+    if ( tran->t_stream != NULL ) {
+	tran = tran->t_stream;
+    }
+    t_parse( tran, NULL );
+}
+
+/*
+ * Read the next line of tran, first passing over any lines for paths
+ * under the directory under, without looking at anything but the path.
+ */
+    static void 
+t_parse( struct transcript *tran, char *under ) 
+{
+    struct t_field		fields[ T_MAXFIELDS ];
+    struct t_field		*fv;
+    struct pathinfo		*pi = &tran->t_pinfo;
+    char			*line, *end;
     char			*epath;
-    char			**argv;
-    int				ac;
+    int				ac, n, phase, linenum;
+
+    phase = stats_enter( SP_PARSE );
+    linenum = tran->t_linenum;
 
     /* read in the next line in the transcript, loop through blanks and # */
-    do {
-	if (( fgets( line, MAXPATHLEN, tran->t_in )) == NULL ) {
+    for ( ;; ) {
+	if ( !t_line( tran, &line, &end, ( tran->t_sources != NULL ) ?
+		T_CLOSURE_MAXLINE : MAXPATHLEN - 1 )) {
 	    tran->t_eof = 1;
+	    stats_count( SC_SKIPPED, tran->t_linenum - linenum );
+	    stats_leave( phase );
 	    return;
 	}
-	tran->t_linenum++;
+	fv = fields;
+	if ((( ac = t_split( line, end, fv )) == 0 ) || ( *fv->f_p == '#' )) {
+	    continue;
+	}
 
-	/* check to see if line contains the whole line */
-	length = strlen( line );
-	if ( line[ length - 1 ] != '\n' ) {
-	    fprintf( stderr, "%s: line %d: line too long\n",
-		    tran->t_fullname, tran->t_linenum );
-	    exit( 2 );
-	} 
-    } while ((( ac = argcargv( line, &argv )) == 0 ) || ( *argv[ 0 ] == '#' ));
+	/* lines of a closure start with the number of their transcript */
+	if ( tran->t_sources != NULL ) {
+	    n = t_decimal( fv );
+	    if (( n < 0 ) || ( n >= tran->t_nsources ) ||
+		    ( tran->t_sources[ n ] == NULL )) {
+		fprintf( stderr, "%s: line %d: bad transcript number\n",
+			tran->t_fullname, tran->t_linenum );
+		exit( 2 );
+	    }
+	    tran->t_cur = tran->t_sources[ n ];
+	    tran->t_type = tran->t_cur->t_type;
+	    pi = &tran->t_cur->t_pinfo;
+	    fv++;
+	    ac--;
+	}
+
+	if (( under == NULL ) || !t_under( tran, ac, fv, under )) {
+	    break;
+	}
+    }
+    tran->t_line = line;
+    tran->t_linelen = end - line;
 
     if ( ac < 3 ) {
 	fprintf( stderr, "%s: line %d: minimum 3 arguments, got %d\n",
@@ -137,26 +534,26 @@ transcript_parse( struct transcript *tran )
 	exit( 2 );
     }
 
-    if ( strlen( argv[ 0 ] ) != 1 ) {
-	fprintf( stderr, "%s: line %d: %s is too long to be a type\n",
-		tran->t_fullname, tran->t_linenum, argv[ 0 ] );
+    if ( fv[ 0 ].f_len != 1 ) {
+	fprintf( stderr, "%s: line %d: %.*s is too long to be a type\n",
+		tran->t_fullname, tran->t_linenum, fv[ 0 ].f_len, fv[ 0 ].f_p );
 	exit( 2 );
     }
 
-    if ( argv[ 0 ][ 0 ] == '-' ) {
-	argv++;
+    if ( *fv[ 0 ].f_p == '-' ) {
+	fv++;
 	ac--;
-	tran->t_pinfo.pi_minus = 1;
+	pi->pi_minus = 1;
     } else {
-	tran->t_pinfo.pi_minus = 0;
+	pi->pi_minus = 0;
     }
-    if ( argv[ 0 ][ 0 ] == '+' ) {
-	argv++;
+    if ( *fv[ 0 ].f_p == '+' ) {
+	fv++;
 	ac--;
     }
 
-    tran->t_pinfo.pi_type = argv[ 0 ][ 0 ];
-    if (( epath = decode( argv[ 1 ] )) == NULL ) {
+    pi->pi_type = *fv[ 0 ].f_p;
+    if (( epath = t_path( &fv[ 1 ] )) == NULL ) {
 	fprintf( stderr, "%s: line %d: path too long\n",
 	    tran->t_fullname, tran->t_linenum );
 	exit( 2 );
@@ -176,9 +573,13 @@ transcript_parse( struct transcript *tran )
     }
 
     strcpy( tran->t_pinfo.pi_name, epath );
+    if ( pi != &tran->t_pinfo ) {
+	strcpy( pi->pi_name, epath );
+	tran->t_pinfo.pi_minus = pi->pi_minus;
+    }
 
     /* reading and parsing the line */
-    switch( *argv[ 0 ] ) {
+    switch( *fv[ 0 ].f_p ) {
     case 'd':				    /* dir */
 	if (( ac != 5 ) && ( ac != 6 )) {
 	    fprintf( stderr, "%s: line %d: expected 5 or 6 arguments, got %d\n",
@@ -186,14 +587,14 @@ transcript_parse( struct transcript *tran )
 	    exit( 2 );
 	}
 
-	tran->t_pinfo.pi_stat.st_mode = strtol( argv[ 2 ], NULL, 8 );
-	tran->t_pinfo.pi_stat.st_uid = atoi( argv[ 3 ] );
-	tran->t_pinfo.pi_stat.st_gid = atoi( argv[ 4 ] );
+	pi->pi_stat.st_mode = t_octal( &fv[ 2 ] );
+	pi->pi_stat.st_uid = t_decimal( &fv[ 3 ] );
+	pi->pi_stat.st_gid = t_decimal( &fv[ 4 ] );
 	if ( ac == 6 ) {
-	    base64_d( argv[ 5 ], strlen( argv[ 5 ] ),
-		    (unsigned char *)tran->t_pinfo.pi_afinfo.ai.ai_data );
+	    base64_d( fv[ 5 ].f_p, fv[ 5 ].f_len,
+		    (unsigned char *)pi->pi_afinfo.ai.ai_data );
 	} else {
-	    memset( tran->t_pinfo.pi_afinfo.ai.ai_data, 0, FINFOLEN );
+	    memset( pi->pi_afinfo.ai.ai_data, 0, FINFOLEN );
 	}
 	break;
 
@@ -205,9 +606,9 @@ transcript_parse( struct transcript *tran )
 		    tran->t_fullname, tran->t_linenum, ac );
 	    exit( 2 );
 	}
-	tran->t_pinfo.pi_stat.st_mode = strtol( argv[ 2 ], NULL, 8 );
-	tran->t_pinfo.pi_stat.st_uid = atoi( argv[ 3 ] );
-	tran->t_pinfo.pi_stat.st_gid = atoi( argv[ 4 ] );
+	pi->pi_stat.st_mode = t_octal( &fv[ 2 ] );
+	pi->pi_stat.st_uid = t_decimal( &fv[ 3 ] );
+	pi->pi_stat.st_gid = t_decimal( &fv[ 4 ] );
 	break;
 
     case 'b':				    /* block or char */
@@ -217,34 +618,34 @@ transcript_parse( struct transcript *tran )
 		    tran->t_fullname, tran->t_linenum, ac );
 	    exit( 2 );
 	}
-	tran->t_pinfo.pi_stat.st_mode = strtol( argv[ 2 ], NULL, 8 );
-	tran->t_pinfo.pi_stat.st_uid = atoi( argv[ 3 ] );
-	tran->t_pinfo.pi_stat.st_gid = atoi( argv[ 4 ] );
-	tran->t_pinfo.pi_stat.st_rdev =
-		makedev( ( unsigned )( atoi( argv[ 5 ] )), 
-		( unsigned )( atoi( argv[ 6 ] )));
+	pi->pi_stat.st_mode = t_octal( &fv[ 2 ] );
+	pi->pi_stat.st_uid = t_decimal( &fv[ 3 ] );
+	pi->pi_stat.st_gid = t_decimal( &fv[ 4 ] );
+	pi->pi_stat.st_rdev =
+		makedev( ( unsigned )( t_decimal( &fv[ 5 ] )), 
+		( unsigned )( t_decimal( &fv[ 6 ] )));
 	break;
 
     case 'l':				    /* link */
 	if ( ac == 3 ) {	/* link without owner, group, mode */
-	    tran->t_pinfo.pi_stat.st_mode = 0777;
-	    tran->t_pinfo.pi_stat.st_uid = 0;
-	    tran->t_pinfo.pi_stat.st_gid = 0;
+	    pi->pi_stat.st_mode = 0777;
+	    pi->pi_stat.st_uid = 0;
+	    pi->pi_stat.st_gid = 0;
 	} else if ( ac == 6 ) { /* link with owner, group, mode */
-	    tran->t_pinfo.pi_stat.st_mode = strtol( argv[ 2 ], NULL, 8 );
-	    tran->t_pinfo.pi_stat.st_uid = atoi( argv[ 3 ] );
-	    tran->t_pinfo.pi_stat.st_gid = atoi( argv[ 4 ] );
+	    pi->pi_stat.st_mode = t_octal( &fv[ 2 ] );
+	    pi->pi_stat.st_uid = t_decimal( &fv[ 3 ] );
+	    pi->pi_stat.st_gid = t_decimal( &fv[ 4 ] );
 	} else {
 	    fprintf( stderr, "%s: line %d: expected 3 or 6 arguments, got %d\n",
 		    tran->t_fullname, tran->t_linenum, ac );
 	    exit( 2 );
 	}
-	if (( epath = decode( argv[ ac - 1 ] )) == NULL ) {
+	if (( epath = t_path( &fv[ ac - 1 ] )) == NULL ) {
 	    fprintf( stderr, "%s: line %d: target path too long\n",
 		tran->t_fullname, tran->t_linenum );
 	    exit( 2 );
 	}
-	strcpy( tran->t_pinfo.pi_link, epath );
+	strcpy( pi->pi_link, epath );
 	break;
 
     case 'h':				    /* hard */
@@ -253,7 +654,7 @@ transcript_parse( struct transcript *tran )
 		    tran->t_fullname, tran->t_linenum, ac );
 	    exit( 2 );
 	}
-	if (( epath = decode( argv[ 2 ] )) == NULL ) {
+	if (( epath = t_path( &fv[ 2 ] )) == NULL ) {
 	    fprintf( stderr, "%s: line %d: target path too long\n",
 		tran->t_fullname, tran->t_linenum );
 	    exit( 2 );
@@ -263,7 +664,7 @@ transcript_parse( struct transcript *tran )
 		    tran->t_fullname, tran->t_linenum );
 	    exit( 2 );
 	}
-	strcpy( tran->t_pinfo.pi_link, epath );
+	strcpy( pi->pi_link, epath );
 	break;
 
     case 'a':				    /* hfs applefile */
@@ -273,166 +674,397 @@ transcript_parse( struct transcript *tran )
 		    tran->t_fullname, tran->t_linenum, ac );
 	    exit( 2 );
 	}
-	tran->t_pinfo.pi_stat.st_mode = strtol( argv[ 2 ], NULL, 8 );
-	tran->t_pinfo.pi_stat.st_uid = atoi( argv[ 3 ] );
-	tran->t_pinfo.pi_stat.st_gid = atoi( argv[ 4 ] );
-	tran->t_pinfo.pi_stat.st_mtime = strtotimet( argv[ 5 ], NULL, 10 );
-	tran->t_pinfo.pi_stat.st_size = strtoofft( argv[ 6 ], NULL, 10 );
+	pi->pi_stat.st_mode = t_octal( &fv[ 2 ] );
+	pi->pi_stat.st_uid = t_decimal( &fv[ 3 ] );
+	pi->pi_stat.st_gid = t_decimal( &fv[ 4 ] );
+	pi->pi_stat.st_mtime = t_decimal( &fv[ 5 ] );
+	pi->pi_stat.st_size = t_decimal( &fv[ 6 ] );
 	if ( tran->t_type != T_NEGATIVE ) {
-	    if (( cksum ) && ( strcmp( "-", argv [ 7 ] ) == 0  )) {
+	    if (( cksum ) && ( fv[ 7 ].f_len == 1 ) && ( *fv[ 7 ].f_p == '-' )) {
 		fprintf( stderr, "%s: line %d: no cksums in transcript\n",
 			tran->t_fullname, tran->t_linenum );
 		exit( 2 );
 	    }
 	}
-	strcpy( tran->t_pinfo.pi_cksum_b64, argv[ 7 ] );
+	if ( fv[ 7 ].f_len >= MAXPATHLEN ) {
+	    fprintf( stderr, "%s: line %d: checksum too long\n",
+		    tran->t_fullname, tran->t_linenum );
+	    exit( 2 );
+	}
+	memcpy( pi->pi_cksum_b64, fv[ 7 ].f_p, fv[ 7 ].f_len );
+	pi->pi_cksum_b64[ fv[ 7 ].f_len ] = '\0';
 	break;
 
     default:
 	fprintf( stderr,
 	    "%s: line %d: unknown file type '%c'\n",
-	    tran->t_fullname, tran->t_linenum, *argv[ 0 ] );
+	    tran->t_fullname, tran->t_linenum, *fv[ 0 ].f_p );
 	exit( 2 );
     }
 
+    stats_count( SC_PARSED, 1 );
+    stats_count( SC_SKIPPED, tran->t_linenum - linenum - 1 );
+    stats_leave( phase );
     return;
 }
 
+/*
+ * Transcript lines are formatted by hand into a private buffer, which is
+ * written out when it fills, at exit, and by t_flush().  Each line must
+ * come out exactly as the equivalent fprintf() would have written it.
+ * When outtran is a terminal, lines are written as they're finished.
+ */
+#define T_OBUFSIZE	( 64 * 1024 )
+
+/* the most a line can need: a transcript name and two encoded paths */
+#define T_OLINEMAX	( 6 * MAXPATHLEN + 256 )
+
+static char			t_obuf[ T_OBUFSIZE ];
+static size_t			t_olen = 0;
+static int			t_oline = -1;
+
     void
-t_print( struct pathinfo *fs, struct transcript *tran, int flag ) 
+t_flush( void )
 {
-    struct pathinfo	*cur;
-    char		*epath;
-    dev_t		dev;
-    int			print_minus = 0;
-
-#ifdef __APPLE__
-    static char         null_buf[ 32 ] = { 0 };
-#endif /* __APPLE__ */
+    if ( t_olen == 0 ) {
+	return;
+    }
+    fwrite( t_obuf, 1, t_olen, outtran );
+    t_olen = 0;
+    if ( t_oline > 0 ) {
+	fflush( outtran );
+    }
+}
 
-    if ( edit_path == APPLICABLE ) {
-	cur = &tran->t_pinfo;
-	if (( fs != NULL ) && ( fs->pi_type != 'd' ) &&
-		( fs->pi_type != 'h' ) && ( fs->pi_stat.st_nlink > 1 )) {
-	    hardlink_changed( fs, 1 );
-	}
-    } else {
-	cur = fs;	/* What if this is NULL? */
+/* return where the next line goes, with room for T_OLINEMAX bytes */
+    static char *
+t_obegin( void )
+{
+    if ( t_oline < 0 ) {
+	t_oline = isatty( fileno( outtran ));
+	atexit( t_flush );
     }
+    if ( t_olen > T_OBUFSIZE - T_OLINEMAX ) {
+	t_flush();
+    }
+    return( t_obuf + t_olen );
+}
 
-    /* Print name of transcript if it changed since the last t_print */
-    if (( edit_path == APPLICABLE )
-	    && (( flag == PR_TRAN_ONLY ) || ( flag == PR_DOWNLOAD )
-		|| ( flag == PR_STATUS_NEG ))
-	    && ( prev_tran != tran )) {
-	fprintf( outtran, "%s:\n", tran->t_shortname );
-	prev_tran = tran;
+    static void
+t_oend( char *p )
+{
+    t_olen = p - t_obuf;
+    if ( t_oline ) {
+	t_flush();
     }
+}
 
-    /*
-     * If a file is missing from the edit_path that was chosen, a - is 
-     * printed and then the file name that is missing is printed.
-     */
-    if ( edit_path == APPLICABLE ) {
-	if ( flag == PR_FS_ONLY ) {
-	    print_minus = 1;
-	    cur = fs;
-	} else if ( flag == PR_STATUS_MINUS ) {
-	    fprintf( outtran, "- " );
-	}
-    } else if (( edit_path ==  CREATABLE ) &&
-	    (( flag == PR_TRAN_ONLY ) || ( fs->pi_type == 'X' ))) {
-	print_minus = 1;
-	cur = &tran->t_pinfo;
-    } 
+/* as with "%*lld" */
+    static char *
+t_oint( char *p, long long v, int width )
+{
+    char		digits[ 24 ];
+    char		*d = digits + sizeof( digits );
+    unsigned long long	u;
+    int			len;
 
-    if ( print_minus ) {
-	/* set fs_minus so we can handle excluded files in dirs to be deleted */
-	fs_minus = 1;
-	fprintf( outtran, "- " );
+    u = ( v < 0 ) ? -(unsigned long long)v : (unsigned long long)v;
+    do {
+	*--d = '0' + ( u % 10 );
+	u /= 10;
+    } while ( u != 0 );
+    if ( v < 0 ) {
+	*--d = '-';
     }
 
-    if (( epath = encode( cur->pi_name )) == NULL ) {
-	fprintf( stderr, "Filename too long: %s\n", cur->pi_name );
-	exit( 2 );
+    len = digits + sizeof( digits ) - d;
+    for ( ; width > len; width-- ) {
+	*p++ = ' ';
     }
+    memcpy( p, d, len );
+    return( p + len );
+}
 
-    /* print out info to file based on type */
-    switch( cur->pi_type ) {
-    case 's':
-    case 'D':
-    case 'p':
-	fprintf( outtran, "%c %-37s\t%.4lo %5d %5d\n", cur->pi_type, epath, 
-		(unsigned long )( T_MODE & cur->pi_stat.st_mode ), 
-		(int)cur->pi_stat.st_uid, (int)cur->pi_stat.st_gid );
-	break;
+/* as with "%.4lo" */
+    static char *
+t_omode( char *p, unsigned long mode )
+{
+    char		digits[ 24 ];
+    char		*d = digits + sizeof( digits );
+    int			len;
 
-    case 'd':
-#ifdef __APPLE__
-	if ( memcmp( cur->pi_afinfo.ai.ai_data, null_buf,
-		sizeof( null_buf )) != 0 ) { 
-	    char	finfo_e[ SZ_BASE64_E( FINFOLEN ) ];
+    do {
+	*--d = '0' + ( mode & 07 );
+	mode >>= 3;
+    } while ( mode != 0 );
+    while ( d > digits + sizeof( digits ) - 4 ) {
+	*--d = '0';
+    }
 
-	    base64_e( (char *)cur->pi_afinfo.ai.ai_data, FINFOLEN, finfo_e );
-	    fprintf( outtran, "%c %-37s\t%.4lo %5d %5d %s\n", cur->pi_type,
-		    epath,
-		    (unsigned long)( T_MODE & cur->pi_stat.st_mode ), 
-		    (int)cur->pi_stat.st_uid, (int)cur->pi_stat.st_gid,
-		    finfo_e );
-	    break;
-	}
-#endif /* __APPLE__ */
-	fprintf( outtran, "%c %-37s\t%.4lo %5d %5d\n", cur->pi_type, epath, 
-		(unsigned long )( T_MODE & cur->pi_stat.st_mode ), 
-		(int)cur->pi_stat.st_uid, (int)cur->pi_stat.st_gid );
-	break;
+    len = digits + sizeof( digits ) - d;
+    memcpy( p, d, len );
+    return( p + len );
+}
 
-    case 'l':
-	fprintf( outtran, "%c %-37s\t%.4lo %5d %5d ", cur->pi_type, epath,
-		    (unsigned long)( T_MODE & cur->pi_stat.st_mode ),
-		    (int)cur->pi_stat.st_uid, (int)cur->pi_stat.st_gid );
-	if (( epath = encode( cur->pi_link )) == NULL ) {
-	    fprintf( stderr, "Filename too long: %s\n", cur->pi_link );
-	    exit( 2 );
-	}
-	fprintf( outtran, "%s\n", epath );
-	break;
+/*
+ * Encode path as with "%-*s" and encode().  Most paths have nothing to
+ * escape, and are copied as they are.
+ */
+    static char *
+t_opath( char *p, char *path, int width )
+{
+    char		*epath = path;
+    size_t		len;
 
-    case 'h':
-	fprintf( outtran, "%c %-37s\t", cur->pi_type, epath );
-	if (( epath = encode( cur->pi_link )) == NULL ) {
-	    fprintf( stderr, "Filename too long: %s\n", cur->pi_link );
+    len = strcspn( path, " \t\n\r\\" );
+    if (( path[ len ] != '\0' ) || ( len > MAXPATHLEN )) {
+	if (( epath = encode( path )) == NULL ) {
+	    fprintf( stderr, "Filename too long: %s\n", path );
 	    exit( 2 );
 	}
-	fprintf( outtran, "%s\n", epath );
-	break;
+	len = strlen( epath );
+    }
 
-    case 'a':		/* hfs applesingle file */
-    case 'f':
-	if (( edit_path == APPLICABLE ) && (( flag == PR_TRAN_ONLY ) || 
-		( flag == PR_DOWNLOAD ))) {
-	    fprintf( outtran, "+ " );
-	}
+    memcpy( p, epath, len );
+    p += len;
+    for ( ; width > (int)len; width-- ) {
+	*p++ = ' ';
+    }
+    return( p );
+}
 
-	/*
-	 * If we don't have a checksum yet, and checksums are on, calculate
-	 * it now.  Note that this can only be the case if "cur" is the
-	 * filesystem, because transcript_parse() won't read lines without
-	 * checksums if they are enabled.  But, don't get the checksum
-	 * if we are just going to remove the file.
-	 */
-	if (( *cur->pi_cksum_b64 == '-' ) && cksum && !print_minus ) {
-	    if ( cur->pi_type == 'f' ) {
-		if ( do_cksum( cur->pi_name, cur->pi_cksum_b64 ) < 0 ) {
-		    perror( cur->pi_name );
-		    exit( 2 );
-		}
-	    } else if ( cur->pi_type == 'a' ) {
-		if ( do_acksum( cur->pi_name, cur->pi_cksum_b64,
-			&cur->pi_afinfo ) < 0 ) {
-		    perror( cur->pi_name );
+    static char *
+t_ostr( char *p, char *s )
+{
+    size_t		len = strlen( s );
+
+    memcpy( p, s, len );
+    return( p + len );
+}
+
+/* type, path, mode, uid and gid, as every line but 'h' starts */
+    static char *
+t_ohead( char *p, struct pathinfo *cur )
+{
+    *p++ = cur->pi_type;
+    *p++ = ' ';
+    p = t_opath( p, cur->pi_name, 37 );
+    *p++ = '\t';
+    p = t_omode( p, (unsigned long)( T_MODE & cur->pi_stat.st_mode ));
+    *p++ = ' ';
+    p = t_oint( p, (int)cur->pi_stat.st_uid, 5 );
+    *p++ = ' ';
+    return( t_oint( p, (int)cur->pi_stat.st_gid, 5 ));
+}
+
+    static void
+t_owarn( char *path )
+{
+    char		*p;
+
+    if ( outtran != stdout ) {
+	printf( "#! Warning: excluding %s\n", path );
+	return;
+    }
+
+    /* in line with the transcript it's part of */
+    if ( strlen( path ) > MAXPATHLEN ) {
+	t_flush();
+	printf( "#! Warning: excluding %s\n", path );
+	return;
+    }
+    p = t_obegin();
+    p = t_ostr( p, "#! Warning: excluding " );
+    p = t_ostr( p, path );
+    *p++ = '\n';
+    t_oend( p );
+}
+
+/*
+ * Work out which side of a difference t_print() reports.  Sets
+ * *print_minus if the line is a removal.
+ */
+    static struct pathinfo *
+t_current( struct pathinfo *fs, struct pathinfo *tinfo, int flag,
+	int *print_minus )
+{
+    struct pathinfo	*cur;
+
+    *print_minus = 0;
+    if ( edit_path == APPLICABLE ) {
+	cur = tinfo;
+	if ( flag == PR_FS_ONLY ) {
+	    *print_minus = 1;
+	    cur = fs;
+	}
+    } else {
+	cur = fs;	/* What if this is NULL? */
+	if (( flag == PR_TRAN_ONLY ) || ( fs->pi_type == 'X' )) {
+	    *print_minus = 1;
+	    cur = tinfo;
+	}
+    } 
+
+    return( cur );
+}
+
+/*
+ * The parts of t_print() that later comparisons and the walk depend on.
+ * These happen as soon as a difference is found, even if the line itself
+ * is waiting in the output queue.
+ */
+    static void
+t_effects( struct pathinfo *fs, int flag )
+{
+    int			print_minus;
+
+    if ( edit_path == APPLICABLE ) {
+	if (( fs != NULL ) && ( fs->pi_type != 'd' ) &&
+		( fs->pi_type != 'h' ) && ( fs->pi_stat.st_nlink > 1 )) {
+	    hardlink_changed( fs, 1 );
+	}
+    }
+
+    (void)t_current( fs, NULL, flag, &print_minus );
+    if ( print_minus ) {
+	/* set fs_minus so we can handle excluded files in dirs to be deleted */
+	fs_minus = 1;
+    }
+}
+
+    void
+t_print( struct pathinfo *fs, struct transcript *tran, int flag ) 
+{
+    t_effects( fs, flag );
+    t_output( fs, tran, &tran->t_pinfo, flag );
+}
+
+    static void
+t_output( struct pathinfo *fs, struct transcript *tran, struct pathinfo *tinfo,
+	int flag ) 
+{
+    struct pathinfo	*cur;
+    char		*p;
+    dev_t		dev;
+    off_t		rc;
+    int			print_minus, phase, hash;
+
+#ifdef __APPLE__
+    static char         null_buf[ 32 ] = { 0 };
+#endif /* __APPLE__ */
+
+    phase = stats_enter( SP_OUTPUT );
+    cur = t_current( fs, tinfo, flag, &print_minus );
+    p = t_obegin();
+
+    /* Print name of transcript if it changed since the last t_print */
+    if (( edit_path == APPLICABLE )
+	    && (( flag == PR_TRAN_ONLY ) || ( flag == PR_DOWNLOAD )
+		|| ( flag == PR_STATUS_NEG ))
+	    && ( prev_tran != tran )) {
+	p = t_ostr( p, tran->t_shortname );
+	*p++ = ':';
+	*p++ = '\n';
+	prev_tran = tran;
+    }
+
+    /*
+     * If a file is missing from the edit_path that was chosen, a - is 
+     * printed and then the file name that is missing is printed.
+     */
+    if (( edit_path == APPLICABLE ) && ( flag == PR_STATUS_MINUS )) {
+	*p++ = '-';
+	*p++ = ' ';
+    }
+
+    if ( print_minus ) {
+	*p++ = '-';
+	*p++ = ' ';
+    }
+
+    /* print out info to file based on type */
+    switch( cur->pi_type ) {
+    case 's':
+    case 'D':
+    case 'p':
+	p = t_ohead( p, cur );
+	*p++ = '\n';
+	break;
+
+    case 'd':
+	p = t_ohead( p, cur );
+#ifdef __APPLE__
+	if ( memcmp( cur->pi_afinfo.ai.ai_data, null_buf,
+		sizeof( null_buf )) != 0 ) { 
+	    char	finfo_e[ SZ_BASE64_E( FINFOLEN ) ];
+
+	    base64_e( (char *)cur->pi_afinfo.ai.ai_data, FINFOLEN, finfo_e );
+	    *p++ = ' ';
+	    p = t_ostr( p, finfo_e );
+	}
+#endif /* __APPLE__ */
+	*p++ = '\n';
+	break;
+
+    case 'l':
+	p = t_ohead( p, cur );
+	*p++ = ' ';
+	p = t_opath( p, cur->pi_link, 0 );
+	*p++ = '\n';
+	break;
+
+    case 'h':
+	*p++ = cur->pi_type;
+	*p++ = ' ';
+	p = t_opath( p, cur->pi_name, 37 );
+	*p++ = '\t';
+	p = t_opath( p, cur->pi_link, 0 );
+	*p++ = '\n';
+	break;
+
+    case 'a':		/* hfs applesingle file */
+    case 'f':
+	if (( edit_path == APPLICABLE ) && (( flag == PR_TRAN_ONLY ) || 
+		( flag == PR_DOWNLOAD ))) {
+	    *p++ = '+';
+	    *p++ = ' ';
+	}
+
+	/*
+	 * If we don't have a checksum yet, and checksums are on, calculate
+	 * it now.  Note that this can only be the case if "cur" is the
+	 * filesystem, because transcript_parse() won't read lines without
+	 * checksums if they are enabled.  But, don't get the checksum
+	 * if we are just going to remove the file.
+	 */
+	if (( *cur->pi_cksum_b64 == '-' ) && cksum && !print_minus ) {
+	    if ( cur->pi_type == 'f' ) {
+		if (( cur == fs ) && cc_lookup( &cur->pi_stat,
+			cur->pi_cksum_b64 )) {
+		    /* unchanged since the last run */
+		} else {
+		    hash = stats_enter( SP_HASH );
+		    rc = do_cksum( cur->pi_name, cur->pi_cksum_b64 );
+		    stats_leave( hash );
+		    if ( rc < 0 ) {
+			perror( cur->pi_name );
+			exit( 2 );
+		    }
+		    t_hashed( rc );
+		    if ( cur == fs ) {
+			cc_store( &cur->pi_stat, cur->pi_cksum_b64 );
+		    }
+		}
+	    } else if ( cur->pi_type == 'a' ) {
+		hash = stats_enter( SP_HASH );
+		rc = do_acksum( cur->pi_name, cur->pi_cksum_b64,
+			&cur->pi_afinfo );
+		stats_leave( hash );
+		if ( rc < 0 ) {
+		    perror( cur->pi_name );
 		    exit( 2 );
 		}
+		t_hashed( rc );
 	    }
 	}
 
@@ -441,24 +1073,26 @@ t_print( struct pathinfo *fs, struct transcript *tran, int flag )
 	 * but the corresponding transcript is negative, hence, retain
 	 * the file system's mtime.  Woof!
 	 */
-	fprintf( outtran, "%c %-37s\t%.4lo %5d %5d %9" PRItimet "d "
-			  "%7" PRIofft "d %s\n",
-		cur->pi_type, epath,
-		(unsigned long)( T_MODE & cur->pi_stat.st_mode ), 
-		(int)cur->pi_stat.st_uid, (int)cur->pi_stat.st_gid,
-		( flag == PR_STATUS_NEG ) ?
-			fs->pi_stat.st_mtime : cur->pi_stat.st_mtime,
-		cur->pi_stat.st_size, cur->pi_cksum_b64 );
+	p = t_ohead( p, cur );
+	*p++ = ' ';
+	p = t_oint( p, ( flag == PR_STATUS_NEG ) ?
+		fs->pi_stat.st_mtime : cur->pi_stat.st_mtime, 9 );
+	*p++ = ' ';
+	p = t_oint( p, cur->pi_stat.st_size, 7 );
+	*p++ = ' ';
+	p = t_ostr( p, cur->pi_cksum_b64 );
+	*p++ = '\n';
 	break;
 
     case 'c':
     case 'b':
 	dev = cur->pi_stat.st_rdev;
-	fprintf( outtran, "%c %-37s\t%.4lo %5d %5d %5d %5d\n",
-		cur->pi_type, epath,
-		(unsigned long )( T_MODE & cur->pi_stat.st_mode ), 
-		(int)cur->pi_stat.st_uid, (int)cur->pi_stat.st_gid,
-		(int)major(dev), (int)minor(dev) );
+	p = t_ohead( p, cur );
+	*p++ = ' ';
+	p = t_oint( p, (int)major(dev), 5 );
+	*p++ = ' ';
+	p = t_oint( p, (int)minor(dev), 5 );
+	*p++ = '\n';
 	break;
 
     case 'X' :
@@ -469,12 +1103,364 @@ t_print( struct pathinfo *fs, struct transcript *tran, int flag )
 	fprintf( stderr, "%s: Unknown type: %c\n", cur->pi_name, cur->pi_type );
 	exit( 2 );
     } 
+    t_oend( p );
+    stats_count( SC_OUTPUT, 1 );
+    stats_leave( phase );
+}
+
+/* count a file checksummed for -S, rc being what do_cksum() returned */
+    static void
+t_hashed( off_t rc )
+{
+    if ( rc >= 0 ) {
+	stats_count( SC_HASHED, 1 );
+	stats_count( SC_HASHBYTES, rc );
+    }
+}
+
+/*
+ * Does cur need a checksum before it can be printed?
+ */
+    static int
+t_needsum( struct pathinfo *cur, int print_minus )
+{
+    return ( cksum && !print_minus && ( *cur->pi_cksum_b64 == '-' ) &&
+	    (( cur->pi_type == 'f' ) || ( cur->pi_type == 'a' )));
+}
+
+/*
+ * Decide how a file or applefile differs from its transcript line, once
+ * fs has its checksum.  Returns the t_print() flag, or 0 if they match.
+ */
+    static int
+t_file_flag( struct pathinfo *fs, struct pathinfo *tinfo, int type )
+{
+    if ( type != T_NEGATIVE ) {
+	if ( fs->pi_stat.st_size != tinfo->pi_stat.st_size ) {
+	    return( PR_DOWNLOAD );
+	}
+	if ( cksum ) {
+	    if ( strcmp( fs->pi_cksum_b64, tinfo->pi_cksum_b64 ) != 0 ) {
+		return( PR_DOWNLOAD );
+	    }
+	} else if ( fs->pi_stat.st_mtime != tinfo->pi_stat.st_mtime ) {
+	    return( PR_DOWNLOAD );
+	}
+
+	if ( fs->pi_stat.st_mtime != tinfo->pi_stat.st_mtime ) {
+	    return( PR_STATUS );
+	}
+    }
+
+    if (( fs->pi_stat.st_uid != tinfo->pi_stat.st_uid ) || 
+	    ( fs->pi_stat.st_gid != tinfo->pi_stat.st_gid ) ||
+	    (( T_MODE & fs->pi_stat.st_mode ) !=
+	    ( T_MODE & tinfo->pi_stat.st_mode ))) {
+	if (( type == T_NEGATIVE ) && ( edit_path == APPLICABLE )) {
+	    return( PR_STATUS_NEG );
+	}
+	return( PR_STATUS );
+    }
+
+    return( 0 );
+}
+
+    static void
+t_hash( void *arg )
+{
+    struct t_batch	*tb = arg;
+    struct pathinfo	*cur;
+    struct cksum_file	cf[ CKSUM_BATCH ];
+    int			err[ CKSUM_BATCH ], which[ CKSUM_BATCH ];
+    int			i, n = 0, phase;
+    off_t		rc;
+
+    phase = stats_enter( SP_HASH );
+    for ( i = 0; i < tb->tb_count; i++ ) {
+	cur = tb->tb_tp[ i ]->tp_cur;
+	err[ i ] = 0;
+	if ( cur->pi_type != 'f' ) {
+	    if (( rc = do_acksum( cur->pi_name, cur->pi_cksum_b64,
+		    &cur->pi_afinfo )) < 0 ) {
+		err[ i ] = errno;
+	    }
+	    t_hashed( rc );
+	    continue;
+	}
+	if (( cf[ n ].cf_fd = open( cur->pi_name, O_RDONLY, 0 )) < 0 ) {
+	    err[ i ] = errno;
+	    continue;
+	}
+	cf[ n ].cf_cksum_b64 = cur->pi_cksum_b64;
+	which[ n++ ] = i;
+    }
+
+    do_fcksum_batch( cf, n );
+    for ( i = 0; i < n; i++ ) {
+	if ( cf[ i ].cf_size < 0 ) {
+	    err[ which[ i ]] = cf[ i ].cf_errno;
+	}
+	if (( close( cf[ i ].cf_fd ) != 0 ) && ( err[ which[ i ]] == 0 )) {
+	    err[ which[ i ]] = errno;
+	}
+	t_hashed( cf[ i ].cf_size );
+    }
+    stats_leave( phase );
+
+    wq_lock();
+    for ( i = 0; i < tb->tb_count; i++ ) {
+	tb->tb_tp[ i ]->tp_errno = err[ i ];
+	tb->tb_tp[ i ]->tp_busy = 0;
+    }
+    wq_unlock();
+    free( tb );
+}
+
+/*
+ * Hand the batch being filled to a worker.
+ */
+    static void
+t_submit( void )
+{
+    struct t_batch	*tb;
+
+    if (( tb = t_filling ) == NULL ) {
+	return;
+    }
+    t_filling = NULL;
+    wq_push( t_hash, tb, WQ_TAIL );
+}
+
+/* how many lines may wait before t_drain() waits on the first */
+    static int
+t_qmax( void )
+{
+    return( T_QUEUE * (( wq_threads() > 0 ) ? wq_threads() : 1 ));
+}
+
+/*
+ * Write out queued lines in order.  With wait, block until the queue is
+ * empty, otherwise stop at the first line still waiting for a checksum,
+ * unless the queue is over its limit.
+ */
+    static void
+t_drain( int wait )
+{
+    struct t_pending	*tp;
+    int			busy, flag;
+
+    while (( tp = t_qhead ) != NULL ) {
+	/* only this thread fills batches, so there's no need to lock */
+	if (( tp->tp_batch == t_filling ) && ( wait || ( t_qlen > t_qmax()))) {
+	    t_submit();
+	}
+	wq_lock();
+	if (( busy = tp->tp_busy ) && ( wait || ( t_qlen > t_qmax()))) {
+	    wq_promote( tp->tp_batch );
+	    while ( tp->tp_busy ) {
+		wq_wait();
+	    }
+	    busy = 0;
+	}
+	wq_unlock();
+	if ( busy ) {
+	    return;
+	}
+
+	if (( t_qhead = tp->tp_next ) == NULL ) {
+	    t_qtail = NULL;
+	}
+	t_qlen--;
+
+	if ( tp->tp_errno != 0 ) {
+	    errno = tp->tp_errno;
+	    perror( tp->tp_cur->pi_name );
+	    exit( 2 );
+	}
+	if (( tp->tp_cur == &tp->tp_fs ) && ( tp->tp_fs.pi_type == 'f' )) {
+	    cc_store( &tp->tp_fs.pi_stat, tp->tp_fs.pi_cksum_b64 );
+	}
+
+	switch ( tp->tp_kind ) {
+	case TP_PRINT:
+	    t_output( tp->tp_nofs ? NULL : &tp->tp_fs, tp->tp_tran,
+		    &tp->tp_tinfo, tp->tp_flag );
+	    break;
+
+	case TP_COMPARE:
+	    if (( flag = t_file_flag( &tp->tp_fs, &tp->tp_tinfo,
+		    tp->tp_tran->t_type )) != 0 ) {
+		t_effects( &tp->tp_fs, flag );
+		t_output( &tp->tp_fs, tp->tp_tran, &tp->tp_tinfo, flag );
+	    }
+	    break;
+
+	case TP_WARN:
+	    t_owarn( tp->tp_fs.pi_name );
+	    break;
+	}
+
+	free( tp );
+    }
+}
+
+/* one of a pathinfo's strings, which may not have been set */
+    static void
+t_strcopy( char *dst, const char *src )
+{
+    const char		*end;
+    size_t		len = MAXPATHLEN - 1;
+
+    if (( end = memchr( src, '\0', MAXPATHLEN )) != NULL ) {
+	len = end - src;
+    }
+    memcpy( dst, src, len );
+    dst[ len ] = '\0';
+}
+
+/*
+ * Copy a pathinfo for the queue.  Its strings are MAXPATHLEN each, and
+ * copying only what's in them keeps queueing a line cheap.
+ */
+    static void
+t_pinfo_copy( struct pathinfo *dst, struct pathinfo *src )
+{
+    dst->pi_type = src->pi_type;
+    dst->pi_minus = src->pi_minus;
+    t_strcopy( dst->pi_name, src->pi_name );
+    t_strcopy( dst->pi_link, src->pi_link );
+    dst->pi_stat = src->pi_stat;
+    t_strcopy( dst->pi_cksum_b64, src->pi_cksum_b64 );
+    dst->pi_afinfo = src->pi_afinfo;
+}
+
+    static struct t_pending *
+t_queue( int kind, struct pathinfo *fs, struct transcript *tran, int flag )
+{
+    struct t_pending	*tp;
+
+    if (( tp = (struct t_pending *)malloc( sizeof( struct t_pending )))
+	    == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    tp->tp_next = NULL;
+    tp->tp_kind = kind;
+    tp->tp_flag = flag;
+    tp->tp_busy = 0;
+    tp->tp_errno = 0;
+    tp->tp_batch = NULL;
+    tp->tp_tran = tran;
+    tp->tp_cur = NULL;
+    if (( tp->tp_nofs = ( fs == NULL )) == 0 ) {
+	t_pinfo_copy( &tp->tp_fs, fs );
+    }
+    if ( tran != NULL ) {
+	t_pinfo_copy( &tp->tp_tinfo, &tran->t_pinfo );
+    }
+
+    if ( t_qtail == NULL ) {
+	t_qhead = tp;
+    } else {
+	t_qtail->tp_next = tp;
+    }
+    t_qtail = tp;
+    t_qlen++;
+
+    return( tp );
+}
+
+/*
+ * Checksum tp->tp_cur, on a worker if there are any, once its batch is
+ * handed on.
+ */
+    static void
+t_queue_hash( struct t_pending *tp )
+{
+    if ( t_filling == NULL ) {
+	if (( t_filling = (struct t_batch *)malloc( sizeof( struct t_batch )))
+		== NULL ) {
+	    perror( "malloc" );
+	    exit( 2 );
+	}
+	t_filling->tb_count = 0;
+    }
+    tp->tp_busy = 1;
+    tp->tp_batch = t_filling;
+    t_filling->tb_tp[ t_filling->tb_count++ ] = tp;
+    if ( t_filling->tb_count == CKSUM_BATCH ) {
+	t_submit();
+    }
+}
+
+/*
+ * t_print(), or queue the line behind pending checksums.
+ */
+    static void
+t_emit( struct pathinfo *fs, struct transcript *tran, int flag )
+{
+    struct t_pending	*tp;
+    struct pathinfo	*cur;
+    int			print_minus;
+
+    cur = t_current( fs, &tran->t_pinfo, flag, &print_minus );
+    if ( t_needsum( cur, print_minus ) && ( cur == fs ) &&
+	    ( cur->pi_type == 'f' )) {
+	(void)cc_lookup( &cur->pi_stat, cur->pi_cksum_b64 );
+    }
+    if (( t_qhead == NULL ) && !t_needsum( cur, print_minus )) {
+	t_print( fs, tran, flag );
+	return;
+    }
+
+    tp = t_queue( TP_PRINT, fs, tran, flag );
+    if ( t_needsum( cur, print_minus )) {
+	tp->tp_cur = ( cur == fs ) ? &tp->tp_fs : &tp->tp_tinfo;
+	t_queue_hash( tp );
+    }
+    t_effects( fs, flag );
+    t_drain( 0 );
+}
+
+/*
+ * Compare a file whose size matches its transcript line by checksum.
+ * Unless the checksum cache has it, the rest of the comparison happens
+ * in t_drain().
+ */
+    static void
+t_cksum_compare( struct pathinfo *fs, struct transcript *tran )
+{
+    struct t_pending	*tp;
+    int			flag;
+
+    if (( fs->pi_type == 'f' ) &&
+	    cc_lookup( &fs->pi_stat, fs->pi_cksum_b64 )) {
+	if (( flag = t_file_flag( fs, &tran->t_pinfo, tran->t_type )) != 0 ) {
+	    t_emit( fs, tran, flag );
+	}
+	return;
+    }
+
+    tp = t_queue( TP_COMPARE, fs, tran, 0 );
+    tp->tp_cur = &tp->tp_fs;
+    t_queue_hash( tp );
+
+    /*
+     * If this turns out to differ, t_print() records the change in the
+     * hardlink table, and later links to it need to see that.
+     */
+    if (( edit_path == APPLICABLE ) && ( fs->pi_stat.st_nlink > 1 )) {
+	t_drain( 1 );
+    } else {
+	t_drain( 0 );
+    }
 }
 
    static int 
 t_compare( struct pathinfo *fs, struct transcript *tran )
 {
     int			cmp;
+    int			flag;
     mode_t		mode;
     mode_t		tran_mode;
     dev_t		dev;
@@ -504,13 +1490,13 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 
     if ( cmp > 0 ) {
 	/* name is in the tran, but not the fs */
-	t_print( fs, tran, PR_TRAN_ONLY ); 
+	t_emit( fs, tran, PR_TRAN_ONLY ); 
 	return T_MOVE_TRAN;
     } 
 
     if ( cmp < 0 ) {
 	/* name is not in the tran */
-	t_print( fs, tran, PR_FS_ONLY );
+	t_emit( fs, tran, PR_FS_ONLY );
 	return T_MOVE_FS;
     } 
 
@@ -520,7 +1506,7 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 
     /* the names match so check types */
     if ( fs->pi_type != tran->t_pinfo.pi_type ) {
-	t_print( fs, tran, PR_DOWNLOAD );
+	t_emit( fs, tran, PR_DOWNLOAD );
 	return T_MOVE_BOTH;
     }
 
@@ -528,47 +1514,12 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
     switch( fs->pi_type ) {
     case 'a':			    /* hfs applefile */
     case 'f':			    /* file */
-	if ( tran->t_type != T_NEGATIVE ) {
-	    if ( fs->pi_stat.st_size != tran->t_pinfo.pi_stat.st_size ) {
-		t_print( fs, tran, PR_DOWNLOAD );
-		break;
-	    }
-	    if ( cksum ) {
-		if ( fs->pi_type == 'f' ) {
-		    if ( do_cksum( fs->pi_name, fs->pi_cksum_b64 ) < 0 ) {
-			perror( fs->pi_name );
-			exit( 2 );
-		    }
-		} else if ( fs->pi_type == 'a' ) {
-		    if ( do_acksum( fs->pi_name, fs->pi_cksum_b64,
-			    &fs->pi_afinfo ) < 0 ) {
-			perror( fs->pi_name );
-			exit( 2 );
-		    }
-		}
-		if ( strcmp( fs->pi_cksum_b64, tran->t_pinfo.pi_cksum_b64 ) != 0 ) {
-		    t_print( fs, tran, PR_DOWNLOAD );
-		    break;
-		}
-	    } else if ( fs->pi_stat.st_mtime != tran->t_pinfo.pi_stat.st_mtime ) {
-		t_print( fs, tran, PR_DOWNLOAD );
-		break;
-	    }
-
-	    if ( fs->pi_stat.st_mtime != tran->t_pinfo.pi_stat.st_mtime ) {
-		t_print( fs, tran, PR_STATUS );
-		break;
-	    }
-	}
-
-	if (( fs->pi_stat.st_uid != tran->t_pinfo.pi_stat.st_uid ) || 
-		( fs->pi_stat.st_gid != tran->t_pinfo.pi_stat.st_gid ) ||
-		( mode != tran_mode )) {
-	    if (( tran->t_type == T_NEGATIVE ) && ( edit_path == APPLICABLE )) {
-		t_print( fs, tran, PR_STATUS_NEG );
-	    } else {
-		t_print( fs, tran, PR_STATUS );
-	    }
+	if (( tran->t_type != T_NEGATIVE ) && cksum &&
+		( fs->pi_stat.st_size == tran->t_pinfo.pi_stat.st_size )) {
+	    t_cksum_compare( fs, tran );
+	} else if (( flag = t_file_flag( fs, &tran->t_pinfo,
+		tran->t_type )) != 0 ) {
+	    t_emit( fs, tran, flag );
 	}
 	break;
 
@@ -580,7 +1531,7 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 		    ( memcmp( fs->pi_afinfo.ai.ai_data,
 		    tran->t_pinfo.pi_afinfo.ai.ai_data, FINFOLEN ) != 0 ) ||
 		    ( mode != tran_mode )) {
-		t_print( fs, tran, PR_STATUS );
+		t_emit( fs, tran, PR_STATUS );
 	    }
 	    break;
 	}
@@ -588,7 +1539,7 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 	if (( fs->pi_stat.st_uid != tran->t_pinfo.pi_stat.st_uid ) ||
 		( fs->pi_stat.st_gid != tran->t_pinfo.pi_stat.st_gid ) ||
 		( mode != tran_mode )) {
-	    t_print( fs, tran, PR_STATUS );
+	    t_emit( fs, tran, PR_STATUS );
 	}
 	break;
 
@@ -598,7 +1549,7 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 	if (( fs->pi_stat.st_uid != tran->t_pinfo.pi_stat.st_uid ) ||
 		( fs->pi_stat.st_gid != tran->t_pinfo.pi_stat.st_gid ) ||
 		( mode != tran_mode )) {
-	    t_print( fs, tran, PR_STATUS );
+	    t_emit( fs, tran, PR_STATUS );
 	}
 	break;
 
@@ -613,7 +1564,7 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 		 || ( mode != tran_mode )
 #endif /* HAVE_LCHMOD */
 	    /* strcmp */ ) {
-		t_print( fs, tran, PR_STATUS );
+		t_emit( fs, tran, PR_STATUS );
 	    }
 	}
 	break;
@@ -621,7 +1572,7 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
     case 'h':			    /* hard */
 	if (( strcmp( fs->pi_link, tran->t_pinfo.pi_link ) != 0 ) ||
 		( hardlink_changed( fs, 0 ) != 0 )) {
-	    t_print( fs, tran, PR_STATUS );
+	    t_emit( fs, tran, PR_STATUS );
 	}
 	break;
 
@@ -637,120 +1588,311 @@ t_compare( struct pathinfo *fs, struct transcript *tran )
 		    ( fs->pi_stat.st_gid != tran->t_pinfo.pi_stat.st_gid ) || 
 		    ( dev != tran->t_pinfo.pi_stat.st_rdev ) ||
 		    ( mode != tran_mode )) {
-		t_print( fs, tran, PR_STATUS );
+		t_emit( fs, tran, PR_STATUS );
 	    }
 	} else if ( dev != tran->t_pinfo.pi_stat.st_rdev ) {
-	    t_print( fs, tran, PR_STATUS );
+	    t_emit( fs, tran, PR_STATUS );
+	}	
+	break;
+
+    case 'b':
+	dev = fs->pi_stat.st_rdev;
+	if (( fs->pi_stat.st_uid != tran->t_pinfo.pi_stat.st_uid ) ||
+		( fs->pi_stat.st_gid != tran->t_pinfo.pi_stat.st_gid ) || 
+		( dev != tran->t_pinfo.pi_stat.st_rdev ) ||
+		( mode != tran_mode )) {
+	    t_emit( fs, tran, PR_STATUS );
 	}	
 	break;
 
-    case 'b':
-	dev = fs->pi_stat.st_rdev;
-	if (( fs->pi_stat.st_uid != tran->t_pinfo.pi_stat.st_uid ) ||
-		( fs->pi_stat.st_gid != tran->t_pinfo.pi_stat.st_gid ) || 
-		( dev != tran->t_pinfo.pi_stat.st_rdev ) ||
-		( mode != tran_mode )) {
-	    t_print( fs, tran, PR_STATUS );
-	}	
-	break;
+    default:
+	fprintf( stderr, "%s: Unknown type: %c\n", fs->pi_name, fs->pi_type );
+	break;
+    }
+
+    return T_MOVE_BOTH;
+}
+
+    static void
+t_warn( char *path )
+{
+    struct t_pending	*tp;
+
+    if ( t_qhead == NULL ) {
+	t_owarn( path );
+	return;
+    }
+
+    tp = t_queue( TP_WARN, NULL, NULL, 0 );
+    strcpy( tp->tp_fs.pi_name, path );
+}
+
+    int
+t_exclude( char *path )
+{
+    int			rc, phase;
+
+    if ( exclude_set == NULL ) {
+	return( 0 );
+    }
+    phase = stats_enter( SP_EXCLUDE );
+    if (( rc = wildset_match( exclude_set, path )) != 0 ) {
+	stats_count( SC_EXCLUDED, 1 );
+    }
+    stats_leave( phase );
+    return( rc );
+}
+
+/*
+ * Is path excluded?  If so, and its parent isn't being removed,
+ * transcript() skips it without looking at anything but its name, so
+ * the walk needn't stat it.  Special files still have highest
+ * precedence.  Safe to call from worker threads.
+ */
+    int
+transcript_skip( char *path )
+{
+    if ( !t_exclude( path )) {
+	return( 0 );
+    }
+    return(( list_size( special_list ) <= 0 ) ||
+	    ( list_check( special_list, path ) == 0 ));
+}
+
+/*
+ * If everything under some directory at or above path is excluded, copy
+ * the directory to dir and return 1.
+ */
+    static int
+t_covered( char *path, char *dir )
+{
+    size_t		len;
+    int			cover, phase;
+
+    if ( exclude_set == NULL ) {
+	return( 0 );
+    }
+    if (( len = strlen( path )) + 2 > MAXPATHLEN ) {
+	return( 0 );
+    }
+    memcpy( dir, path, len );
+    strcpy( dir + len, "/" );
+    phase = stats_enter( SP_EXCLUDE );
+    cover = wildset_covers( exclude_set, dir );
+    stats_leave( phase );
+    if ( cover == 0 ) {
+	return( 0 );
+    }
+
+    /* keep the '/' of a root directory */
+    dir[ ( cover > 1 ) ? cover - 1 : cover ] = '\0';
+    return( 1 );
+}
+
+/*
+ * Is everything under the directory path excluded, without any special
+ * files there?  Then, unless path is being removed, transcript() would
+ * skip all of it, and the walk needn't read the directory at all.
+ */
+    int
+transcript_covered( char *path )
+{
+    char		dir[ MAXPATHLEN ];
+    struct node		*cur;
+
+    if ( exclude_warnings || !t_covered( path, dir )) {
+	return( 0 );
+    }
+    for ( cur = special_list->l_head; cur != NULL; cur = cur->n_next ) {
+	if ( ischildcase( cur->n_path, path, case_sensitive )) {
+	    return( 0 );
+	}
+    }
+    return( 1 );
+}
+
+/*
+ * Does a come before b?  Transcripts earlier in the list, which have
+ * higher t_num, come first among equal paths.
+ */
+    static int
+t_less( struct transcript *a, struct transcript *b )
+{
+    int			rc;
+
+    if (( rc = pathcasecmp( a->t_pinfo.pi_name, b->t_pinfo.pi_name,
+	    case_sensitive )) != 0 ) {
+	return( rc < 0 );
+    }
+    return( a->t_num > b->t_num );
+}
 
-    default:
-	fprintf( stderr, "%s: Unknown type: %c\n", fs->pi_name, fs->pi_type );
-	break;
+/*
+ * Move the top of the heap down into place after it's been read, or
+ * drop it if it's at EOF.
+ */
+    static void
+t_heap_down( void )
+{
+    struct transcript	*top;
+    int			i, c;
+
+    if ( t_nheap == 0 ) {
+	return;
+    }
+    top = t_heap[ 0 ];
+    if ( top->t_eof ) {
+	if ( --t_nheap == 0 ) {
+	    return;
+	}
+	top = t_heap[ t_nheap ];
     }
 
-    return T_MOVE_BOTH;
+    for ( i = 0; ( c = 2 * i + 1 ) < t_nheap; i = c ) {
+	if (( c + 1 < t_nheap ) && t_less( t_heap[ c + 1 ], t_heap[ c ] )) {
+	    c++;
+	}
+	if ( !t_less( t_heap[ c ], top )) {
+	    break;
+	}
+	t_heap[ i ] = t_heap[ c ];
+    }
+    t_heap[ i ] = top;
 }
 
-    int
-t_exclude( char *path )
+    static void
+t_heap_push( struct transcript *tran )
 {
-    struct node		*cur;
+    int			i, p;
 
-    if ( list_size( exclude_list ) > 0 ) {
-	for ( cur = exclude_list->l_head; cur != NULL; cur = cur->n_next ) {
-	    if ( wildcard( cur->n_path, path, case_sensitive )) {
-		return( 1 );
-	    }
+    for ( i = t_nheap++; i > 0; i = p ) {
+	p = ( i - 1 ) / 2;
+	if ( !t_less( tran, t_heap[ p ] )) {
+	    break;
 	}
+	t_heap[ i ] = t_heap[ p ];
     }
+    t_heap[ i ] = tran;
+}
 
-    return( 0 );
+    static void
+t_heap_init( void )
+{
+    struct transcript	*tran;
+    int			count = 0;
+
+    for ( tran = tran_head; tran != NULL; tran = tran->t_next ) {
+	count++;
+	t_last = tran;
+    }
+    if (( t_heap = malloc( count * sizeof( struct transcript * ))) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    for ( tran = tran_head; tran != NULL; tran = tran->t_next ) {
+	if ( !tran->t_eof ) {
+	    t_heap_push( tran );
+	}
+    }
 }
 
 /* 
- * Loop through the list of transcripts and compare each
- * to find which transcript to start with. Only switch to the
- * transcript if it is not at EOF.  A transcript at EOF may
- * still be returned.
+ * Find which transcript has the next path, keeping the transcripts in a
+ * min-heap ordered by path and then precedence.  Between calls, only
+ * the transcript last returned may have been read, and it's still at
+ * the top.  When every transcript is at EOF, the last one in the list
+ * is returned.
  */
     struct transcript *
 transcript_select( void )
 {
-    struct transcript	*next_tran = NULL;
     struct transcript	*begin_tran = NULL;
+    char		dir[ MAXPATHLEN ];
+
+    if ( t_heap == NULL ) {
+	t_heap_init();
+    } else {
+	t_heap_down();
+    }
 
     for (;;) {
-	for ( begin_tran = tran_head, next_tran = tran_head->t_next;
-		next_tran != NULL; next_tran = next_tran->t_next ) {
-	    if ( begin_tran->t_eof ) {
-		begin_tran = next_tran;
-		continue;
-	    }
-	    if ( ! next_tran->t_eof ) {
-		if ( pathcasecmp( next_tran->t_pinfo.pi_name,
-			begin_tran->t_pinfo.pi_name, case_sensitive ) < 0 ) {
-		    begin_tran = next_tran;
-		}
-	    }
+	if ( t_nheap == 0 ) {
+	    /* This is presumably the NULL transcript. */
+	    return( t_last );
 	}
+	begin_tran = t_heap[ 0 ];
 
-	/* move ahead other transcripts that match */
-	for ( next_tran = begin_tran->t_next; next_tran != NULL;
-		next_tran = next_tran->t_next ) {
-	    if ( pathcasecmp( begin_tran->t_pinfo.pi_name,
-		    next_tran->t_pinfo.pi_name, case_sensitive ) == 0 ) {
-		transcript_parse( next_tran );
-	    }
+	/*
+	 * move ahead other transcripts that match.  They're at the top
+	 * once begin_tran is out of the way, and then all come after it.
+	 */
+	t_heap[ 0 ] = t_heap[ --t_nheap ];
+	t_heap_down();
+	while (( t_nheap > 0 ) && ( pathcasecmp( t_heap[ 0 ]->t_pinfo.pi_name,
+		begin_tran->t_pinfo.pi_name, case_sensitive ) == 0 )) {
+	    transcript_parse( t_heap[ 0 ] );
+	    t_heap_down();
 	}
+	t_heap_push( begin_tran );
 
-	/* This is presumably the NULL transcript. */
-	if ( !begin_tran->t_eof ) {
-	    /*
-	     * If the highest precedence transcript line has a leading '-',
-	     * then just pretend it's not there.
-	     */
-	    if ( begin_tran->t_pinfo.pi_minus ) {
-		transcript_parse( begin_tran );
-		continue;
-	    }
+	/*
+	 * If the highest precedence transcript line has a leading '-',
+	 * then just pretend it's not there.
+	 */
+	if ( begin_tran->t_pinfo.pi_minus ) {
+	    transcript_parse( begin_tran );
+	    t_heap_down();
+	    continue;
+	}
 
-	    /* If we match an exclude pattern, pretend we don't see it */
-	    if ( begin_tran->t_type != T_SPECIAL &&
-		    t_exclude( begin_tran->t_pinfo.pi_name )) {
-		if ( exclude_warnings ) {
-		    printf( "#! Warning: excluding %s\n",
-				begin_tran->t_pinfo.pi_name );
-		}
+	/* If we match an exclude pattern, pretend we don't see it */
+	if ( begin_tran->t_type != T_SPECIAL &&
+		t_exclude( begin_tran->t_pinfo.pi_name )) {
+	    if ( exclude_warnings ) {
+		t_warn( begin_tran->t_pinfo.pi_name );
+		transcript_parse( begin_tran );
+	    } else if ( t_covered( begin_tran->t_pinfo.pi_name, dir )) {
+		/* so is the rest of dir, pass over it in one go */
+		t_parse( begin_tran, dir );
+	    } else {
 		transcript_parse( begin_tran );
-		continue;
 	    }
+	    t_heap_down();
+	    continue;
+	}
 
-	    /* Don't look outside of the initial path. */
-	
-	    if ( !ischildcase( begin_tran->t_pinfo.pi_name, path_prefix,
-		    case_sensitive )) {
+	/*
+	 * Don't look outside of the initial path.  What's under it comes
+	 * all together, so once past it there's no more to read, unless
+	 * exclusions are being warned about.
+	 */
+	if (( path_prefix != NULL ) && !ischildcase(
+		begin_tran->t_pinfo.pi_name, path_prefix, case_sensitive )) {
+	    if ( !exclude_warnings && ( pathcasecmp(
+		    begin_tran->t_pinfo.pi_name, path_prefix,
+		    case_sensitive ) > 0 )) {
+		begin_tran->t_eof = 1;
+	    } else {
 		transcript_parse( begin_tran );
-		continue;
 	    }
+	    t_heap_down();
+	    continue;
 	}
 
+	/* a closure's line belongs to one of its transcripts */
+	if ( begin_tran->t_cur != NULL ) {
+	    return( begin_tran->t_cur );
+	}
 	return( begin_tran );
     }
 }
 
+/*
+ * Compare path to the transcripts.  name is path relative to the open
+ * directory dfd, which may be AT_FDCWD.
+ */
     int
-transcript( char *path, struct stat *st, char *type,
+transcript( char *path, int dfd, char *name, struct stat *st, char *type,
 		struct applefileinfo *afinfo, int parent_minus )
 {
     struct pathinfo	pi;
@@ -771,18 +1913,15 @@ transcript( char *path, struct stat *st, char *type,
 	 * check for exclude match first to avoid any unnecessary work.
 	 * special files still have highest precedence.
 	 */
-	if ( t_exclude( path ) && !parent_minus ) {
-	    if ( list_size( special_list ) <= 0
-		    || list_check( special_list, path ) == 0 ) {
-		if ( exclude_warnings ) {
-		    printf( "#! Warning: excluding %s\n", path );
-		}
+	if ( !parent_minus && transcript_skip( path )) {
+	    if ( exclude_warnings ) {
+		t_warn( path );
+	    }
 
-		/* move the transcripts ahead */
-		tran = transcript_select();
+	    /* move the transcripts ahead */
+	    tran = transcript_select();
 
-		return( 0 );
-	    }
+	    return( 0 );
 	}
 
 	strcpy( pi.pi_name, path );
@@ -796,7 +1935,7 @@ transcript( char *path, struct stat *st, char *type,
 	    pi.pi_type = 'h';
 	    strcpy( pi.pi_link, linkpath );
 	} else if ( S_ISLNK( pi.pi_stat.st_mode )) {
-	    len = readlink( pi.pi_name, epath, MAXPATHLEN );
+	    len = readlinkat( dfd, name, epath, MAXPATHLEN );
 	    epath[ len ] = '\0';
 	    strcpy( pi.pi_link, epath );
 	}
@@ -843,6 +1982,7 @@ transcript( char *path, struct stat *st, char *type,
 t_new( int type, char *fullname, char *shortname, char *kfile ) 
 {
     struct transcript	 *new;
+    int			 fd;
 
     if (( new = (struct transcript *)malloc( sizeof( struct transcript )))
 	    == NULL ) {
@@ -865,7 +2005,15 @@ t_new( int type, char *fullname, char *shortname, char *kfile )
 	strcpy( new->t_shortname, shortname );
 	strcpy( new->t_fullname, fullname );
 	strcpy( new->t_kfile, kfile );
-	if (( new->t_in = fopen( fullname, "r" )) == NULL ) {
+	if (( fd = open( fullname, O_RDONLY, 0 )) < 0 ) {
+	    perror( fullname );
+	    exit( 2 );
+	}
+	t_map( new, fd );
+	if (( path_prefix != NULL ) && !exclude_warnings && new->t_mapped ) {
+	    t_seek( new );
+	}
+	if ( close( fd ) != 0 ) {
 	    perror( fullname );
 	    exit( 2 );
 	}
@@ -942,12 +2090,404 @@ t_display( void )
     return;
 }
 
+/*
+ * A closure is everything transcript_select() would return for a command
+ * file, kept beside it in kfile.closure so that later runs can read one
+ * file instead of reading and merging every transcript.  Lines that are
+ * excluded, or hidden by minus lines or higher precedence transcripts,
+ * are gone, and each line that's left starts with the number of the
+ * transcript it came from.
+ *
+ * The lines are preceded by '#' lines: the format version, case
+ * sensitivity and path format; the device, inode, size and mtime of
+ * every command file and transcript read; the exclude patterns and
+ * special files; and the transcripts themselves.  A closure is only used
+ * if none of those files has changed, and is rewritten otherwise.
+ */
+#define T_CLOSURE_VERSION	1
+
+int				closure = 0;
+static time_t			t_start;
+
+    static void
+t_close( void )
+{
+    struct transcript	*next;
+    int			i;
+
+    free( t_heap );
+    t_heap = NULL;
+    t_nheap = 0;
+    t_last = NULL;
+
+    while ( tran_head != NULL ) {
+	next = tran_head->t_next;
+	if ( tran_head->t_mapped ) {
+	    munmap( tran_head->t_map, tran_head->t_size );
+	} else {
+	    free( tran_head->t_map );
+	}
+	for ( i = 0; i < tran_head->t_nsources; i++ ) {
+	    free( tran_head->t_sources[ i ] );
+	}
+	free( tran_head->t_sources );
+	free( tran_head );
+	tran_head = next;
+    }
+}
+
+/*
+ * Write the closure of the transcripts just read to path.  Returns 0,
+ * having read nothing, if any of the files might have changed while
+ * they were being read.
+ */
+/* encode path for a closure, or return NULL if it can't be read back */
+    static char *
+t_encode( char *path )
+{
+    char		*e;
+
+    if ((( e = encode( path )) == NULL ) || ( strlen( e ) >= MAXPATHLEN )) {
+	return( NULL );
+    }
+    return( e );
+}
+
+    static int
+t_closure_write( char *path )
+{
+    struct transcript	*tran;
+    struct node		*cur;
+    struct stat		st;
+    char		temp[ MAXPATHLEN ];
+    char		*e;
+    FILE		*f;
+    int			fd;
+
+    if ( tran_head->t_type == T_NULL ) {
+	return( 0 );
+    }
+
+    if ( snprintf( temp, sizeof( temp ), "%s.XXXXXX", path )
+	    >= (int)sizeof( temp )) {
+	fprintf( stderr, "%s: path too long\n", path );
+	exit( 2 );
+    }
+    if (( fd = mkstemp( temp )) < 0 ) {
+	perror( temp );
+	exit( 2 );
+    }
+    if (( f = fdopen( fd, "w" )) == NULL ) {
+	perror( temp );
+	exit( 2 );
+    }
+    fprintf( f, "#closure %d %d %d\n", T_CLOSURE_VERSION, case_sensitive,
+	    tran_format );
+
+    for ( cur = kfile_list->l_head; cur != NULL; cur = cur->n_next ) {
+	if (( stat( cur->n_path, &st ) != 0 ) ||
+		( st.st_mtime >= t_start ) ||
+		(( e = t_encode( cur->n_path )) == NULL )) {
+	    goto unstable;
+	}
+	fprintf( f, "#file %llu %llu %" PRIofft "d %" PRItimet "d %s\n",
+		(unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+		st.st_size, st.st_mtime, e );
+    }
+    for ( tran = tran_head; tran->t_type != T_NULL; tran = tran->t_next ) {
+	if (( stat( tran->t_fullname, &st ) != 0 ) ||
+		( st.st_dev != tran->t_st.st_dev ) ||
+		( st.st_ino != tran->t_st.st_ino ) ||
+		( st.st_size != tran->t_st.st_size ) ||
+		( st.st_mtime != tran->t_st.st_mtime ) ||
+		( st.st_mtime >= t_start ) ||
+		(( e = t_encode( tran->t_fullname )) == NULL )) {
+	    goto unstable;
+	}
+	fprintf( f, "#file %llu %llu %" PRIofft "d %" PRItimet "d %s\n",
+		(unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+		st.st_size, st.st_mtime, e );
+    }
+
+    for ( cur = exclude_list->l_head; cur != NULL; cur = cur->n_next ) {
+	if (( e = t_encode( cur->n_path )) == NULL ) {
+	    goto unstable;
+	}
+	fprintf( f, "#exclude %s\n", e );
+    }
+    for ( cur = special_list->l_head; cur != NULL; cur = cur->n_next ) {
+	if (( e = t_encode( cur->n_path )) == NULL ) {
+	    goto unstable;
+	}
+	fprintf( f, "#special %s\n", e );
+    }
+    for ( tran = tran_head; tran->t_type != T_NULL; tran = tran->t_next ) {
+	fprintf( f, "#source %d %c", tran->t_num,
+		( tran->t_type == T_POSITIVE ) ? 'p' :
+		( tran->t_type == T_NEGATIVE ) ? 'n' : 's' );
+	if (( e = t_encode( tran->t_shortname )) == NULL ) {
+	    goto unstable;
+	}
+	fprintf( f, " %s", e );
+	if (( e = t_encode( tran->t_kfile )) == NULL ) {
+	    goto unstable;
+	}
+	fprintf( f, " %s", e );
+	if (( e = t_encode( tran->t_fullname )) == NULL ) {
+	    goto unstable;
+	}
+	fprintf( f, " %s\n", e );
+    }
+
+    while (( tran = transcript_select())->t_type != T_NULL ) {
+	fprintf( f, "%d %.*s\n", tran->t_num, tran->t_linelen, tran->t_line );
+	transcript_parse( tran );
+    }
+
+    if ( fclose( f ) != 0 ) {
+	perror( temp );
+	unlink( temp );
+	exit( 2 );
+    }
+    if ( rename( temp, path ) != 0 ) {
+	perror( path );
+	unlink( temp );
+	exit( 2 );
+    }
+    return( 1 );
+
+unstable:
+    fclose( f );
+    unlink( temp );
+    return( 0 );
+}
+
+/*
+ * Check that the '#' lines at the top of the closure tran describe
+ * files that haven't changed, and return the number of transcripts it
+ * has, or 0 if it can't be used.  tran is left at its first line.
+ */
+    static int
+t_closure_check( struct transcript *tran, int check )
+{
+    struct t_field	fv[ T_MAXFIELDS ];
+    struct stat		st;
+    char		*line, *end, *p;
+    int			ac, nsources = 0;
+
+    tran->t_off = 0;
+    tran->t_linenum = 0;
+    if ( !t_line( tran, &line, &end, T_CLOSURE_MAXLINE ) ||
+	    ( t_split( line, end, fv ) != 4 ) ||
+	    ( fv[ 0 ].f_len != 8 ) || ( memcmp( fv[ 0 ].f_p, "#closure", 8 )) ||
+	    ( t_decimal( &fv[ 1 ] ) != T_CLOSURE_VERSION ) ||
+	    ( t_decimal( &fv[ 2 ] ) != case_sensitive ) ||
+	    ( t_decimal( &fv[ 3 ] ) != tran_format )) {
+	return( 0 );
+    }
+
+    for ( ;; ) {
+	if ( !t_line( tran, &line, &end, T_CLOSURE_MAXLINE )) {
+	    break;
+	}
+	if (( ac = t_split( line, end, fv )) == 0 ) {
+	    continue;
+	}
+	if ( *fv[ 0 ].f_p != '#' ) {
+	    /* the first line of the closure proper */
+	    tran->t_off = line - tran->t_map;
+	    tran->t_linenum--;
+	    break;
+	}
+
+	if (( fv[ 0 ].f_len == 5 ) && ( memcmp( fv[ 0 ].f_p, "#file", 5 ) == 0 )) {
+	    if (( ac != 6 ) || (( p = t_path( &fv[ 5 ] )) == NULL )) {
+		return( 0 );
+	    }
+	    if ( !check ) {
+		continue;
+	    }
+	    if (( stat( p, &st ) != 0 ) ||
+		    ( (unsigned long long)t_decimal( &fv[ 1 ] ) !=
+		    (unsigned long long)st.st_dev ) ||
+		    ( (unsigned long long)t_decimal( &fv[ 2 ] ) !=
+		    (unsigned long long)st.st_ino ) ||
+		    ( t_decimal( &fv[ 3 ] ) != st.st_size ) ||
+		    ( t_decimal( &fv[ 4 ] ) != st.st_mtime )) {
+		return( 0 );
+	    }
+	} else if ((( fv[ 0 ].f_len == 8 ) &&
+		( memcmp( fv[ 0 ].f_p, "#exclude", 8 ) == 0 )) ||
+		(( fv[ 0 ].f_len == 8 ) &&
+		( memcmp( fv[ 0 ].f_p, "#special", 8 ) == 0 ))) {
+	    if (( ac != 2 ) || ( t_path( &fv[ 1 ] ) == NULL )) {
+		return( 0 );
+	    }
+	} else if (( fv[ 0 ].f_len == 7 ) &&
+		( memcmp( fv[ 0 ].f_p, "#source", 7 ) == 0 )) {
+	    if (( ac != 6 ) || ( fv[ 2 ].f_len != 1 ) ||
+		    ( strchr( "pns", *fv[ 2 ].f_p ) == NULL ) ||
+		    ( t_decimal( &fv[ 1 ] ) < 0 ) ||
+		    ( t_decimal( &fv[ 1 ] ) > 100000 ) ||
+		    ( t_path( &fv[ 3 ] ) == NULL ) ||
+		    ( t_path( &fv[ 4 ] ) == NULL ) ||
+		    ( t_path( &fv[ 5 ] ) == NULL )) {
+		return( 0 );
+	    }
+	    if ( t_decimal( &fv[ 1 ] ) >= nsources ) {
+		nsources = t_decimal( &fv[ 1 ] ) + 1;
+	    }
+	}
+    }
+
+    return( nsources );
+}
+
+/*
+ * Read the closure at path instead of the command file's transcripts.
+ * Unless check is 0, as it is for a closure just written, the closure
+ * is only read if it's up to date, and the exclude patterns and special
+ * files are taken from it.  Returns 0 if the closure wasn't read.
+ */
+    static int
+t_closure_read( char *path, int check )
+{
+    struct transcript	*new, *src;
+    struct t_field	fv[ T_MAXFIELDS ];
+    char		*line, *end, *p;
+    size_t		first;
+    int			fd, ac, n, firstline;
+
+    if (( fd = open( path, O_RDONLY, 0 )) < 0 ) {
+	if ( errno == ENOENT ) {
+	    return( 0 );
+	}
+	perror( path );
+	exit( 2 );
+    }
+    if (( new = (struct transcript *)malloc( sizeof( struct transcript )))
+	    == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    memset( new, 0, sizeof( struct transcript ));
+    new->t_type = T_POSITIVE;
+    strcpy( new->t_shortname, path );
+    strcpy( new->t_fullname, path );
+    t_map( new, fd );
+    if ( close( fd ) != 0 ) {
+	perror( path );
+	exit( 2 );
+    }
+
+    if (( new->t_nsources = t_closure_check( new, check )) == 0 ) {
+	if ( new->t_mapped ) {
+	    munmap( new->t_map, new->t_size );
+	} else {
+	    free( new->t_map );
+	}
+	free( new );
+	return( 0 );
+    }
+    first = new->t_off;
+    firstline = new->t_linenum;
+
+    if (( new->t_sources = (struct transcript **)calloc( new->t_nsources,
+	    sizeof( struct transcript * ))) == NULL ) {
+	perror( "calloc" );
+	exit( 2 );
+    }
+    new->t_off = 0;
+    new->t_linenum = 0;
+    while (( new->t_off < first ) &&
+	    t_line( new, &line, &end, T_CLOSURE_MAXLINE )) {
+	if (( ac = t_split( line, end, fv )) == 0 ) {
+	    continue;
+	}
+
+	if (( fv[ 0 ].f_len == 7 ) &&
+		( memcmp( fv[ 0 ].f_p, "#source", 7 ) == 0 )) {
+	    n = t_decimal( &fv[ 1 ] );
+	    if (( src = (struct transcript *)malloc(
+		    sizeof( struct transcript ))) == NULL ) {
+		perror( "malloc" );
+		exit( 2 );
+	    }
+	    memset( src, 0, sizeof( struct transcript ));
+	    src->t_type = ( *fv[ 2 ].f_p == 'p' ) ? T_POSITIVE :
+		    ( *fv[ 2 ].f_p == 'n' ) ? T_NEGATIVE : T_SPECIAL;
+	    src->t_num = n;
+	    src->t_eof = 0;
+	    src->t_stream = new;
+	    strcpy( src->t_shortname, t_path( &fv[ 3 ] ));
+	    strcpy( src->t_kfile, t_path( &fv[ 4 ] ));
+	    strcpy( src->t_fullname, t_path( &fv[ 5 ] ));
+	    free( new->t_sources[ n ] );
+	    new->t_sources[ n ] = src;
+	    continue;
+	}
+	if ( !check ) {
+	    continue;
+	}
+	if (( fv[ 0 ].f_len == 8 ) &&
+		( memcmp( fv[ 0 ].f_p, "#exclude", 8 ) == 0 )) {
+	    p = t_path( &fv[ 1 ] );
+	    if ( !list_check( exclude_list, p ) &&
+		    ( list_insert( exclude_list, p ) != 0 )) {
+		perror( "list_insert" );
+		exit( 2 );
+	    }
+	} else if (( fv[ 0 ].f_len == 8 ) &&
+		( memcmp( fv[ 0 ].f_p, "#special", 8 ) == 0 )) {
+	    p = t_path( &fv[ 1 ] );
+	    if ( !list_check( special_list, p ) &&
+		    ( list_insert( special_list, p ) != 0 )) {
+		perror( "list_insert" );
+		exit( 2 );
+	    }
+	}
+    }
+    new->t_off = first;
+    new->t_linenum = firstline;
+
+    new->t_next = tran_head;
+    tran_head->t_prev = new;
+    new->t_num = new->t_next->t_num + 1;
+    tran_head = new;
+    transcript_parse( new );
+
+    return( 1 );
+}
+
+/* compile the exclude patterns, since every path is checked */
+    static void
+t_excludes( void )
+{
+    struct node		*cur;
+
+    if ( list_size( exclude_list ) <= 0 ) {
+	return;
+    }
+    if (( exclude_set = wildset_new( case_sensitive )) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    for ( cur = exclude_list->l_head; cur != NULL; cur = cur->n_next ) {
+	if ( wildset_add( exclude_set, cur->n_path ) != 0 ) {
+	    perror( "malloc" );
+	    exit( 2 );
+	}
+    }
+}
+
     void
 transcript_init( char *kfile, int location )
 {
     char	*special = "special.T";
-    char	*p;
+    char	*p, *prefix;
     char	fullpath[ MAXPATHLEN ];
+    char	cpath[ MAXPATHLEN ];
+    int		use_closure = 0;
 
     /*
      * Make sure that there's always a transcript to read, so other code
@@ -987,20 +2527,60 @@ transcript_init( char *kfile, int location )
 	perror( "list_new" );
 	exit( 2 );
     }
-    if ( read_kfile( kfile, location ) != 0 ) {
-	exit( 2 );
+
+    /*
+     * Exclusion warnings need the excluded lines, which a closure
+     * leaves out.
+     */
+    if ( closure && ( location == K_CLIENT ) && !exclude_warnings &&
+	    ( skip == 0 )) {
+	if ( snprintf( cpath, sizeof( cpath ), "%s.closure", kfile )
+		>= (int)sizeof( cpath )) {
+	    fprintf( stderr, "%s.closure: path too long\n", kfile );
+	    exit( 2 );
+	}
+	use_closure = 1;
+	t_start = time( NULL );
     }
 
-    if ( !( skip & T_SKIP_SPECIAL )) {
-	if (( list_size( special_list ) > 0 ) && ( location == K_CLIENT )) {
-	    /* open the special transcript if there were any special files */
-	    if ( strlen( kdir ) + strlen( special ) + 2 > MAXPATHLEN ) {
-		fprintf( stderr, 
-			"special path too long: %s%s\n", kdir, special );
-		exit( 2 );
+    if ( use_closure && t_closure_read( cpath, 1 )) {
+	t_excludes();
+    } else {
+	/* a closure has to have everything, not just what's under the prefix */
+	prefix = path_prefix;
+	if ( use_closure ) {
+	    path_prefix = NULL;
+	}
+
+	if ( read_kfile( kfile, location ) != 0 ) {
+	    exit( 2 );
+	}
+	t_excludes();
+
+	if ( !( skip & T_SKIP_SPECIAL )) {
+	    if (( list_size( special_list ) > 0 ) && ( location == K_CLIENT )) {
+		/* open the special transcript if there were any special files */
+		if ( strlen( kdir ) + strlen( special ) + 2 > MAXPATHLEN ) {
+		    fprintf( stderr, 
+			    "special path too long: %s%s\n", kdir, special );
+		    exit( 2 );
+		}
+		sprintf( fullpath, "%s%s", kdir, special );
+		t_new( T_SPECIAL, fullpath, special, "special" );
+	    }
+	}
+
+	if ( use_closure ) {
+	    /* the transcripts are used up writing it, so read it back */
+	    if ( t_closure_write( cpath )) {
+		t_close();
+		t_new( T_NULL, NULL, NULL, NULL );
+		if ( !t_closure_read( cpath, 0 )) {
+		    fprintf( stderr, "%s: bad closure\n", cpath );
+		    exit( 2 );
+		}
 	    }
-	    sprintf( fullpath, "%s%s", kdir, special );
-	    t_new( T_SPECIAL, fullpath, special, "special" );
+	    path_prefix = prefix;
 	}
     }
 
@@ -1215,20 +2795,15 @@ read_kfile( char *kfile, int location )
     void
 transcript_free( )
 {
-    struct transcript	 *next;
-
     /*
      * Call transcript() with NULL to indicate that we've run out of
      * filesystem to compare against.
      */
-    transcript( NULL, NULL, NULL, NULL, 0 );
+    transcript( NULL, AT_FDCWD, NULL, NULL, NULL, NULL, 0 );
+    t_drain( 1 );
+    t_flush();
+    t_close();
 
-    while ( tran_head != NULL ) {
-	next = tran_head->t_next;
-	if ( tran_head->t_in != NULL ) {
-	    fclose( tran_head->t_in );
-	}
-	free( tran_head );
-	tran_head = next;
-    }
+    wildset_free( exclude_set );
+    exclude_set = NULL;
 }
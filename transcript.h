@@ -68,17 +68,31 @@ struct transcript {
     char		t_kfile[ MAXPATHLEN ];
     int			t_linenum;
     int			t_eof;
-    FILE		*t_in;
+    char		*t_map;
+    size_t		t_size;
+    size_t		t_off;
+    int			t_mapped;
+    struct stat		t_st;
+    char		*t_line;
+    int			t_linelen;
+    struct transcript	**t_sources;
+    int			t_nsources;
+    struct transcript	*t_cur;
+    struct transcript	*t_stream;
 };
 
-int			transcript( char *, struct stat *, char *, struct applefileinfo *, int );
+int			transcript( char *, int, char *, struct stat *, char *,
+			    struct applefileinfo *, int );
 void			transcript_init( char *kfile, int location );
 struct transcript	*transcript_select( void );
 void			transcript_parse( struct transcript * );
 void			transcript_free( void );
 void			t_new( int, char *, char *, char * );
 int			t_exclude( char *path );
+int			transcript_skip( char *path );
+int			transcript_covered( char *path );
 void			t_print( struct pathinfo *, struct transcript *, int );
+void			t_flush( void );
 char			*hardlink( struct pathinfo * );
 int			hardlink_changed( struct pathinfo *, int );
 void			hardlink_free( void );
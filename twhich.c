@@ -105,6 +105,7 @@ twhich( char *pattern, int displayall )
 	    } else {
 		t_print( NULL, tran, PR_TRAN_ONLY );
 	    }
+	    t_flush();
 
 	    if ( !displayall ) {
 		goto done;
@@ -6,4 +6,4 @@
 #include "config.h"
 
 char *version = VERSION;
-char *checksumlist = "sha1\nsha\nmd5\nmd2\ndss1\nmdc2\nripemd160";
+char *checksumlist = "blake3\nsha1\nsha\nmd5\nmd2\ndss1\nmdc2\nripemd160";
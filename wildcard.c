@@ -5,7 +5,10 @@
 
 #include "config.h"
 
+#include <sys/param.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 
 #include "wildcard.h"
@@ -139,3 +142,566 @@ wildcard( char *wild, char *p, int sensitive )
 	}
     }
 }
+
+/*
+ * A wildset is a set of patterns compiled to be matched against many
+ * paths, giving the same answer as calling wildcard() with each pattern
+ * in turn.  Patterns become an NFA, and the patterns are merged into a
+ * trie of its states, up to any '{', so that patterns sharing a start
+ * share the work of matching it.  A path is matched in one pass, running
+ * every state reached so far, so the cost grows with the length of the
+ * path rather than the number of patterns.
+ *
+ * In the trie, wt_next is a state's first child and wt_sibling the next
+ * child of its parent.  The part of a pattern from a '{' on is a chain of
+ * its own, where wt_next is simply the state that follows.
+ *
+ * wildcard() reads past the end of the path when a '?' or '[' reaches it;
+ * here those never match.
+ */
+
+#define WS_CHAR		1	/* consume wt_c */
+#define WS_ANY		2	/* consume any character */
+#define WS_NOT		3	/* consume any character but wt_c */
+#define WS_STAR		4	/* consume any character, or go on */
+#define WS_RANGE	5	/* consume a number from wt_min to wt_max */
+#define WS_SPLIT	6	/* go to both wt_next and wt_alt */
+#define WS_MATCH	7	/* match, if at the end of the path */
+#define WS_FAIL		8	/* malformed, never matches */
+
+/* sets of states this size or smaller are matched without malloc() */
+#define WS_STACK	256
+
+struct ws_list {
+    int			*wl_states;
+    int			wl_count;
+    unsigned char	*wl_mark;
+};
+
+struct ws_run {
+    struct wildset	*wr_set;
+    char		*wr_path;
+    struct ws_list	wr_pend;	/* states waiting on a number */
+    int			wr_pendpos;	/* where the number ends */
+    int			wr_covers;	/* for wildset_covers() */
+};
+
+static int	ws_fold( struct wildset *, int );
+static int	ws_emit( struct wildset *, struct wildstate * );
+static char	*ws_token( struct wildset *, char *, struct wildstate * );
+static int	ws_chain( struct wildset *, char * );
+static int	ws_marked( struct ws_list *, int );
+static void	ws_mark( struct ws_list *, int );
+static void	ws_clear( struct ws_list * );
+static int	ws_add( struct ws_run *, struct ws_list *, int, int );
+static int	ws_adds( struct ws_run *, struct ws_list *, int, int );
+static int	ws_match( struct wildset *, char *, int );
+
+    static int
+ws_fold( struct wildset *ws, int c )
+{
+    return( ws->ws_sensitive ? c : tolower( c ));
+}
+
+/* Append a copy of t, by default followed by the next state appended. */
+    static int
+ws_emit( struct wildset *ws, struct wildstate *t )
+{
+    struct wildstate	*new;
+
+    if ( ws->ws_nstates >= ws->ws_ssize ) {
+	ws->ws_ssize = ( ws->ws_ssize == 0 ) ? 64 : ws->ws_ssize * 2;
+	if (( new = realloc( ws->ws_states,
+		ws->ws_ssize * sizeof( struct wildstate ))) == NULL ) {
+	    return( -1 );
+	}
+	ws->ws_states = new;
+    }
+
+    new = &ws->ws_states[ ws->ws_nstates ];
+    *new = *t;
+    new->wt_next = ws->ws_nstates + 1;
+    new->wt_alt = -1;
+    new->wt_sibling = -1;
+
+    return( ws->ws_nstates++ );
+}
+
+/*
+ * Read the piece of the pattern at wild into t, in the same way that
+ * wildcard() reads it, and return what follows.  wildcard() fails when it
+ * gets as far as a malformed '<', so that is WS_FAIL.  A '*' followed by
+ * more of the pattern only tries the rest where there's some path left,
+ * which is noted in wt_c.  '{' isn't read here.
+ */
+    static char *
+ws_token( struct wildset *ws, char *wild, struct wildstate *t )
+{
+    char		*end;
+
+    memset( t, 0, sizeof( struct wildstate ));
+
+    switch ( *wild ) {
+    case '*' :
+	t->wt_op = WS_STAR;
+	t->wt_c = ( wild[ 1 ] != '\0' );
+	return( wild + 1 );
+
+    case '<' :
+	wild++;
+	t->wt_op = WS_FAIL;
+
+	if ( ! isdigit( (int)*wild )) {
+	    return( wild );
+	}
+	t->wt_min = atoi( wild );
+	while ( isdigit( (int)*wild )) wild++;
+
+	if ( *wild++ != '-' ) {
+	    return( wild );
+	}
+
+	if ( ! isdigit( (int)*wild )) {
+	    return( wild );
+	}
+	t->wt_max = atoi( wild );
+	while ( isdigit( (int)*wild )) wild++;
+
+	if ( *wild++ != '>' ) {
+	    return( wild );
+	}
+
+	t->wt_op = WS_RANGE;
+	return( wild );
+
+    case '?' :
+	t->wt_op = WS_ANY;
+	return( wild + 1 );
+
+    case '[' :
+	/*
+	 * wildcard() takes any character that differs from one of
+	 * those in the brackets.
+	 */
+	t->wt_op = WS_FAIL;
+	for ( end = wild + 1; *end != ']'; end++ ) {
+	    if ( *end == '\0' ) {
+		return( end );
+	    }
+	}
+	if ( end == wild + 1 ) {
+	    return( end );
+	}
+	t->wt_op = WS_NOT;
+	t->wt_c = ws_fold( ws, wild[ 1 ] );
+	for ( wild += 2; wild < end; wild++ ) {
+	    if ( ws_fold( ws, *wild ) != t->wt_c ) {
+		t->wt_op = WS_ANY;
+		t->wt_c = 0;
+	    }
+	}
+	return( end + 1 );
+
+    case '\\' :
+	wild++;
+    default :
+	if ( *wild == '\0' ) {
+	    t->wt_op = WS_MATCH;
+	    return( wild );
+	}
+	t->wt_op = WS_CHAR;
+	t->wt_c = ws_fold( ws, *wild );
+	return( wild + 1 );
+    }
+}
+
+/*
+ * Compile wild, which starts with a '{', into a chain of states.  Each
+ * alternative in braces is a run of WS_CHAR states, with a WS_SPLIT in
+ * front of all but the last, all going on to the rest of the pattern.
+ */
+    static int
+ws_chain( struct wildset *ws, char *wild )
+{
+    struct wildstate	t;
+    char		*end, *alt, *q;
+    int			s, cont;
+
+    for (;;) {
+	if ( *wild != '{' ) {
+	    wild = ws_token( ws, wild, &t );
+	    if ( ws_emit( ws, &t ) < 0 ) {
+		return( -1 );
+	    }
+	    if (( t.wt_op == WS_MATCH ) || ( t.wt_op == WS_FAIL )) {
+		return( 0 );
+	    }
+	    continue;
+	}
+
+	for ( end = wild + 1; *end != '}'; end++ ) {
+	    if ( *end == '{' || *end == '\0' ) {
+		/* malformed pattern */
+		memset( &t, 0, sizeof( struct wildstate ));
+		t.wt_op = WS_FAIL;
+		return(( ws_emit( ws, &t ) < 0 ) ? -1 : 0 );
+	    }
+	}
+
+	/* a state for each character and each comma */
+	cont = ws->ws_nstates + ( end - wild - 1 );
+	for ( alt = wild + 1; ; alt = q + 1 ) {
+	    for ( q = alt; *q != ',' && *q != '}'; q++ )
+		;
+	    if ( *q == ',' ) {
+		memset( &t, 0, sizeof( struct wildstate ));
+		t.wt_op = WS_SPLIT;
+		if (( s = ws_emit( ws, &t )) < 0 ) {
+		    return( -1 );
+		}
+		if ( q == alt ) {
+		    ws->ws_states[ s ].wt_next = cont;
+		}
+		ws->ws_states[ s ].wt_alt = s + 1 + ( q - alt );
+	    }
+	    for ( ; alt < q; alt++ ) {
+		memset( &t, 0, sizeof( struct wildstate ));
+		t.wt_op = WS_CHAR;
+		t.wt_c = ws_fold( ws, *alt );
+		if (( s = ws_emit( ws, &t )) < 0 ) {
+		    return( -1 );
+		}
+		if ( alt + 1 == q ) {
+		    ws->ws_states[ s ].wt_next = cont;
+		}
+	    }
+	    if ( *q == '}' ) {
+		break;
+	    }
+	}
+	wild = end + 1;
+    }
+}
+
+    struct wildset *
+wildset_new( int sensitive )
+{
+    struct wildset	*ws;
+
+    if (( ws = malloc( sizeof( struct wildset ))) == NULL ) {
+	return( NULL );
+    }
+    memset( ws, 0, sizeof( struct wildset ));
+    ws->ws_sensitive = sensitive;
+    ws->ws_root = -1;
+
+    return( ws );
+}
+
+    int
+wildset_add( struct wildset *ws, char *wild )
+{
+    struct wildstate	t, *st;
+    int			parent = -1, s;
+
+    for (;;) {
+	s = ( parent < 0 ) ? ws->ws_root : ws->ws_states[ parent ].wt_next;
+
+	if ( *wild == '{' ) {
+	    /* the rest is this pattern's own, behind a WS_SPLIT */
+	    memset( &t, 0, sizeof( struct wildstate ));
+	    t.wt_op = WS_SPLIT;
+	} else {
+	    wild = ws_token( ws, wild, &t );
+	    for ( ; s >= 0; s = st->wt_sibling ) {
+		st = &ws->ws_states[ s ];
+		if (( st->wt_op == t.wt_op ) && ( st->wt_c == t.wt_c ) &&
+			( st->wt_min == t.wt_min ) &&
+			( st->wt_max == t.wt_max )) {
+		    break;
+		}
+	    }
+	}
+
+	if ( s < 0 || t.wt_op == WS_SPLIT ) {
+	    /* add a new first child to parent */
+	    if (( s = ws_emit( ws, &t )) < 0 ) {
+		return( -1 );
+	    }
+	    st = &ws->ws_states[ s ];
+	    if ( parent < 0 ) {
+		st->wt_sibling = ws->ws_root;
+		ws->ws_root = s;
+	    } else {
+		st->wt_sibling = ws->ws_states[ parent ].wt_next;
+		ws->ws_states[ parent ].wt_next = s;
+	    }
+	    if ( t.wt_op == WS_SPLIT ) {
+		return( ws_chain( ws, wild ));
+	    }
+	    st->wt_next = -1;
+	}
+
+	if (( t.wt_op == WS_MATCH ) || ( t.wt_op == WS_FAIL )) {
+	    return( 0 );
+	}
+	parent = s;
+    }
+}
+
+    static int
+ws_marked( struct ws_list *l, int s )
+{
+    return( l->wl_mark[ s >> 3 ] & ( 1 << ( s & 7 )));
+}
+
+    static void
+ws_mark( struct ws_list *l, int s )
+{
+    l->wl_mark[ s >> 3 ] |= ( 1 << ( s & 7 ));
+    l->wl_states[ l->wl_count++ ] = s;
+}
+
+    static void
+ws_clear( struct ws_list *l )
+{
+    int			i, s;
+
+    for ( i = 0; i < l->wl_count; i++ ) {
+	s = l->wl_states[ i ];
+	l->wl_mark[ s >> 3 ] &= ~( 1 << ( s & 7 ));
+    }
+    l->wl_count = 0;
+}
+
+/*
+ * Add state s, at pos in the path, to l if it can consume the character
+ * there, along with everything it leads to without consuming one.
+ * Returns 1 if that reaches a match.
+ */
+    static int
+ws_add( struct ws_run *r, struct ws_list *l, int s, int pos )
+{
+    struct wildstate	*st;
+    char		*p;
+    int			c, e;
+
+    st = &r->wr_set->ws_states[ s ];
+    p = &r->wr_path[ pos ];
+
+    switch ( st->wt_op ) {
+    case WS_CHAR :
+	if ( *p == '\0' ) {
+	    return( 0 );
+	}
+	c = ws_fold( r->wr_set, *p );
+	if ( c != st->wt_c ) {
+	    return( 0 );
+	}
+	break;
+
+    case WS_NOT :
+	if ( *p == '\0' ) {
+	    return( 0 );
+	}
+	c = ws_fold( r->wr_set, *p );
+	if ( c == st->wt_c ) {
+	    return( 0 );
+	}
+	break;
+
+    case WS_ANY :
+	if ( *p == '\0' ) {
+	    return( 0 );
+	}
+	break;
+
+    case WS_STAR :
+	if ( ws_marked( l, s )) {
+	    return( 0 );
+	}
+	ws_mark( l, s );
+	if ( st->wt_c && ( *p == '\0' )) {
+	    return( 0 );
+	}
+	return( ws_adds( r, l, st->wt_next, pos ));
+
+    case WS_SPLIT :
+	if ( ws_adds( r, l, st->wt_next, pos )) {
+	    return( 1 );
+	}
+	return( ws_adds( r, l, st->wt_alt, pos ));
+
+    case WS_RANGE :
+	/* the whole number is consumed, so go on where it ends */
+	if ( ! isdigit( (int)*p )) {
+	    return( 0 );
+	}
+	e = atoi( p );
+	if (( e < st->wt_min ) || ( e > st->wt_max ) || ( st->wt_next < 0 )) {
+	    return( 0 );
+	}
+	for ( e = pos; isdigit( (int)r->wr_path[ e ] ); e++ )
+	    ;
+	r->wr_pendpos = e;
+	if ( !ws_marked( &r->wr_pend, st->wt_next )) {
+	    ws_mark( &r->wr_pend, st->wt_next );
+	}
+	return( 0 );
+
+    case WS_MATCH :
+	return( !r->wr_covers && ( *p == '\0' ));
+
+    default :
+	return( 0 );
+    }
+
+    if ( !ws_marked( l, s )) {
+	ws_mark( l, s );
+    }
+    return( 0 );
+}
+
+/* ws_add() s and its siblings. */
+    static int
+ws_adds( struct ws_run *r, struct ws_list *l, int s, int pos )
+{
+    for ( ; s >= 0; s = r->wr_set->ws_states[ s ].wt_sibling ) {
+	if ( ws_add( r, l, s, pos )) {
+	    return( 1 );
+	}
+    }
+    return( 0 );
+}
+
+/*
+ * Run path through ws.  Unless covers is set, returns 1 if it matches.
+ * With covers, instead returns the length of the shortest part of path
+ * ending in a '/' that can't be followed by anything that doesn't match,
+ * because some pattern has reached a final '*', or 0 if there's none.
+ */
+    static int
+ws_match( struct wildset *ws, char *path, int covers )
+{
+    struct ws_run	r;
+    struct ws_list	l[ 2 ], *cur, *next, *tmp;
+    struct wildstate	*st;
+    int			states[ 3 * WS_STACK ];
+    unsigned char	marks[ 3 * (( WS_STACK + 7 ) / 8 ) ];
+    int			*sbuf = states;
+    unsigned char	*mbuf = marks;
+    int			n, mlen, pos, i, s, match = 0;
+
+    if ( ws->ws_root < 0 ) {
+	return( 0 );
+    }
+
+    n = ws->ws_nstates;
+    mlen = ( n + 7 ) / 8;
+    if ( n > WS_STACK ) {
+	if ((( sbuf = malloc( 3 * n * sizeof( int ))) == NULL ) ||
+		(( mbuf = malloc( 3 * mlen )) == NULL )) {
+	    perror( "malloc" );
+	    exit( 2 );
+	}
+    }
+    memset( mbuf, 0, 3 * mlen );
+    for ( i = 0; i < 2; i++ ) {
+	l[ i ].wl_states = sbuf + i * n;
+	l[ i ].wl_mark = mbuf + i * mlen;
+	l[ i ].wl_count = 0;
+    }
+    r.wr_set = ws;
+    r.wr_path = path;
+    r.wr_pend.wl_states = sbuf + 2 * n;
+    r.wr_pend.wl_mark = mbuf + 2 * mlen;
+    r.wr_pend.wl_count = 0;
+    r.wr_pendpos = -1;
+    r.wr_covers = covers;
+    cur = &l[ 0 ];
+    next = &l[ 1 ];
+
+    if ( ws_adds( &r, cur, ws->ws_root, 0 )) {
+	match = 1;
+	goto done;
+    }
+
+    for ( pos = 0; path[ pos ] != '\0'; pos++ ) {
+	if (( cur->wl_count == 0 ) && ( r.wr_pendpos < 0 )) {
+	    break;
+	}
+
+	/* every state in cur consumes path[ pos ] */
+	for ( i = 0; i < cur->wl_count; i++ ) {
+	    s = cur->wl_states[ i ];
+	    st = &ws->ws_states[ s ];
+	    if ( st->wt_op == WS_STAR ) {
+		match = ws_add( &r, next, s, pos + 1 );
+	    } else {
+		match = ws_adds( &r, next, st->wt_next, pos + 1 );
+	    }
+	    if ( match ) {
+		goto done;
+	    }
+	}
+	ws_clear( cur );
+	tmp = cur;
+	cur = next;
+	next = tmp;
+
+	if ( pos + 1 == r.wr_pendpos ) {
+	    for ( i = 0; i < r.wr_pend.wl_count; i++ ) {
+		if ( ws_adds( &r, cur, r.wr_pend.wl_states[ i ], pos + 1 )) {
+		    match = 1;
+		    goto done;
+		}
+	    }
+	    ws_clear( &r.wr_pend );
+	    r.wr_pendpos = -1;
+	}
+
+	if ( covers && ( path[ pos ] == '/' )) {
+	    for ( i = 0; i < cur->wl_count; i++ ) {
+		st = &ws->ws_states[ cur->wl_states[ i ]];
+		if (( st->wt_op == WS_STAR ) && !st->wt_c ) {
+		    match = pos + 1;
+		    goto done;
+		}
+	    }
+	}
+    }
+
+done:
+    if ( sbuf != states ) {
+	free( sbuf );
+	free( mbuf );
+    }
+    return( match );
+}
+
+    int
+wildset_match( struct wildset *ws, char *path )
+{
+    return( ws_match( ws, path, 0 ));
+}
+
+/*
+ * If everything beginning with some leading part of path, ending in a
+ * '/', matches, return the length of the shortest such part.  This may
+ * miss some parts that are covered, but never claims one that isn't.
+ */
+    int
+wildset_covers( struct wildset *ws, char *path )
+{
+    return( ws_match( ws, path, 1 ));
+}
+
+    void
+wildset_free( struct wildset *ws )
+{
+    if ( ws == NULL ) {
+	return;
+    }
+    free( ws->ws_states );
+    free( ws );
+}
@@ -4,3 +4,27 @@
  */
 
 int wildcard( char *, char *, int );
+
+struct wildstate {
+    int			wt_op;
+    int			wt_c;
+    int			wt_min;
+    int			wt_max;
+    int			wt_next;
+    int			wt_alt;
+    int			wt_sibling;
+};
+
+struct wildset {
+    int			ws_sensitive;
+    struct wildstate	*ws_states;
+    int			ws_nstates;
+    int			ws_ssize;
+    int			ws_root;
+};
+
+struct wildset	*wildset_new( int sensitive );
+int		wildset_add( struct wildset *, char * );
+int		wildset_match( struct wildset *, char * );
+int		wildset_covers( struct wildset *, char * );
+void		wildset_free( struct wildset * );
@@ -0,0 +1,296 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+#include "workq.h"
+
+/*
+ * A single process-wide pool of worker threads.  Tasks are run in queue
+ * order; callers that need a task run sooner push it at the head.  Every
+ * task that finishes wakes anyone sleeping in wq_wait(), so callers keep
+ * their own completion state, change it only while holding wq_lock(),
+ * and re-check it after each wakeup.
+ *
+ * With one thread, or without pthreads, no workers are started and
+ * wq_push() runs the task immediately in the caller.
+ */
+
+struct wq_task {
+    struct wq_task	*wt_next;
+    struct wq_task	*wt_prev;
+    void		(*wt_fn)( void * );
+    void		*wt_arg;
+};
+
+static struct wq_task	*wq_head = NULL;
+static struct wq_task	*wq_tail = NULL;
+static int		wq_nthreads = 0;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t	wq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	wq_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	wq_done = PTHREAD_COND_INITIALIZER;
+static pthread_t	*wq_tids = NULL;
+static int		wq_shutdown = 0;
+
+static void		*wq_worker( void * );
+#endif /* HAVE_PTHREAD */
+
+static struct wq_task	*wq_find( void * );
+static void		wq_unlink( struct wq_task * );
+
+    static struct wq_task *
+wq_find( void *arg )
+{
+    struct wq_task	*cur;
+
+    for ( cur = wq_head; cur != NULL; cur = cur->wt_next ) {
+	if ( cur->wt_arg == arg ) {
+	    return( cur );
+	}
+    }
+    return( NULL );
+}
+
+    static void
+wq_unlink( struct wq_task *task )
+{
+    if ( task->wt_prev != NULL ) {
+	task->wt_prev->wt_next = task->wt_next;
+    } else {
+	wq_head = task->wt_next;
+    }
+    if ( task->wt_next != NULL ) {
+	task->wt_next->wt_prev = task->wt_prev;
+    } else {
+	wq_tail = task->wt_prev;
+    }
+    task->wt_next = task->wt_prev = NULL;
+}
+
+#ifdef HAVE_PTHREAD
+    static void *
+wq_worker( void *arg )
+{
+    struct wq_task	*task;
+
+    pthread_mutex_lock( &wq_mutex );
+    for (;;) {
+	while (( wq_head == NULL ) && ( !wq_shutdown )) {
+	    pthread_cond_wait( &wq_work, &wq_mutex );
+	}
+	if ( wq_head == NULL ) {
+	    break;
+	}
+	task = wq_head;
+	wq_unlink( task );
+	pthread_mutex_unlock( &wq_mutex );
+
+	(*task->wt_fn)( task->wt_arg );
+	free( task );
+
+	pthread_mutex_lock( &wq_mutex );
+	pthread_cond_broadcast( &wq_done );
+    }
+    pthread_mutex_unlock( &wq_mutex );
+
+    return( NULL );
+}
+#endif /* HAVE_PTHREAD */
+
+/*
+ * Start nthreads workers.  Returns the number of workers running, which
+ * is 0 when tasks will be run inline.
+ */
+    int
+wq_init( int nthreads )
+{
+#ifdef HAVE_PTHREAD
+    int			i, rc;
+
+    if ( nthreads <= 1 || wq_nthreads > 0 ) {
+	return( wq_nthreads );
+    }
+
+    if (( wq_tids = malloc( nthreads * sizeof( pthread_t ))) == NULL ) {
+	return( -1 );
+    }
+    for ( i = 0; i < nthreads; i++ ) {
+	if (( rc = pthread_create( &wq_tids[ i ], NULL,
+		wq_worker, NULL )) != 0 ) {
+	    errno = rc;
+	    if ( i == 0 ) {
+		free( wq_tids );
+		wq_tids = NULL;
+		return( -1 );
+	    }
+	    break;
+	}
+    }
+    wq_nthreads = i;
+#endif /* HAVE_PTHREAD */
+
+    return( wq_nthreads );
+}
+
+    int
+wq_threads( void )
+{
+    return( wq_nthreads );
+}
+
+    void
+wq_push( void (*fn)( void * ), void *arg, int where )
+{
+    struct wq_task	*task;
+
+    if ( wq_nthreads == 0 ) {
+	(*fn)( arg );
+	return;
+    }
+
+    if (( task = malloc( sizeof( struct wq_task ))) == NULL ) {
+	perror( "malloc" );
+	exit( 2 );
+    }
+    task->wt_fn = fn;
+    task->wt_arg = arg;
+
+    wq_lock();
+    if ( where == WQ_HEAD ) {
+	task->wt_prev = NULL;
+	task->wt_next = wq_head;
+	if ( wq_head != NULL ) {
+	    wq_head->wt_prev = task;
+	} else {
+	    wq_tail = task;
+	}
+	wq_head = task;
+    } else {
+	task->wt_next = NULL;
+	task->wt_prev = wq_tail;
+	if ( wq_tail != NULL ) {
+	    wq_tail->wt_next = task;
+	} else {
+	    wq_head = task;
+	}
+	wq_tail = task;
+    }
+#ifdef HAVE_PTHREAD
+    pthread_cond_signal( &wq_work );
+#endif /* HAVE_PTHREAD */
+    wq_unlock();
+}
+
+/*
+ * Remove a task that no worker has picked up yet.  Called with the lock
+ * held.  Returns 1 if the task was removed, 0 if it is running or done.
+ */
+    int
+wq_cancel( void *arg )
+{
+    struct wq_task	*task;
+
+    if (( task = wq_find( arg )) == NULL ) {
+	return( 0 );
+    }
+    wq_unlink( task );
+    free( task );
+    return( 1 );
+}
+
+/*
+ * Move a queued task to the head of the queue.  Called with the lock held.
+ */
+    int
+wq_promote( void *arg )
+{
+    struct wq_task	*task;
+
+    if (( task = wq_find( arg )) == NULL ) {
+	return( 0 );
+    }
+    wq_unlink( task );
+    task->wt_next = wq_head;
+    if ( wq_head != NULL ) {
+	wq_head->wt_prev = task;
+    } else {
+	wq_tail = task;
+    }
+    wq_head = task;
+    return( 1 );
+}
+
+    void
+wq_lock( void )
+{
+#ifdef HAVE_PTHREAD
+    if ( wq_nthreads > 0 ) {
+	pthread_mutex_lock( &wq_mutex );
+    }
+#endif /* HAVE_PTHREAD */
+}
+
+    void
+wq_unlock( void )
+{
+#ifdef HAVE_PTHREAD
+    if ( wq_nthreads > 0 ) {
+	pthread_mutex_unlock( &wq_mutex );
+    }
+#endif /* HAVE_PTHREAD */
+}
+
+/*
+ * Sleep until some task finishes.  Called with the lock held.
+ */
+    void
+wq_wait( void )
+{
+#ifdef HAVE_PTHREAD
+    if ( wq_nthreads > 0 ) {
+	pthread_cond_wait( &wq_done, &wq_mutex );
+    }
+#endif /* HAVE_PTHREAD */
+}
+
+/*
+ * Let the workers drain the queue, then stop them.
+ */
+    void
+wq_free( void )
+{
+#ifdef HAVE_PTHREAD
+    int			i;
+
+    if ( wq_nthreads == 0 ) {
+	return;
+    }
+
+    pthread_mutex_lock( &wq_mutex );
+    wq_shutdown = 1;
+    pthread_cond_broadcast( &wq_work );
+    pthread_mutex_unlock( &wq_mutex );
+
+    for ( i = 0; i < wq_nthreads; i++ ) {
+	pthread_join( wq_tids[ i ], NULL );
+    }
+    free( wq_tids );
+    wq_tids = NULL;
+    wq_nthreads = 0;
+    wq_shutdown = 0;
+#endif /* HAVE_PTHREAD */
+}
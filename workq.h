@@ -0,0 +1,17 @@
+/*
+ * Copyright (c) 2003 Regents of The University of Michigan.
+ * All Rights Reserved.  See COPYRIGHT.
+ */
+
+#define WQ_HEAD		0
+#define WQ_TAIL		1
+
+int	wq_init( int nthreads );
+int	wq_threads( void );
+void	wq_push( void (*fn)( void * ), void *arg, int where );
+int	wq_cancel( void *arg );
+int	wq_promote( void *arg );
+void	wq_lock( void );
+void	wq_unlock( void );
+void	wq_wait( void );
+void	wq_free( void );